@@ -6,9 +6,75 @@
 #include <sys/socket.h>
 #include <netdb.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstring>
 #include <sstream>
 #include <stdexcept>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<ip_address>::value, "addresses are kept in per-connection tables");
+static_assert(std::is_trivially_copyable<socket_address>::value, "addresses are kept in per-connection tables");
+
+namespace
+{
+    // inet_ntoa returns a pointer to a static buffer and is not
+    // safe to use when several event loops run concurrently
+    std::string format_address(uint32_t addr_net)
+    {
+        in_addr tmp{};
+        tmp.s_addr = addr_net;
+        char buf[INET_ADDRSTRLEN];
+        char const* res = inet_ntop(AF_INET, &tmp, buf, sizeof buf);
+        assert(res != nullptr);
+        return res;
+    }
+
+    std::string format_address(unsigned char const* bytes)
+    {
+        char buf[INET6_ADDRSTRLEN];
+        char const* res = inet_ntop(AF_INET6, bytes, buf, sizeof buf);
+        assert(res != nullptr);
+        return res;
+    }
+
+    // finalizer of splitmix64, every bit of x affects every bit of the
+    // result, so sequential addresses don't collide in hash tables
+    uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    uint64_t hash_bytes(void const* data, size_t size, uint64_t seed)
+    {
+        unsigned char const* p = static_cast<unsigned char const*>(data);
+        uint64_t h = seed;
+        for (size_t i = 0; i < size; i += sizeof(uint64_t))
+        {
+            uint64_t word = 0;
+            memcpy(&word, p + i, std::min(sizeof word, size - i));
+            h = mix(h ^ word);
+        }
+        return h;
+    }
+
+    void throw_invalid_address(std::string const& text)
+    {
+        std::stringstream ss;
+        ss << '\'' << text << "' is not a valid ip address";
+        throw std::runtime_error(ss.str());
+    }
+}
+
+ipv4_address::ipv4_address()
+    : addr_net{}
+{}
 
 ipv4_address::ipv4_address(uint32_t addr_net)
     : addr_net(addr_net)
@@ -29,9 +95,7 @@ ipv4_address::ipv4_address(const std::string &text)
 
 std::string ipv4_address::to_string() const
 {
-    in_addr tmp{};
-    tmp.s_addr = addr_net;
-    return inet_ntoa(tmp);
+    return format_address(addr_net);
 }
 
 uint32_t ipv4_address::address_network() const
@@ -44,6 +108,21 @@ ipv4_address ipv4_address::any()
     return ipv4_address{INADDR_ANY};
 }
 
+size_t ipv4_address::hash() const
+{
+    return static_cast<size_t>(mix(addr_net));
+}
+
+bool operator==(ipv4_address const& a, ipv4_address const& b)
+{
+    return a.addr_net == b.addr_net;
+}
+
+bool operator!=(ipv4_address const& a, ipv4_address const& b)
+{
+    return !(a == b);
+}
+
 std::vector<ipv4_address> ipv4_address::resolve(std::string const& hostname)
 {
     addrinfo hints{};
@@ -106,18 +185,448 @@ ipv4_endpoint::ipv4_endpoint(uint16_t port_net, uint32_t addr_net)
     , addr_net(addr_net)
 {}
 
+bool operator==(ipv4_endpoint const& a, ipv4_endpoint const& b)
+{
+    return a.port_net == b.port_net && a.addr_net == b.addr_net;
+}
+
+bool operator!=(ipv4_endpoint const& a, ipv4_endpoint const& b)
+{
+    return !(a == b);
+}
+
+ipv6_address::ipv6_address()
+    : bytes()
+{}
+
+ipv6_address::ipv6_address(in6_addr const& addr)
+{
+    memcpy(bytes, &addr, sizeof bytes);
+}
+
+ipv6_address::ipv6_address(std::string const& text)
+{
+    in6_addr tmp{};
+    if (inet_pton(AF_INET6, text.c_str(), &tmp) != 1)
+        throw_invalid_address(text);
+    memcpy(bytes, &tmp, sizeof bytes);
+}
+
+std::string ipv6_address::to_string() const
+{
+    return format_address(bytes);
+}
+
+in6_addr ipv6_address::address_network() const
+{
+    in6_addr result;
+    memcpy(&result, bytes, sizeof bytes);
+    return result;
+}
+
+ipv6_address ipv6_address::any()
+{
+    return ipv6_address{in6addr_any};
+}
+
+ipv6_address ipv6_address::loopback()
+{
+    return ipv6_address{in6addr_loopback};
+}
+
+size_t ipv6_address::hash() const
+{
+    return static_cast<size_t>(hash_bytes(bytes, sizeof bytes, AF_INET6));
+}
+
+bool operator==(ipv6_address const& a, ipv6_address const& b)
+{
+    return memcmp(a.bytes, b.bytes, sizeof a.bytes) == 0;
+}
+
+bool operator!=(ipv6_address const& a, ipv6_address const& b)
+{
+    return !(a == b);
+}
+
+ipv6_endpoint::ipv6_endpoint()
+    : port_net{}
+    , scope{}
+{}
+
+ipv6_endpoint::ipv6_endpoint(uint16_t port_host, ipv6_address addr, uint32_t scope_id)
+    : port_net{htons(port_host)}
+    , addr(addr)
+    , scope(scope_id)
+{}
+
+uint16_t ipv6_endpoint::port() const
+{
+    return ntohs(port_net);
+}
+
+ipv6_address ipv6_endpoint::address() const
+{
+    return addr;
+}
+
+uint32_t ipv6_endpoint::scope_id() const
+{
+    return scope;
+}
+
+std::string ipv6_endpoint::to_string() const
+{
+    std::stringstream ss;
+    ss << *this;
+    return ss.str();
+}
+
+bool operator==(ipv6_endpoint const& a, ipv6_endpoint const& b)
+{
+    return a.port_net == b.port_net && a.addr == b.addr && a.scope == b.scope;
+}
+
+bool operator!=(ipv6_endpoint const& a, ipv6_endpoint const& b)
+{
+    return !(a == b);
+}
+
+ip_address::ip_address()
+    : addr_family(AF_INET)
+    , bytes()
+{}
+
+ip_address::ip_address(ipv4_address addr)
+    : addr_family(AF_INET)
+    , bytes()
+{
+    uint32_t addr_net = addr.address_network();
+    memcpy(bytes, &addr_net, sizeof addr_net);
+}
+
+ip_address::ip_address(ipv6_address addr)
+    : addr_family(AF_INET6)
+{
+    in6_addr tmp = addr.address_network();
+    memcpy(bytes, &tmp, sizeof bytes);
+}
+
+ip_address::ip_address(std::string const& text)
+    : addr_family(AF_INET)
+    , bytes()
+{
+    if (inet_pton(AF_INET, text.c_str(), bytes) == 1)
+        return;
+
+    addr_family = AF_INET6;
+    if (inet_pton(AF_INET6, text.c_str(), bytes) != 1)
+        throw_invalid_address(text);
+}
+
+int ip_address::family() const
+{
+    return addr_family;
+}
+
+ipv4_address ip_address::as_ipv4() const
+{
+    assert(addr_family == AF_INET);
+    uint32_t addr_net;
+    memcpy(&addr_net, bytes, sizeof addr_net);
+    return ipv4_address{addr_net};
+}
+
+ipv6_address ip_address::as_ipv6() const
+{
+    assert(addr_family == AF_INET6);
+    in6_addr tmp;
+    memcpy(&tmp, bytes, sizeof tmp);
+    return ipv6_address{tmp};
+}
+
+std::string ip_address::to_string() const
+{
+    return addr_family == AF_INET ? as_ipv4().to_string() : as_ipv6().to_string();
+}
+
+std::vector<ip_address> ip_address::resolve(std::string const& hostname)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* list_head;
+    int res = getaddrinfo(hostname.c_str(), nullptr, &hints, &list_head);
+    if (res != 0)
+    {
+        std::stringstream ss;
+        ss << "can not resolve server '" << hostname << "': " << gai_strerror(res);
+        throw std::runtime_error(ss.str());
+    }
+
+    std::vector<ip_address> r;
+
+    for (addrinfo* i = list_head; i != nullptr; i = i->ai_next)
+    {
+        assert(i->ai_socktype == SOCK_STREAM);
+        if (i->ai_family == AF_INET)
+            r.push_back(ipv4_address{reinterpret_cast<sockaddr_in const*>(i->ai_addr)->sin_addr.s_addr});
+        else if (i->ai_family == AF_INET6)
+            r.push_back(ipv6_address{reinterpret_cast<sockaddr_in6 const*>(i->ai_addr)->sin6_addr});
+    }
+
+    freeaddrinfo(list_head);
+
+    return r;
+}
+
+size_t ip_address::hash() const
+{
+    return static_cast<size_t>(hash_bytes(bytes, sizeof bytes, addr_family));
+}
+
+bool operator==(ip_address const& a, ip_address const& b)
+{
+    return a.addr_family == b.addr_family && memcmp(a.bytes, b.bytes, sizeof a.bytes) == 0;
+}
+
+bool operator!=(ip_address const& a, ip_address const& b)
+{
+    return !(a == b);
+}
+
+unix_endpoint::unix_endpoint()
+    : length(0)
+    , name()
+{}
+
+unix_endpoint::unix_endpoint(std::string const& path)
+    : length(0)
+    , name()
+{
+    // filesystem paths are stored with their terminating zero
+    if (path.empty() || path.size() >= sizeof name)
+    {
+        std::stringstream ss;
+        ss << '\'' << path << "' is not a valid unix socket path";
+        throw std::invalid_argument(ss.str());
+    }
+
+    memcpy(name, path.data(), path.size());
+    length = static_cast<uint8_t>(path.size());
+}
+
+std::string unix_endpoint::path() const
+{
+    return std::string(name, length);
+}
+
+bool unix_endpoint::is_abstract() const
+{
+    return length != 0 && name[0] == '@';
+}
+
+std::string unix_endpoint::to_string() const
+{
+    std::stringstream ss;
+    ss << *this;
+    return ss.str();
+}
+
+socket_address::socket_address()
+    : length(0)
+    , addr()
+{}
+
+socket_address::socket_address(ipv4_endpoint const& endpoint)
+    : length(sizeof(sockaddr_in))
+    , addr()
+{
+    addr.in.sin_family = AF_INET;
+    addr.in.sin_port = endpoint.port_net;
+    addr.in.sin_addr.s_addr = endpoint.addr_net;
+}
+
+socket_address::socket_address(ipv6_endpoint const& endpoint)
+    : length(sizeof(sockaddr_in6))
+    , addr()
+{
+    addr.in6.sin6_family = AF_INET6;
+    addr.in6.sin6_port = endpoint.port_net;
+    addr.in6.sin6_addr = endpoint.addr.address_network();
+    addr.in6.sin6_scope_id = endpoint.scope;
+}
+
+socket_address::socket_address(ip_address const& address, uint16_t port_host)
+    : socket_address()
+{
+    if (address.family() == AF_INET)
+        *this = ipv4_endpoint(port_host, address.as_ipv4());
+    else
+        *this = ipv6_endpoint(port_host, address.as_ipv6());
+}
+
+socket_address::socket_address(unix_endpoint const& endpoint)
+    : length(offsetof(sockaddr_un, sun_path))
+    , addr()
+{
+    addr.un.sun_family = AF_UNIX;
+    if (endpoint.length == 0)
+        return;
+
+    // the kernel tells an abstract name by its leading zero byte and
+    // takes its length from the address size, not from a terminator
+    memcpy(addr.un.sun_path, endpoint.name, endpoint.length);
+    if (endpoint.is_abstract())
+    {
+        addr.un.sun_path[0] = '\0';
+        length += endpoint.length;
+    }
+    else
+        length += endpoint.length + 1;
+}
+
+socket_address::socket_address(sockaddr const* addr, socklen_t size)
+    : length(size)
+    , addr()
+{
+    if (size > sizeof this->addr)
+        throw std::invalid_argument("socket address is too large");
+    memcpy(&this->addr, addr, size);
+}
+
+int socket_address::family() const
+{
+    return length == 0 ? AF_UNSPEC : addr.generic.sa_family;
+}
+
+ipv4_endpoint socket_address::as_ipv4() const
+{
+    assert(family() == AF_INET);
+    return ipv4_endpoint{addr.in.sin_port, addr.in.sin_addr.s_addr};
+}
+
+ipv6_endpoint socket_address::as_ipv6() const
+{
+    assert(family() == AF_INET6);
+    return ipv6_endpoint{ntohs(addr.in6.sin6_port), ipv6_address{addr.in6.sin6_addr}, addr.in6.sin6_scope_id};
+}
+
+unix_endpoint socket_address::as_unix() const
+{
+    assert(family() == AF_UNIX);
+
+    unix_endpoint result;
+    size_t size = length - offsetof(sockaddr_un, sun_path);
+    if (size == 0)
+        return result;
+
+    if (addr.un.sun_path[0] == '\0')
+    {
+        memcpy(result.name, addr.un.sun_path, size);
+        result.name[0] = '@';
+    }
+    else
+    {
+        // reported with or without the terminating zero
+        size = strnlen(addr.un.sun_path, size);
+        memcpy(result.name, addr.un.sun_path, size);
+    }
+    result.length = static_cast<uint8_t>(size);
+    return result;
+}
+
+sockaddr const* socket_address::data() const
+{
+    return &addr.generic;
+}
+
+socklen_t socket_address::size() const
+{
+    return length;
+}
+
+std::string socket_address::to_string() const
+{
+    std::stringstream ss;
+    ss << *this;
+    return ss.str();
+}
+
+size_t socket_address::hash() const
+{
+    return static_cast<size_t>(hash_bytes(&addr, length, length));
+}
+
+bool operator==(socket_address const& a, socket_address const& b)
+{
+    return a.length == b.length && memcmp(&a.addr, &b.addr, a.length) == 0;
+}
+
+bool operator!=(socket_address const& a, socket_address const& b)
+{
+    return !(a == b);
+}
+
 std::ostream& operator<<(std::ostream& os, ipv4_address const& addr)
 {
-    in_addr tmp{};
-    tmp.s_addr = addr.addr_net;
-    os << inet_ntoa(tmp);
+    os << format_address(addr.addr_net);
     return os;
 }
 
 std::ostream& operator<<(std::ostream& os, ipv4_endpoint const& endpoint)
 {
-    in_addr tmp{};
-    tmp.s_addr = endpoint.addr_net;
-    os << inet_ntoa(tmp) << ':' << endpoint.port();
+    os << format_address(endpoint.addr_net) << ':' << endpoint.port();
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, ipv6_address const& addr)
+{
+    os << format_address(addr.bytes);
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, ipv6_endpoint const& endpoint)
+{
+    os << '[' << endpoint.addr;
+    if (endpoint.scope != 0)
+        os << '%' << endpoint.scope;
+    os << "]:" << endpoint.port();
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, ip_address const& addr)
+{
+    os << addr.to_string();
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, unix_endpoint const& endpoint)
+{
+    if (endpoint.length == 0)
+        os << "<unnamed>";
+    else
+        os << endpoint.path();
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, socket_address const& address)
+{
+    switch (address.family())
+    {
+    case AF_INET:
+        os << address.as_ipv4();
+        break;
+    case AF_INET6:
+        os << address.as_ipv6();
+        break;
+    case AF_UNIX:
+        os << address.as_unix();
+        break;
+    default:
+        os << "<unspecified>";
+        break;
+    }
     return os;
 }
@@ -2,7 +2,11 @@
 #define ADDRESS_H
 
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <ostream>
 #include <vector>
@@ -18,8 +22,14 @@ struct ipv4_address
     uint32_t address_network() const;
 
     static ipv4_address any();
+    // A records only, see ip_address::resolve
     static std::vector<ipv4_address> resolve(std::string const& hostname);
 
+    size_t hash() const;
+
+    friend bool operator==(ipv4_address const& a, ipv4_address const& b);
+    friend bool operator!=(ipv4_address const& a, ipv4_address const& b);
+
 private:
     uint32_t addr_net;
 
@@ -37,6 +47,9 @@ struct ipv4_endpoint
 
     std::string to_string() const;
 
+    friend bool operator==(ipv4_endpoint const& a, ipv4_endpoint const& b);
+    friend bool operator!=(ipv4_endpoint const& a, ipv4_endpoint const& b);
+
 private:
     ipv4_endpoint(uint16_t port_net, uint32_t addr_net);
 
@@ -46,9 +59,200 @@ private:
     friend std::ostream& operator<<(std::ostream& os, ipv4_endpoint const& endpoint);
     friend struct client_socket;
     friend struct server_socket;
+    friend struct datagram_batch;
+    friend struct datagram_socket;
+    friend struct socket_address;
+};
+
+struct ipv6_address
+{
+    ipv6_address();
+    explicit ipv6_address(in6_addr const& addr);
+    ipv6_address(std::string const& text);
+
+    std::string to_string() const;
+
+    in6_addr address_network() const;
+
+    static ipv6_address any();
+    static ipv6_address loopback();
+
+    size_t hash() const;
+
+    friend bool operator==(ipv6_address const& a, ipv6_address const& b);
+    friend bool operator!=(ipv6_address const& a, ipv6_address const& b);
+
+private:
+    unsigned char bytes[16];
+
+    friend std::ostream& operator<<(std::ostream& os, ipv6_address const& addr);
+};
+
+struct ipv6_endpoint
+{
+    ipv6_endpoint();
+    // scope_id is the interface index of link-local addresses
+    ipv6_endpoint(uint16_t port_host, ipv6_address, uint32_t scope_id = 0);
+
+    uint16_t port() const;
+    ipv6_address address() const;
+    uint32_t scope_id() const;
+
+    // "[address]:port"
+    std::string to_string() const;
+
+    friend bool operator==(ipv6_endpoint const& a, ipv6_endpoint const& b);
+    friend bool operator!=(ipv6_endpoint const& a, ipv6_endpoint const& b);
+
+private:
+    uint16_t port_net;
+    ipv6_address addr;
+    uint32_t scope;
+
+    friend std::ostream& operator<<(std::ostream& os, ipv6_endpoint const& endpoint);
+    friend struct socket_address;
+};
+
+// Address of either family. Trivially copyable and compared and hashed
+// as a few machine words, cheap enough to key per-connection tables.
+struct ip_address
+{
+    ip_address();
+    ip_address(ipv4_address addr);
+    ip_address(ipv6_address addr);
+    // either notation
+    explicit ip_address(std::string const& text);
+
+    // AF_INET or AF_INET6
+    int family() const;
+    ipv4_address as_ipv4() const;
+    ipv6_address as_ipv6() const;
+
+    std::string to_string() const;
+
+    // A and AAAA records, in the order of getaddrinfo()
+    static std::vector<ip_address> resolve(std::string const& hostname);
+
+    size_t hash() const;
+
+    friend bool operator==(ip_address const& a, ip_address const& b);
+    friend bool operator!=(ip_address const& a, ip_address const& b);
+
+private:
+    uint16_t addr_family;
+    // IPv4 addresses take the first 4 bytes, the rest is zero
+    unsigned char bytes[16];
+};
+
+// Address of an AF_UNIX socket: a filesystem path, or a name in the
+// abstract namespace when written with a leading '@'. Abstract names
+// are not visible in the filesystem and disappear with the socket.
+struct unix_endpoint
+{
+    // unnamed, e.g. the peer of an accepted connection
+    unix_endpoint();
+    explicit unix_endpoint(std::string const& path);
+
+    // with the leading '@' for abstract names
+    std::string path() const;
+    bool is_abstract() const;
+
+    std::string to_string() const;
+
+private:
+    uint8_t length;
+    char name[sizeof(sockaddr_un::sun_path)];
+
+    friend std::ostream& operator<<(std::ostream& os, unix_endpoint const& endpoint);
+    friend struct socket_address;
+};
+
+// Address a stream socket is bound or connected to: an ipv4_endpoint,
+// an ipv6_endpoint or a unix_endpoint. Trivially copyable, kept in its
+// native form so it is passed to the system calls as is.
+struct socket_address
+{
+    socket_address();
+    socket_address(ipv4_endpoint const& endpoint);
+    socket_address(ipv6_endpoint const& endpoint);
+    socket_address(unix_endpoint const& endpoint);
+    socket_address(ip_address const& address, uint16_t port_host);
+    // from getsockname() and the like
+    socket_address(sockaddr const* addr, socklen_t size);
+
+    // AF_INET, AF_INET6 or AF_UNIX
+    int family() const;
+    ipv4_endpoint as_ipv4() const;
+    ipv6_endpoint as_ipv6() const;
+    unix_endpoint as_unix() const;
+
+    sockaddr const* data() const;
+    socklen_t size() const;
+
+    std::string to_string() const;
+
+    // of the bytes that are in use, the rest of the storage is ignored
+    size_t hash() const;
+
+    friend bool operator==(socket_address const& a, socket_address const& b);
+    friend bool operator!=(socket_address const& a, socket_address const& b);
+
+private:
+    socklen_t length;
+    union
+    {
+        sockaddr generic;
+        sockaddr_in in;
+        sockaddr_in6 in6;
+        sockaddr_un un;
+    } addr;
 };
 
 std::ostream& operator<<(std::ostream& os, ipv4_address const& addr);
 std::ostream& operator<<(std::ostream& os, ipv4_endpoint const& endpoint);
+std::ostream& operator<<(std::ostream& os, ipv6_address const& addr);
+std::ostream& operator<<(std::ostream& os, ipv6_endpoint const& endpoint);
+std::ostream& operator<<(std::ostream& os, ip_address const& addr);
+std::ostream& operator<<(std::ostream& os, unix_endpoint const& endpoint);
+std::ostream& operator<<(std::ostream& os, socket_address const& address);
+
+namespace std
+{
+    template <>
+    struct hash<ipv4_address>
+    {
+        size_t operator()(ipv4_address const& addr) const
+        {
+            return addr.hash();
+        }
+    };
+
+    template <>
+    struct hash<ipv6_address>
+    {
+        size_t operator()(ipv6_address const& addr) const
+        {
+            return addr.hash();
+        }
+    };
+
+    template <>
+    struct hash<ip_address>
+    {
+        size_t operator()(ip_address const& addr) const
+        {
+            return addr.hash();
+        }
+    };
+
+    template <>
+    struct hash<socket_address>
+    {
+        size_t operator()(socket_address const& addr) const
+        {
+            return addr.hash();
+        }
+    };
+}
 
 #endif // ADDRESS_H
@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <unordered_set>
+#include "socket.h"
+
+TEST(ipv6_address, parse01)
+{
+    ipv6_address a("2001:db8::1");
+    EXPECT_EQ(a.to_string(), "2001:db8::1");
+    EXPECT_EQ(ipv6_address::loopback().to_string(), "::1");
+    EXPECT_EQ(ipv6_address::any().to_string(), "::");
+    EXPECT_THROW(ipv6_address("2001:db8::g"), std::runtime_error);
+    EXPECT_THROW(ipv6_address("10.0.0.1"), std::runtime_error);
+
+    EXPECT_EQ(ipv6_endpoint(443, a).to_string(), "[2001:db8::1]:443");
+    EXPECT_EQ(ipv6_endpoint(80, ipv6_address("fe80::1"), 2).to_string(), "[fe80::1%2]:80");
+}
+
+TEST(ip_address, parse01)
+{
+    ip_address v4("10.0.0.1");
+    EXPECT_EQ(v4.family(), AF_INET);
+    EXPECT_EQ(v4.as_ipv4(), ipv4_address("10.0.0.1"));
+    EXPECT_EQ(v4.to_string(), "10.0.0.1");
+
+    ip_address v6("::ffff:10.0.0.1");
+    EXPECT_EQ(v6.family(), AF_INET6);
+    EXPECT_EQ(v6.to_string(), "::ffff:10.0.0.1");
+
+    EXPECT_THROW(ip_address("localhost"), std::runtime_error);
+}
+
+TEST(ip_address, hash01)
+{
+    EXPECT_TRUE(std::is_trivially_copyable<ip_address>::value);
+    EXPECT_TRUE(std::is_trivially_copyable<socket_address>::value);
+
+    EXPECT_EQ(ip_address("::1"), ip_address(ipv6_address::loopback()));
+    EXPECT_NE(ip_address("0.0.0.1"), ip_address("::1"));
+    EXPECT_EQ(ip_address("10.0.0.1").hash(), ip_address(ipv4_address("10.0.0.1")).hash());
+
+    std::unordered_set<ip_address> addresses;
+    for (int i = 0; i != 256; ++i)
+    {
+        addresses.insert(ip_address("10.0.0." + std::to_string(i)));
+        addresses.insert(ip_address("2001:db8::" + std::to_string(i)));
+    }
+    addresses.insert(ip_address("10.0.0.1"));
+    EXPECT_EQ(addresses.size(), 512u);
+    EXPECT_EQ(addresses.count(ip_address("2001:db8::255")), 1u);
+
+    std::unordered_set<socket_address> endpoints;
+    endpoints.insert(socket_address(ip_address("10.0.0.1"), 80));
+    endpoints.insert(socket_address(ip_address("10.0.0.1"), 81));
+    endpoints.insert(ipv4_endpoint(80, ipv4_address("10.0.0.1")));
+    endpoints.insert(unix_endpoint("@x"));
+    EXPECT_EQ(endpoints.size(), 3u);
+}
+
+TEST(ip_address, resolve01)
+{
+    std::vector<ip_address> v4 = ip_address::resolve("127.0.0.1");
+    ASSERT_EQ(v4.size(), 1u);
+    EXPECT_EQ(v4[0], ip_address("127.0.0.1"));
+
+    std::vector<ip_address> v6 = ip_address::resolve("::1");
+    ASSERT_EQ(v6.size(), 1u);
+    EXPECT_EQ(v6[0], ip_address(ipv6_address::loopback()));
+}
+
+TEST(unix_endpoint, path01)
+{
+    unix_endpoint e("/tmp/echo.sock");
+    EXPECT_EQ(e.path(), "/tmp/echo.sock");
+    EXPECT_FALSE(e.is_abstract());
+    EXPECT_EQ(e.to_string(), "/tmp/echo.sock");
+
+    unix_endpoint a("@echo");
+    EXPECT_EQ(a.path(), "@echo");
+    EXPECT_TRUE(a.is_abstract());
+
+    EXPECT_EQ(unix_endpoint().to_string(), "<unnamed>");
+}
+
+TEST(unix_endpoint, invalid01)
+{
+    EXPECT_THROW(unix_endpoint(""), std::invalid_argument);
+    EXPECT_THROW(unix_endpoint(std::string(sizeof(sockaddr_un::sun_path), 'x')), std::invalid_argument);
+    EXPECT_NO_THROW(unix_endpoint(std::string(sizeof(sockaddr_un::sun_path) - 1, 'x')));
+}
+
+TEST(socket_address, native01)
+{
+    socket_address path = unix_endpoint("/tmp/x");
+    EXPECT_EQ(path.family(), AF_UNIX);
+    EXPECT_EQ(path.size(), offsetof(sockaddr_un, sun_path) + 7);
+    EXPECT_STREQ(reinterpret_cast<sockaddr_un const*>(path.data())->sun_path, "/tmp/x");
+    EXPECT_EQ(path.as_unix().path(), "/tmp/x");
+
+    // abstract names start with a zero byte and have no terminator
+    socket_address abstract = unix_endpoint("@x");
+    EXPECT_EQ(abstract.size(), offsetof(sockaddr_un, sun_path) + 2);
+    EXPECT_EQ(reinterpret_cast<sockaddr_un const*>(abstract.data())->sun_path[0], '\0');
+    EXPECT_EQ(abstract.as_unix().path(), "@x");
+
+    socket_address ip6 = socket_address(ip_address("::1"), 8080);
+    EXPECT_EQ(ip6.family(), AF_INET6);
+    EXPECT_EQ(ip6.size(), sizeof(sockaddr_in6));
+    EXPECT_EQ(ip6.to_string(), "[::1]:8080");
+    EXPECT_EQ(ip6.as_ipv6(), ipv6_endpoint(8080, ipv6_address::loopback()));
+
+    socket_address ip = ipv4_endpoint(80, ipv4_address("10.0.0.1"));
+    EXPECT_EQ(ip.family(), AF_INET);
+    EXPECT_EQ(ip.size(), sizeof(sockaddr_in));
+    EXPECT_EQ(ip.to_string(), "10.0.0.1:80");
+    EXPECT_EQ(ip.as_ipv4().port(), 80);
+
+    EXPECT_EQ(socket_address().family(), AF_UNSPEC);
+}
+
+TEST(socket_address, unix_connect01)
+{
+    epoll ep;
+    std::unique_ptr<client_socket> accepted;
+    server_socket ss(ep, unix_endpoint("@address_test"), [&] {
+        accepted.reset(new client_socket(ss.accept(client_socket::on_ready_t{})));
+        ep.stop();
+    });
+    EXPECT_EQ(ss.local_endpoint().to_string(), "@address_test");
+
+    client_socket c = client_socket::connect(ep, ss.local_endpoint(), std::chrono::seconds(1),
+                                             [] {}, client_socket::on_ready_t{});
+
+    ep.run();
+    ASSERT_TRUE(static_cast<bool>(accepted));
+
+    // the listener of another loop accepts from the same socket
+    epoll ep2;
+    bool accepted2 = false;
+    server_socket shared(ep2, ss, [&] {
+        client_socket s = shared.accept(client_socket::on_ready_t{});
+        accepted2 = true;
+        ep2.stop();
+    });
+    client_socket c2 = client_socket::connect(ep2, ss.local_endpoint(), client_socket::on_ready_t{});
+    ep2.run();
+    EXPECT_TRUE(accepted2);
+}
+
+TEST(socket_address, dual_stack01)
+{
+    epoll ep;
+    size_t accepted = 0;
+    server_socket ss(ep, ipv6_endpoint(0, ipv6_address::any()), [&] {
+        client_socket s = ss.accept(client_socket::on_ready_t{});
+        if (++accepted == 2)
+            ep.stop();
+    });
+    uint16_t port = ss.local_endpoint().as_ipv6().port();
+
+    // a listener on [::] takes both families unless v6only is set
+    client_socket c4 = client_socket::connect(ep, ipv4_endpoint(port, ipv4_address("127.0.0.1")), client_socket::on_ready_t{});
+    client_socket c6 = client_socket::connect(ep, ipv6_endpoint(port, ipv6_address::loopback()), client_socket::on_ready_t{});
+    ep.run();
+    EXPECT_EQ(accepted, 2u);
+}
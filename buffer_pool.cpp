@@ -0,0 +1,123 @@
+#include "buffer_pool.h"
+
+#include <sys/mman.h>
+#include <errno.h>
+
+#include <cassert>
+
+#include "throw_error.h"
+
+namespace
+{
+    size_t const class_sizes[buffer_pool::number_of_classes] = {4 * 1024, 16 * 1024, 64 * 1024};
+
+    void* map_chunk(bool hugepages)
+    {
+        if (hugepages)
+        {
+            void* p = ::mmap(nullptr, buffer_pool::chunk_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED)
+                return p;
+        }
+
+        void* p = ::mmap(nullptr, buffer_pool::chunk_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw_error(errno, "mmap()");
+
+        // no huge pages are reserved, a transparent one is still better
+        // than 512 small ones; failing is harmless
+        if (hugepages)
+            ::madvise(p, buffer_pool::chunk_size, MADV_HUGEPAGE);
+
+        return p;
+    }
+}
+
+size_t const io_buffer::header_size;
+
+char* io_buffer::data()
+{
+    return reinterpret_cast<char*>(this) + header_size;
+}
+
+size_t io_buffer::capacity() const
+{
+    return buffer_pool::class_capacity(size_class);
+}
+
+size_t const buffer_pool::number_of_classes;
+size_t const buffer_pool::chunk_size;
+
+buffer_pool::buffer_pool()
+    : hugepages(false)
+    , buffers_in_use(0)
+    , free_lists()
+{
+    static_assert(sizeof(io_buffer) <= io_buffer::header_size, "io_buffer header doesn't fit");
+}
+
+buffer_pool::~buffer_pool()
+{
+    for (void* chunk : chunks)
+        ::munmap(chunk, chunk_size);
+}
+
+void buffer_pool::set_hugepages(bool enabled)
+{
+    hugepages = enabled;
+}
+
+io_buffer* buffer_pool::acquire(size_t min_capacity)
+{
+    size_t size_class = 0;
+    while (size_class + 1 != number_of_classes && class_capacity(size_class) < min_capacity)
+        ++size_class;
+
+    if (!free_lists[size_class])
+        add_chunk(size_class);
+
+    io_buffer* buffer = free_lists[size_class];
+    free_lists[size_class] = buffer->next_free;
+    buffer->start = 0;
+    buffer->end = 0;
+    ++buffers_in_use;
+    return buffer;
+}
+
+void buffer_pool::release(io_buffer* buffer) noexcept
+{
+    assert(buffers_in_use != 0);
+    buffer->next_free = free_lists[buffer->size_class];
+    free_lists[buffer->size_class] = buffer;
+    --buffers_in_use;
+}
+
+size_t buffer_pool::in_use() const
+{
+    return buffers_in_use;
+}
+
+size_t buffer_pool::class_capacity(size_t size_class)
+{
+    assert(size_class < number_of_classes);
+    return class_sizes[size_class] - io_buffer::header_size;
+}
+
+void buffer_pool::add_chunk(size_t size_class)
+{
+    chunks.reserve(chunks.size() + 1);
+    char* chunk = static_cast<char*>(map_chunk(hugepages));
+    chunks.push_back(chunk);
+
+    // buffers are handed out in address order
+    size_t buffer_size = class_sizes[size_class];
+    for (size_t i = chunk_size / buffer_size; i != 0; --i)
+    {
+        io_buffer* buffer = reinterpret_cast<io_buffer*>(chunk + (i - 1) * buffer_size);
+        buffer->size_class = static_cast<uint32_t>(size_class);
+        buffer->next_free = free_lists[size_class];
+        free_lists[size_class] = buffer;
+    }
+}
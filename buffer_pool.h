@@ -0,0 +1,71 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Buffer borrowed from a buffer_pool. The header is stored in front of the
+// data, so holding a buffer costs a connection a single pointer.
+struct io_buffer
+{
+    char* data();
+    size_t capacity() const;
+
+    // bytes start..end of data() are filled and not consumed yet
+    uint32_t start;
+    uint32_t end;
+
+    // the data starts a cache line after the header
+    static size_t const header_size = 64;
+
+private:
+    io_buffer* next_free;
+    uint32_t size_class;
+
+    friend struct buffer_pool;
+};
+
+// Per-loop pool of I/O buffers. Connections borrow a buffer only while they
+// hold data that was read and not yet written and give it back right after,
+// so idle connections own no buffer memory. Buffers come in a few size
+// classes, asking for more than a full buffer held moves a bulk transfer to
+// a bigger class. Memory is mapped in chunks, optionally backed by huge
+// pages, and kept for reuse.
+// Not thread safe: an instance belongs to one loop.
+struct buffer_pool
+{
+    buffer_pool();
+    buffer_pool(buffer_pool const&) = delete;
+    buffer_pool& operator=(buffer_pool const&) = delete;
+    ~buffer_pool();
+
+    // chunks mapped after the call use MAP_HUGETLB, or transparent huge
+    // pages when no huge pages are reserved
+    void set_hugepages(bool enabled);
+
+    // returns an empty buffer of the smallest class that holds
+    // min_capacity bytes, or of the largest class
+    io_buffer* acquire(size_t min_capacity);
+    void release(io_buffer* buffer) noexcept;
+
+    // number of buffers borrowed and not released yet
+    size_t in_use() const;
+
+    static size_t const number_of_classes = 3;
+    static size_t const chunk_size = 2 * 1024 * 1024;
+
+    // capacity of the buffers of a class
+    static size_t class_capacity(size_t size_class);
+
+private:
+    void add_chunk(size_t size_class);
+
+private:
+    bool hugepages;
+    size_t buffers_in_use;
+    io_buffer* free_lists[number_of_classes];
+    std::vector<void*> chunks;
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <set>
+#include <vector>
+#include "buffer_pool.h"
+
+TEST(buffer_pool, acquire01)
+{
+    buffer_pool pool;
+    io_buffer* b = pool.acquire(100);
+    EXPECT_EQ(b->start, 0u);
+    EXPECT_EQ(b->end, 0u);
+    EXPECT_EQ(b->capacity(), buffer_pool::class_capacity(0));
+    EXPECT_GE(b->capacity(), 100u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(b->data()) % io_buffer::header_size, 0u);
+    memset(b->data(), 'x', b->capacity());
+    pool.release(b);
+}
+
+TEST(buffer_pool, size_classes01)
+{
+    buffer_pool pool;
+    for (size_t i = 0; i != buffer_pool::number_of_classes; ++i)
+    {
+        io_buffer* b = pool.acquire(buffer_pool::class_capacity(i));
+        EXPECT_EQ(b->capacity(), buffer_pool::class_capacity(i));
+        pool.release(b);
+    }
+
+    // asking for more than a full buffer moves to the next class
+    io_buffer* b = pool.acquire(buffer_pool::class_capacity(0) + 1);
+    EXPECT_EQ(b->capacity(), buffer_pool::class_capacity(1));
+    pool.release(b);
+}
+
+TEST(buffer_pool, largest_class01)
+{
+    buffer_pool pool;
+    io_buffer* b = pool.acquire(100 * 1024 * 1024);
+    EXPECT_EQ(b->capacity(), buffer_pool::class_capacity(buffer_pool::number_of_classes - 1));
+    pool.release(b);
+}
+
+TEST(buffer_pool, reuse01)
+{
+    buffer_pool pool;
+    io_buffer* a = pool.acquire(0);
+    a->end = 10;
+    pool.release(a);
+    io_buffer* b = pool.acquire(0);
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(b->end, 0u);
+    pool.release(b);
+}
+
+TEST(buffer_pool, in_use01)
+{
+    buffer_pool pool;
+    EXPECT_EQ(pool.in_use(), 0u);
+
+    std::vector<io_buffer*> buffers;
+    std::set<char*> distinct;
+    // more than a chunk holds
+    for (size_t i = 0; i != 1000; ++i)
+    {
+        buffers.push_back(pool.acquire(0));
+        distinct.insert(buffers.back()->data());
+    }
+    EXPECT_EQ(pool.in_use(), 1000u);
+    EXPECT_EQ(distinct.size(), 1000u);
+
+    for (io_buffer* b : buffers)
+        pool.release(b);
+    EXPECT_EQ(pool.in_use(), 0u);
+}
+
+TEST(buffer_pool, hugepages01)
+{
+    // works without reserved huge pages too
+    buffer_pool pool;
+    pool.set_hugepages(true);
+    io_buffer* b = pool.acquire(0);
+    memset(b->data(), 'x', b->capacity());
+    pool.release(b);
+}
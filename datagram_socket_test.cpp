@@ -0,0 +1,208 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include "socket.h"
+
+namespace
+{
+    ipv4_endpoint loopback(uint16_t port)
+    {
+        return ipv4_endpoint(port, ipv4_address("127.0.0.1"));
+    }
+}
+
+TEST(datagram_batch, push01)
+{
+    datagram_batch batch(2, 100);
+    EXPECT_EQ(batch.capacity(), 2u);
+    EXPECT_EQ(batch.max_message_size(), 100u);
+    EXPECT_EQ(batch.size(), 0u);
+
+    EXPECT_TRUE(batch.push("abc", 3, loopback(1)));
+    EXPECT_FALSE(batch.push(std::string(101, 'x').data(), 101, loopback(1)));
+    EXPECT_TRUE(batch.push("defgh", 5, loopback(2), 2));
+    EXPECT_FALSE(batch.push("i", 1, loopback(3)));
+
+    EXPECT_EQ(batch.size(), 2u);
+    EXPECT_EQ(std::string(batch.data(0), batch.message_size(0)), "abc");
+    EXPECT_EQ(batch.segment_size(0), 0u);
+    EXPECT_EQ(batch.peer(0).to_string(), loopback(1).to_string());
+    EXPECT_EQ(std::string(batch.data(1), batch.message_size(1)), "defgh");
+    EXPECT_EQ(batch.segment_size(1), 2u);
+
+    batch.clear();
+    EXPECT_EQ(batch.size(), 0u);
+}
+
+TEST(datagram_batch, push02)
+{
+    // UDP_SEGMENT takes 16 bits
+    datagram_batch batch(1, 100000);
+    std::string data(70000, 'x');
+    EXPECT_THROW(batch.push(data.data(), data.size(), loopback(1), 65536), std::invalid_argument);
+    EXPECT_TRUE(batch.push(data.data(), data.size(), loopback(1), 65535));
+}
+
+TEST(datagram_socket, send_receive01)
+{
+    epoll ep;
+    datagram_socket a(ep, loopback(0), socket_options{});
+    datagram_socket b(ep, loopback(0), socket_options{});
+
+    datagram_batch out(8, 100);
+    for (int i = 0; i != 8; ++i)
+    {
+        std::string s = "message " + std::to_string(i);
+        ASSERT_TRUE(out.push(s.data(), s.size(), b.local_endpoint()));
+    }
+    EXPECT_EQ(a.send(out, 0), 8u);
+
+    datagram_batch in(4, 100);
+    std::vector<std::string> received;
+    b.set_on_read_write([&] {
+        while (size_t n = b.receive(in))
+        {
+            for (size_t i = 0; i != n; ++i)
+            {
+                EXPECT_EQ(in.peer(i).to_string(), a.local_endpoint().to_string());
+                received.push_back(std::string(in.data(i), in.message_size(i)));
+            }
+        }
+        if (received.size() == 8)
+            ep.stop();
+    }, datagram_socket::on_ready_t{});
+    ep.run();
+
+    ASSERT_EQ(received.size(), 8u);
+    for (int i = 0; i != 8; ++i)
+        EXPECT_EQ(received[i], "message " + std::to_string(i));
+}
+
+TEST(datagram_socket, segments01)
+{
+    epoll ep;
+    datagram_socket a(ep, loopback(0), socket_options{});
+    datagram_socket b(ep, loopback(0), socket_options{});
+    a.connect(b.local_endpoint());
+
+    // without GRO on the receiver a segmented message arrives as separate datagrams
+    datagram_batch out(1, 100);
+    ASSERT_TRUE(out.push("aaabbbcc", 8, b.local_endpoint(), 3));
+    EXPECT_EQ(a.send(out, 0), 1u);
+
+    datagram_batch in(8, 100);
+    std::vector<std::string> received;
+    b.set_on_read_write([&] {
+        while (size_t n = b.receive(in))
+            for (size_t i = 0; i != n; ++i)
+                received.push_back(std::string(in.data(i), in.message_size(i)));
+        if (received.size() == 3)
+            ep.stop();
+    }, datagram_socket::on_ready_t{});
+    ep.run();
+
+    ASSERT_EQ(received.size(), 3u);
+    EXPECT_EQ(received[0], "aaa");
+    EXPECT_EQ(received[1], "bbb");
+    EXPECT_EQ(received[2], "cc");
+}
+
+TEST(datagram_socket, connect_refused01)
+{
+    epoll ep;
+    socket_address remote;
+    {
+        // nobody listens on the port once the socket is closed
+        datagram_socket closed(ep, loopback(0), socket_options{});
+        remote = closed.local_endpoint();
+    }
+
+    datagram_socket a(ep, loopback(0), socket_options{});
+    a.connect(remote);
+    datagram_batch out(1, 100);
+    ASSERT_TRUE(out.push("abc", 3, remote));
+    EXPECT_EQ(a.send(out, 0), 1u);
+
+    // the ICMP error reaches the read handler through receive(), it is
+    // not thrown by the loop
+    datagram_batch in(1, 100);
+    std::string error;
+    a.set_on_read_write([&] {
+        try
+        {
+            a.receive(in);
+        }
+        catch (std::exception const& e)
+        {
+            error = e.what();
+        }
+        ep.stop();
+    }, datagram_socket::on_ready_t{});
+
+    testing::internal::CaptureStderr();
+    timer_element deadline(ep.get_timer(), std::chrono::seconds(5), [&ep] { ep.stop(); });
+    ep.run();
+    EXPECT_EQ(testing::internal::GetCapturedStderr(), "");
+    EXPECT_NE(error.find("ECONNREFUSED"), std::string::npos) << error;
+}
+
+TEST(datagram_socket, ipv6_01)
+{
+    epoll ep;
+    socket_address local(ipv6_endpoint(0, ipv6_address::loopback()));
+    datagram_socket a(ep, local, socket_options{});
+    datagram_socket b(ep, local, socket_options{});
+
+    datagram_batch out(1, 100);
+    ASSERT_TRUE(out.push("abc", 3, b.local_endpoint()));
+    EXPECT_EQ(a.send(out, 0), 1u);
+
+    datagram_batch in(4, 100);
+    std::string received;
+    b.set_on_read_write([&] {
+        while (size_t n = b.receive(in))
+        {
+            for (size_t i = 0; i != n; ++i)
+            {
+                EXPECT_EQ(in.peer(i), a.local_endpoint());
+                received.append(in.data(i), in.message_size(i));
+            }
+        }
+        ep.stop();
+    }, datagram_socket::on_ready_t{});
+    ep.run();
+
+    EXPECT_EQ(received, "abc");
+}
+
+TEST(datagram_socket, dual_stack01)
+{
+    epoll ep;
+    // [::] without v6only receives from IPv4 peers, the reply goes to
+    // the IPv4-mapped address it came from
+    datagram_socket server(ep, ipv6_endpoint(0, ipv6_address::any()), socket_options{});
+    datagram_socket client(ep, loopback(0), socket_options{});
+
+    datagram_batch out(1, 100);
+    ASSERT_TRUE(out.push("ping", 4, loopback(server.local_endpoint().as_ipv6().port())));
+    EXPECT_EQ(client.send(out, 0), 1u);
+
+    datagram_batch echo(4, 100);
+    server.set_on_read_write([&] {
+        size_t n = server.receive(echo);
+        EXPECT_EQ(server.send(echo, 0), n);
+    }, datagram_socket::on_ready_t{});
+
+    datagram_batch in(4, 100);
+    std::string received;
+    client.set_on_read_write([&] {
+        while (size_t n = client.receive(in))
+            for (size_t i = 0; i != n; ++i)
+                received.append(in.data(i), in.message_size(i));
+        ep.stop();
+    }, datagram_socket::on_ready_t{});
+
+    timer_element deadline(ep.get_timer(), std::chrono::seconds(5), [&ep] { ep.stop(); });
+    ep.run();
+    EXPECT_EQ(received, "ping");
+}
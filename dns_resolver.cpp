@@ -0,0 +1,895 @@
+#include "dns_resolver.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "socket.h"
+
+namespace
+{
+    uint16_t const type_a = 1;
+    uint16_t const type_aaaa = 28;
+    uint16_t const class_in = 1;
+
+    uint16_t const flag_response = 0x8000;
+    uint16_t const flag_truncated = 0x0200;
+    uint16_t const flag_recursion_desired = 0x0100;
+    uint16_t const rcode_mask = 0x000f;
+    uint16_t const rcode_no_error = 0;
+    uint16_t const rcode_name_error = 3;
+
+    size_t const header_size = 12;
+    size_t const max_name_size = 255;
+    size_t const max_label_size = 63;
+    // without EDNS answers over UDP are at most 512 bytes, some servers
+    // send more anyway
+    size_t const max_udp_message_size = 4096;
+    // compression pointers followed while reading one name
+    unsigned const max_pointer_hops = 64;
+
+    uint16_t const dns_port = 53;
+    // limits of resolv.conf(5)
+    size_t const max_nameservers = 3;
+    unsigned const max_ndots = 15;
+    unsigned const max_timeout_seconds = 30;
+    unsigned const max_attempts = 5;
+
+    char const no_name_error[] = "Name or service not known";
+    char const temporary_error[] = "Temporary failure in name resolution";
+
+    // lower case and without the trailing dot
+    std::string normalize_name(std::string const& name)
+    {
+        std::string result = name;
+        if (!result.empty() && result.back() == '.')
+            result.pop_back();
+        for (char& c : result)
+            if (c >= 'A' && c <= 'Z')
+                c = c - 'A' + 'a';
+        return result;
+    }
+
+    bool parse_literal(std::string const& text, ip_address& result)
+    {
+        in_addr addr4;
+        if (inet_pton(AF_INET, text.c_str(), &addr4) == 1)
+        {
+            result = ipv4_address(addr4.s_addr);
+            return true;
+        }
+
+        in6_addr addr6;
+        if (inet_pton(AF_INET6, text.c_str(), &addr6) == 1)
+        {
+            result = ipv6_address(addr6);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool parse_unsigned(std::string const& text, unsigned& result)
+    {
+        if (text.empty() || text.size() > 9)
+            return false;
+
+        unsigned value = 0;
+        for (char c : text)
+        {
+            if (c < '0' || c > '9')
+                return false;
+            value = value * 10 + (c - '0');
+        }
+
+        result = value;
+        return true;
+    }
+
+    bool read_file(std::string const& path, std::string& text)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+
+        std::stringstream ss;
+        ss << file.rdbuf();
+        text = ss.str();
+        return true;
+    }
+
+    void put16(std::string& out, uint16_t value)
+    {
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value & 0xff));
+    }
+
+    // name is normalized, throws std::invalid_argument when it can't be
+    // encoded
+    std::string build_query(uint16_t id, std::string const& name, uint16_t type)
+    {
+        std::string out;
+        out.reserve(header_size + name.size() + 6);
+        put16(out, id);
+        put16(out, flag_recursion_desired);
+        put16(out, 1);
+        put16(out, 0);
+        put16(out, 0);
+        put16(out, 0);
+
+        size_t start = 0;
+        while (start != name.size())
+        {
+            size_t end = name.find('.', start);
+            if (end == std::string::npos)
+                end = name.size();
+
+            size_t label_size = end - start;
+            if (label_size == 0 || label_size > max_label_size)
+                throw std::invalid_argument("invalid host name '" + name + "'");
+
+            out.push_back(static_cast<char>(label_size));
+            out.append(name, start, label_size);
+            start = end == name.size() ? end : end + 1;
+        }
+        out.push_back('\0');
+
+        if (out.size() - header_size > max_name_size)
+            throw std::invalid_argument("invalid host name '" + name + "'");
+
+        put16(out, type);
+        put16(out, class_in);
+        return out;
+    }
+
+    // bounds checked reader of a received message
+    struct message_reader
+    {
+        message_reader(unsigned char const* data, size_t size)
+            : data(data)
+            , size(size)
+            , pos(0)
+        {}
+
+        bool read16(uint16_t& value)
+        {
+            if (size - pos < 2)
+                return false;
+            value = static_cast<uint16_t>(data[pos] << 8 | data[pos + 1]);
+            pos += 2;
+            return true;
+        }
+
+        bool read32(uint32_t& value)
+        {
+            uint16_t high, low;
+            if (!read16(high) || !read16(low))
+                return false;
+            value = uint32_t(high) << 16 | low;
+            return true;
+        }
+
+        bool skip(size_t n)
+        {
+            if (size - pos < n)
+                return false;
+            pos += n;
+            return true;
+        }
+
+        // lower case dotted text, compression pointers are followed
+        bool read_name(std::string& name)
+        {
+            name.clear();
+            size_t p = pos;
+            bool jumped = false;
+            unsigned hops = 0;
+
+            for (;;)
+            {
+                if (p >= size)
+                    return false;
+
+                unsigned label_size = data[p];
+                if ((label_size & 0xc0) == 0xc0)
+                {
+                    if (p + 1 >= size || ++hops > max_pointer_hops)
+                        return false;
+                    if (!jumped)
+                        pos = p + 2;
+                    jumped = true;
+                    p = (label_size & 0x3f) << 8 | data[p + 1];
+                    continue;
+                }
+                if (label_size & 0xc0)
+                    return false;
+
+                ++p;
+                if (label_size == 0)
+                    break;
+                if (size - p < label_size)
+                    return false;
+
+                if (!name.empty())
+                    name.push_back('.');
+                for (size_t i = 0; i != label_size; ++i)
+                {
+                    char c = static_cast<char>(data[p + i]);
+                    if (c >= 'A' && c <= 'Z')
+                        c = c - 'A' + 'a';
+                    name.push_back(c);
+                }
+                p += label_size;
+
+                if (name.size() > max_name_size)
+                    return false;
+            }
+
+            if (!jumped)
+                pos = p;
+            return true;
+        }
+
+        unsigned char const* data;
+        size_t size;
+        size_t pos;
+    };
+
+    struct answer
+    {
+        uint16_t rcode;
+        bool truncated;
+        std::vector<ip_address> addresses;
+    };
+
+    // false when data is not a well-formed response to our question,
+    // such messages are ignored. Records of the asked type are taken from
+    // the answer section, the server follows the CNAMEs for us
+    bool parse_response(unsigned char const* data, size_t size, uint16_t id, std::string const& name, uint16_t type, answer& result)
+    {
+        message_reader r(data, size);
+        uint16_t response_id, flags, questions, answers, authorities, additionals;
+        if (!r.read16(response_id)
+         || !r.read16(flags)
+         || !r.read16(questions)
+         || !r.read16(answers)
+         || !r.read16(authorities)
+         || !r.read16(additionals))
+            return false;
+
+        if (response_id != id || (flags & flag_response) == 0 || questions != 1)
+            return false;
+
+        std::string question_name;
+        uint16_t question_type, question_class;
+        if (!r.read_name(question_name)
+         || !r.read16(question_type)
+         || !r.read16(question_class))
+            return false;
+
+        if (question_name != name || question_type != type || question_class != class_in)
+            return false;
+
+        result.rcode = flags & rcode_mask;
+        result.truncated = (flags & flag_truncated) != 0;
+        result.addresses.clear();
+        // the records may be cut off, they are asked again over TCP
+        if (result.truncated)
+            return true;
+
+        for (uint16_t i = 0; i != answers; ++i)
+        {
+            std::string record_name;
+            uint16_t record_type, record_class, data_size;
+            uint32_t ttl;
+            if (!r.read_name(record_name)
+             || !r.read16(record_type)
+             || !r.read16(record_class)
+             || !r.read32(ttl)
+             || !r.read16(data_size)
+             || size - r.pos < data_size)
+                return false;
+
+            unsigned char const* record_data = data + r.pos;
+            if (record_class == class_in && record_type == type)
+            {
+                if (type == type_a && data_size == 4)
+                {
+                    uint32_t addr;
+                    memcpy(&addr, record_data, sizeof addr);
+                    result.addresses.push_back(ipv4_address(addr));
+                }
+                else if (type == type_aaaa && data_size == 16)
+                {
+                    in6_addr addr;
+                    memcpy(&addr, record_data, sizeof addr);
+                    result.addresses.push_back(ipv6_address(addr));
+                }
+            }
+
+            r.skip(data_size);
+        }
+
+        return true;
+    }
+}
+
+// One wire query: a name and a record type. Every attempt uses a new
+// UDP socket, so late answers to an earlier attempt can't be mistaken
+// for the current one.
+struct dns_resolver::question
+{
+    question(query* parent, std::string const& name, uint16_t type);
+    question(question const&) = delete;
+    question& operator=(question const&) = delete;
+
+    void send();
+
+private:
+    void next_attempt();
+    void on_udp_readable();
+    void start_tcp();
+    void on_tcp_connected();
+    void read_tcp(bool disconnected);
+    void on_answer(answer const& a);
+    // must be the last thing done, the question is destroyed
+    void finish(std::vector<ip_address> const& addresses, bool temporary_failure);
+
+    socket_address const& nameserver() const;
+
+private:
+    query* parent;
+    dns_resolver& resolver;
+    std::string name;
+    uint16_t type;
+    uint16_t id;
+    unsigned attempt;
+    std::string message;
+    file_descriptor udp;
+    epoll_registration udp_registration;
+    std::unique_ptr<client_socket> tcp;
+    std::string tcp_response;
+    timer_element timeout;
+};
+
+struct dns_resolver::query : intrusive_list_element<>
+{
+    query(dns_resolver& resolver, std::string hostname, on_resolved_t on_resolved);
+
+    void start();
+    // tries the next name of the search list
+    void ask_next();
+    void on_question_done(question* q, std::vector<ip_address> const& addresses, bool temporary_failure);
+    // must be the last thing done, the query is destroyed
+    void finish(std::vector<ip_address> addresses, char const* error);
+
+    dns_resolver& resolver;
+    // cleared when the handle lets go
+    handle* owner;
+    std::string hostname;
+    on_resolved_t on_resolved;
+    std::vector<std::string> names;
+    size_t next_name;
+    // A and AAAA
+    std::unique_ptr<question> questions[2];
+    std::vector<ip_address> found[2];
+    // a nameserver timed out or failed, the name may still exist
+    bool temporary_failure;
+    // starts the query from the loop
+    timer_element deferred;
+};
+
+dns_resolver::question::question(query* parent, std::string const& name, uint16_t type)
+    : parent(parent)
+    , resolver(parent->resolver)
+    , name(name)
+    , type(type)
+    , id(0)
+    , attempt(0)
+    , message(build_query(0, name, type))
+    , timeout([this] { next_attempt(); })
+{}
+
+void dns_resolver::question::send()
+{
+    timer& t = resolver.ep.get_timer();
+    udp_registration = epoll_registration();
+    udp = file_descriptor();
+    tcp.reset();
+
+    if (resolver.cfg.nameservers.empty())
+    {
+        timeout.restart(t, timer::clock_t::duration::zero());
+        return;
+    }
+
+    id = static_cast<uint16_t>(resolver.random());
+    message[0] = static_cast<char>(id >> 8);
+    message[1] = static_cast<char>(id & 0xff);
+
+    socket_address const& server = nameserver();
+    file_descriptor fd = ::socket(server.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd.getfd() == -1
+     || ::connect(fd.getfd(), server.data(), server.size()) == -1
+     || ::send(fd.getfd(), message.data(), message.size(), 0) != static_cast<ssize_t>(message.size()))
+    {
+        // the next attempt is made from the loop, so send() never
+        // finishes the question itself
+        timeout.restart(t, timer::clock_t::duration::zero());
+        return;
+    }
+
+    udp = std::move(fd);
+    udp_registration = epoll_registration(resolver.ep, udp.getfd(), EPOLLIN, [this](uint32_t) {
+        on_udp_readable();
+    });
+    timeout.restart(t, resolver.cfg.timeout);
+}
+
+void dns_resolver::question::next_attempt()
+{
+    size_t attempts = resolver.cfg.attempts * resolver.cfg.nameservers.size();
+    if (++attempt >= attempts)
+    {
+        finish(std::vector<ip_address>(), true);
+        return;
+    }
+
+    send();
+}
+
+void dns_resolver::question::on_udp_readable()
+{
+    unsigned char buf[max_udp_message_size];
+    for (;;)
+    {
+        ssize_t res = ::recv(udp.getfd(), buf, sizeof buf, 0);
+        if (res == -1)
+        {
+            int err = errno;
+            if (err == EINTR)
+                continue;
+            if (err == EAGAIN)
+                return;
+
+            // ECONNREFUSED: nobody listens on the nameserver port
+            next_attempt();
+            return;
+        }
+
+        answer a;
+        if (!parse_response(buf, static_cast<size_t>(res), id, name, type, a))
+            continue;
+
+        if (a.truncated)
+            start_tcp();
+        else
+            on_answer(a);
+        return;
+    }
+}
+
+void dns_resolver::question::start_tcp()
+{
+    udp_registration = epoll_registration();
+    udp = file_descriptor();
+    tcp_response.clear();
+
+    timer& t = resolver.ep.get_timer();
+    try
+    {
+        tcp.reset(new client_socket(client_socket::connect(resolver.ep,
+                                                           nameserver(),
+                                                           resolver.cfg.timeout,
+                                                           [this] { on_tcp_connected(); },
+                                                           [this] { read_tcp(true); })));
+    }
+    catch (std::exception const&)
+    {
+        timeout.restart(t, timer::clock_t::duration::zero());
+        return;
+    }
+
+    timeout.restart(t, resolver.cfg.timeout);
+}
+
+void dns_resolver::question::on_tcp_connected()
+{
+    // over TCP every message is preceded by its size
+    std::string framed;
+    framed.reserve(message.size() + 2);
+    put16(framed, static_cast<uint16_t>(message.size()));
+    framed += message;
+    tcp->queue_output(std::move(framed));
+    tcp->set_on_read([this] { read_tcp(false); });
+}
+
+void dns_resolver::question::read_tcp(bool disconnected)
+{
+    // on disconnect the answer can still wait in the receive queue
+    char buf[4096];
+    for (;;)
+    {
+        size_t bytes_read;
+        try
+        {
+            bytes_read = tcp->read_some(buf, sizeof buf);
+        }
+        catch (std::exception const&)
+        {
+            disconnected = true;
+            break;
+        }
+
+        if (bytes_read == 0)
+            break;
+        tcp_response.append(buf, bytes_read);
+
+        if (tcp_response.size() < 2)
+            continue;
+        size_t size = static_cast<unsigned char>(tcp_response[0]) << 8
+                    | static_cast<unsigned char>(tcp_response[1]);
+        if (tcp_response.size() - 2 < size)
+            continue;
+
+        answer a;
+        unsigned char const* data = reinterpret_cast<unsigned char const*>(tcp_response.data()) + 2;
+        if (!parse_response(data, size, id, name, type, a) || a.truncated)
+            next_attempt();
+        else
+            on_answer(a);
+        return;
+    }
+
+    if (disconnected)
+        next_attempt();
+}
+
+void dns_resolver::question::on_answer(answer const& a)
+{
+    if (a.rcode == rcode_no_error)
+        finish(a.addresses, false);
+    else if (a.rcode == rcode_name_error)
+        finish(std::vector<ip_address>(), false);
+    else
+        // SERVFAIL, REFUSED and the like: another nameserver may know
+        next_attempt();
+}
+
+void dns_resolver::question::finish(std::vector<ip_address> const& addresses, bool temporary_failure)
+{
+    parent->on_question_done(this, addresses, temporary_failure);
+}
+
+socket_address const& dns_resolver::question::nameserver() const
+{
+    std::vector<socket_address> const& nameservers = resolver.cfg.nameservers;
+    return nameservers[attempt % nameservers.size()];
+}
+
+dns_resolver::query::query(dns_resolver& resolver, std::string hostname, on_resolved_t on_resolved)
+    : resolver(resolver)
+    , owner(nullptr)
+    , hostname(std::move(hostname))
+    , on_resolved(std::move(on_resolved))
+    , next_name(0)
+    , temporary_failure(false)
+    , deferred([this] { start(); })
+{}
+
+void dns_resolver::query::start()
+{
+    ip_address literal;
+    if (parse_literal(hostname, literal))
+    {
+        finish(std::vector<ip_address>(1, literal), nullptr);
+        return;
+    }
+
+    bool absolute = !hostname.empty() && hostname.back() == '.';
+    std::string name = normalize_name(hostname);
+    if (name.empty())
+    {
+        finish(std::vector<ip_address>(), no_name_error);
+        return;
+    }
+
+    auto i = resolver.cfg.hosts.find(name);
+    if (i != resolver.cfg.hosts.end())
+    {
+        finish(i->second, nullptr);
+        return;
+    }
+
+    size_t dots = std::count(name.begin(), name.end(), '.');
+    bool name_first = absolute || dots >= resolver.cfg.ndots;
+    if (name_first)
+        names.push_back(name);
+    if (!absolute)
+        for (std::string const& suffix : resolver.cfg.search)
+            names.push_back(name + "." + suffix);
+    if (!name_first)
+        names.push_back(name);
+
+    ask_next();
+}
+
+void dns_resolver::query::ask_next()
+{
+    for (;;)
+    {
+        if (next_name == names.size())
+        {
+            finish(std::vector<ip_address>(), temporary_failure ? temporary_error : no_name_error);
+            return;
+        }
+
+        std::string const& name = names[next_name++];
+        try
+        {
+            questions[0].reset(new question(this, name, type_a));
+            questions[1].reset(new question(this, name, type_aaaa));
+        }
+        catch (std::invalid_argument const&)
+        {
+            // a name with an empty or too long label doesn't exist
+            questions[0].reset();
+            questions[1].reset();
+            continue;
+        }
+
+        questions[0]->send();
+        questions[1]->send();
+        return;
+    }
+}
+
+void dns_resolver::query::on_question_done(question* q, std::vector<ip_address> const& addresses, bool temporary_failure)
+{
+    size_t index = q == questions[0].get() ? 0 : 1;
+    assert(questions[index].get() == q);
+    found[index] = addresses;
+    if (temporary_failure)
+        this->temporary_failure = true;
+    questions[index].reset();
+
+    if (questions[0] || questions[1])
+        return;
+
+    if (found[0].empty() && found[1].empty())
+    {
+        ask_next();
+        return;
+    }
+
+    std::vector<ip_address> result = std::move(found[0]);
+    result.insert(result.end(), found[1].begin(), found[1].end());
+    finish(std::move(result), nullptr);
+}
+
+void dns_resolver::query::finish(std::vector<ip_address> addresses, char const* error)
+{
+    std::string message;
+    if (error)
+    {
+        std::stringstream ss;
+        ss << "can not resolve server '" << hostname << "': " << error;
+        message = ss.str();
+    }
+
+    on_resolved_t callback = std::move(on_resolved);
+    if (owner)
+        owner->q = nullptr;
+    resolver.destroy(this);
+
+    callback(addresses, message);
+}
+
+dns_resolver::config::config()
+    : ndots(1)
+    , timeout(std::chrono::seconds(5))
+    , attempts(2)
+{}
+
+void dns_resolver::config::parse_resolv_conf(std::string const& text)
+{
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        size_t comment = line.find_first_of("#;");
+        if (comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword))
+            continue;
+
+        if (keyword == "nameserver")
+        {
+            std::string text;
+            ip_address addr;
+            // scoped IPv6 addresses aren't supported and skipped
+            if (words >> text && parse_literal(text, addr) && nameservers.size() < max_nameservers)
+                nameservers.push_back(socket_address(addr, dns_port));
+        }
+        else if (keyword == "search" || keyword == "domain")
+        {
+            // the last one wins
+            search.clear();
+            std::string suffix;
+            while (words >> suffix)
+            {
+                suffix = normalize_name(suffix);
+                if (!suffix.empty())
+                    search.push_back(suffix);
+            }
+        }
+        else if (keyword == "options")
+        {
+            std::string option;
+            while (words >> option)
+            {
+                size_t colon = option.find(':');
+                unsigned value;
+                if (colon == std::string::npos || !parse_unsigned(option.substr(colon + 1), value))
+                    continue;
+
+                std::string option_name = option.substr(0, colon);
+                if (option_name == "ndots")
+                    ndots = std::min(value, max_ndots);
+                else if (option_name == "timeout")
+                    timeout = std::chrono::seconds(std::max(1u, std::min(value, max_timeout_seconds)));
+                else if (option_name == "attempts")
+                    attempts = std::max(1u, std::min(value, max_attempts));
+            }
+        }
+    }
+}
+
+void dns_resolver::config::parse_hosts(std::string const& text)
+{
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream words(line);
+        std::string text;
+        ip_address addr;
+        if (!(words >> text) || !parse_literal(text, addr))
+            continue;
+
+        std::string name;
+        while (words >> name)
+        {
+            std::vector<ip_address>& addresses = hosts[normalize_name(name)];
+            if (std::find(addresses.begin(), addresses.end(), addr) == addresses.end())
+                addresses.push_back(addr);
+        }
+    }
+}
+
+dns_resolver::config dns_resolver::config::load(std::string const& resolv_conf_path, std::string const& hosts_path)
+{
+    config result;
+    std::string text;
+    if (read_file(resolv_conf_path, text))
+        result.parse_resolv_conf(text);
+    if (read_file(hosts_path, text))
+        result.parse_hosts(text);
+
+    if (result.nameservers.empty())
+        result.nameservers.push_back(socket_address(ipv4_address(htonl(INADDR_LOOPBACK)), dns_port));
+
+    return result;
+}
+
+dns_resolver::config dns_resolver::config::load_system()
+{
+    return load("/etc/resolv.conf", "/etc/hosts");
+}
+
+dns_resolver::handle::handle()
+    : q(nullptr)
+{}
+
+dns_resolver::handle::handle(query* q)
+    : q(q)
+{
+    q->owner = this;
+}
+
+dns_resolver::handle::handle(handle&& other)
+    : q(other.q)
+{
+    other.q = nullptr;
+    if (q)
+        q->owner = this;
+}
+
+dns_resolver::handle& dns_resolver::handle::operator=(handle&& other)
+{
+    if (this == &other)
+        return *this;
+
+    cancel();
+    q = other.q;
+    other.q = nullptr;
+    if (q)
+        q->owner = this;
+    return *this;
+}
+
+dns_resolver::handle::~handle()
+{
+    cancel();
+}
+
+void dns_resolver::handle::cancel()
+{
+    if (!q)
+        return;
+
+    query* p = q;
+    q = nullptr;
+    p->owner = nullptr;
+    p->resolver.destroy(p);
+}
+
+dns_resolver::handle::operator bool() const
+{
+    return q != nullptr;
+}
+
+dns_resolver::dns_resolver(epoll& ep)
+    : dns_resolver(ep, config::load_system())
+{}
+
+dns_resolver::dns_resolver(epoll& ep, config cfg)
+    : ep(ep)
+    , cfg(std::move(cfg))
+    , random(std::random_device()())
+{}
+
+dns_resolver::~dns_resolver()
+{
+    while (!queries.empty())
+    {
+        query& q = queries.front();
+        if (q.owner)
+            q.owner->q = nullptr;
+        destroy(&q);
+    }
+}
+
+dns_resolver::handle dns_resolver::resolve(std::string const& hostname, on_resolved_t on_resolved)
+{
+    query* q = new query(*this, hostname, std::move(on_resolved));
+    queries.push_back(*q);
+    q->deferred.restart(ep.get_timer(), timer::clock_t::duration::zero());
+    return handle(q);
+}
+
+dns_resolver::config const& dns_resolver::get_config() const
+{
+    return cfg;
+}
+
+void dns_resolver::destroy(query* q)
+{
+    q->unlink();
+    delete q;
+}
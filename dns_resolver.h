@@ -0,0 +1,104 @@
+#ifndef DNS_RESOLVER_H
+#define DNS_RESOLVER_H
+
+#include "address.h"
+#include "epoll.h"
+#include "intrusive_list.h"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Stub resolver speaking the DNS wire protocol from the event loop, no
+// threads involved. A and AAAA are asked in parallel over UDP from the
+// nameservers of resolv.conf, a truncated answer is asked again over TCP.
+// Every query has its own socket and retry timer; a nameserver that
+// doesn't answer within the timeout is replaced by the next one.
+// Address literals and names from the hosts file are answered without
+// a query.
+//
+// Belongs to one loop and must be used from its thread only.
+struct dns_resolver
+{
+    // addresses on success, otherwise error is the reason of the failure
+    typedef small_function<void (std::vector<ip_address> const& addresses, std::string const& error)> on_resolved_t;
+
+    struct config
+    {
+        config();
+
+        // loopback when resolv.conf doesn't list any
+        std::vector<socket_address> nameservers;
+        // suffixes tried for names with fewer than ndots dots first,
+        // after the name itself otherwise
+        std::vector<std::string> search;
+        unsigned ndots;
+        // per query sent
+        timer::clock_t::duration timeout;
+        // rounds over all the nameservers
+        unsigned attempts;
+        // lower case names
+        std::unordered_map<std::string, std::vector<ip_address>> hosts;
+
+        // understands nameserver, search, domain and the ndots, timeout
+        // and attempts options
+        void parse_resolv_conf(std::string const& text);
+        void parse_hosts(std::string const& text);
+
+        // missing files leave the defaults
+        static config load(std::string const& resolv_conf_path, std::string const& hosts_path);
+        // /etc/resolv.conf and /etc/hosts
+        static config load_system();
+    };
+
+    struct query;
+
+    // Owned by the one waiting for the answer. Destroying or cancelling
+    // it stops the query, the callback isn't called after that.
+    struct handle
+    {
+        handle();
+        handle(handle&& other);
+        handle& operator=(handle&& other);
+        ~handle();
+
+        void cancel();
+        // false for a cancelled or finished query
+        explicit operator bool() const;
+
+    private:
+        explicit handle(query* q);
+
+        query* q;
+
+        friend struct dns_resolver;
+    };
+
+    // reads the system configuration
+    explicit dns_resolver(epoll& ep);
+    dns_resolver(epoll& ep, config cfg);
+    dns_resolver(dns_resolver const&) = delete;
+    dns_resolver& operator=(dns_resolver const&) = delete;
+    ~dns_resolver();
+
+    // on_resolved is called from the loop, never from inside resolve()
+    handle resolve(std::string const& hostname, on_resolved_t on_resolved);
+
+    config const& get_config() const;
+
+private:
+    struct question;
+
+    void destroy(query* q);
+
+private:
+    epoll& ep;
+    config cfg;
+    // query ids
+    std::mt19937 random;
+    intrusive_list<query> queries;
+};
+
+#endif // DNS_RESOLVER_H
@@ -0,0 +1,433 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <list>
+#include <map>
+#include "dns_resolver.h"
+#include "socket.h"
+
+namespace
+{
+    uint16_t const type_a = 1;
+    uint16_t const type_aaaa = 28;
+
+    void put16(std::string& out, size_t value)
+    {
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value & 0xff));
+    }
+
+    // Nameserver on loopback answering from the records it was given,
+    // over UDP and over TCP on the same port.
+    struct stub_server
+    {
+        explicit stub_server(epoll& ep)
+            : rcode(0)
+            , truncate_udp(false)
+            , silent(false)
+            , udp_queries(0)
+            , tcp_queries(0)
+            , udp(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), socket_options{})
+            , tcp(ep, udp.local_endpoint(), [this] { on_connected(); })
+            , in(16, 512)
+            , out(16, 4096)
+        {
+            udp.set_on_read_write([this] { on_udp_readable(); }, datagram_socket::on_ready_t{});
+        }
+
+        socket_address endpoint() const
+        {
+            return udp.local_endpoint();
+        }
+
+        void add_a(std::string const& name, std::string const& text)
+        {
+            in_addr addr;
+            inet_pton(AF_INET, text.c_str(), &addr);
+            records[{name, type_a}].push_back(std::string(reinterpret_cast<char const*>(&addr), sizeof addr));
+        }
+
+        void add_aaaa(std::string const& name, std::string const& text)
+        {
+            in6_addr addr;
+            inet_pton(AF_INET6, text.c_str(), &addr);
+            records[{name, type_aaaa}].push_back(std::string(reinterpret_cast<char const*>(&addr), sizeof addr));
+        }
+
+        // error code of every answer
+        uint16_t rcode;
+        // answers over UDP have the TC bit and no records
+        bool truncate_udp;
+        // UDP queries are not answered
+        bool silent;
+        size_t udp_queries;
+        size_t tcp_queries;
+
+    private:
+        struct connection
+        {
+            std::unique_ptr<client_socket> socket;
+            std::string received;
+        };
+
+        std::string answer(std::string const& query, bool over_udp)
+        {
+            size_t pos = 12;
+            std::string name;
+            while (query[pos] != 0)
+            {
+                size_t label_size = static_cast<unsigned char>(query[pos]);
+                if (!name.empty())
+                    name.push_back('.');
+                name.append(query, pos + 1, label_size);
+                pos += label_size + 1;
+            }
+            ++pos;
+            uint16_t type = static_cast<unsigned char>(query[pos]) << 8 | static_cast<unsigned char>(query[pos + 1]);
+
+            auto i = records.find({name, type});
+            bool truncated = over_udp && truncate_udp;
+            size_t answers = truncated || i == records.end() ? 0 : i->second.size();
+
+            std::string result(query, 0, 2);
+            put16(result, 0x8180 | (truncated ? 0x0200 : 0) | rcode);
+            put16(result, 1);
+            put16(result, answers);
+            put16(result, 0);
+            put16(result, 0);
+            result.append(query, 12, pos + 4 - 12);
+            for (size_t j = 0; j != answers; ++j)
+            {
+                std::string const& data = i->second[j];
+                // compression pointer to the name of the question
+                put16(result, 0xc00c);
+                put16(result, type);
+                put16(result, 1);
+                put16(result, 0);
+                put16(result, 60);
+                put16(result, data.size());
+                result += data;
+            }
+            return result;
+        }
+
+        void on_udp_readable()
+        {
+            while (size_t n = udp.receive(in))
+            {
+                out.clear();
+                for (size_t i = 0; i != n; ++i)
+                {
+                    ++udp_queries;
+                    if (silent)
+                        continue;
+                    std::string response = answer(std::string(in.data(i), in.message_size(i)), true);
+                    out.push(response.data(), response.size(), in.peer(i));
+                }
+                udp.send(out, 0);
+            }
+        }
+
+        void on_connected()
+        {
+            connections.emplace_back();
+            auto i = std::prev(connections.end());
+            i->socket.reset(new client_socket(tcp.accept([this, i] { connections.erase(i); },
+                                                         [this, i] { on_tcp_readable(*i); },
+                                                         client_socket::on_ready_t{})));
+        }
+
+        void on_tcp_readable(connection& c)
+        {
+            char buf[512];
+            while (size_t n = c.socket->read_some(buf, sizeof buf))
+                c.received.append(buf, n);
+
+            while (c.received.size() >= 2)
+            {
+                size_t size = static_cast<unsigned char>(c.received[0]) << 8 | static_cast<unsigned char>(c.received[1]);
+                if (c.received.size() - 2 < size)
+                    break;
+
+                ++tcp_queries;
+                std::string response = answer(c.received.substr(2, size), false);
+                std::string framed;
+                put16(framed, response.size());
+                framed += response;
+                c.socket->queue_output(std::move(framed));
+                c.received.erase(0, size + 2);
+            }
+        }
+
+    private:
+        datagram_socket udp;
+        server_socket tcp;
+        datagram_batch in;
+        datagram_batch out;
+        std::map<std::pair<std::string, uint16_t>, std::vector<std::string>> records;
+        std::list<connection> connections;
+    };
+
+    size_t open_descriptors()
+    {
+        size_t result = 0;
+        DIR* dir = ::opendir("/proc/self/fd");
+        while (::readdir(dir))
+            ++result;
+        ::closedir(dir);
+        return result;
+    }
+
+    dns_resolver::config make_config(std::vector<socket_address> nameservers)
+    {
+        dns_resolver::config cfg;
+        cfg.nameservers = std::move(nameservers);
+        cfg.timeout = std::chrono::milliseconds(500);
+        return cfg;
+    }
+
+    struct result
+    {
+        result()
+            : called(false)
+        {}
+
+        dns_resolver::on_resolved_t callback(epoll& ep)
+        {
+            return [this, &ep](std::vector<ip_address> const& addresses, std::string const& error) {
+                called = true;
+                this->addresses = addresses;
+                this->error = error;
+                ep.stop();
+            };
+        }
+
+        bool called;
+        std::vector<ip_address> addresses;
+        std::string error;
+    };
+}
+
+TEST(dns_resolver, resolv_conf01)
+{
+    dns_resolver::config cfg;
+    cfg.parse_resolv_conf("# comment\n"
+                          "nameserver 10.0.0.1\n"
+                          "nameserver ::1 ; comment\n"
+                          "nameserver bogus\n"
+                          "nameserver 10.0.0.2\n"
+                          "nameserver 10.0.0.3\n"
+                          "search Example.COM. corp\n"
+                          "options ndots:2 timeout:3 attempts:9 rotate\n");
+
+    ASSERT_EQ(cfg.nameservers.size(), 3u);
+    EXPECT_EQ(cfg.nameservers[0].to_string(), "10.0.0.1:53");
+    EXPECT_EQ(cfg.nameservers[1].to_string(), "[::1]:53");
+    EXPECT_EQ(cfg.nameservers[2].to_string(), "10.0.0.2:53");
+    EXPECT_EQ(cfg.search, (std::vector<std::string>{"example.com", "corp"}));
+    EXPECT_EQ(cfg.ndots, 2u);
+    EXPECT_TRUE(cfg.timeout == std::chrono::seconds(3));
+    EXPECT_EQ(cfg.attempts, 5u);
+}
+
+TEST(dns_resolver, hosts01)
+{
+    dns_resolver::config cfg;
+    cfg.parse_hosts("127.0.0.1 localhost Localhost.localdomain\n"
+                    "::1\tlocalhost ip6-localhost # comment\n"
+                    "# 10.0.0.1 commented\n"
+                    "bogus name\n");
+
+    EXPECT_EQ(cfg.hosts.size(), 3u);
+    EXPECT_EQ(cfg.hosts["localhost"], (std::vector<ip_address>{ip_address("127.0.0.1"), ip_address("::1")}));
+    EXPECT_EQ(cfg.hosts["localhost.localdomain"], std::vector<ip_address>{ip_address("127.0.0.1")});
+    EXPECT_EQ(cfg.hosts.count("name"), 0u);
+}
+
+TEST(dns_resolver, resolve01)
+{
+    epoll ep;
+    stub_server server(ep);
+    server.add_a("www.example.test", "10.0.0.1");
+    server.add_a("www.example.test", "10.0.0.2");
+    server.add_aaaa("www.example.test", "2001:db8::1");
+    dns_resolver resolver(ep, make_config({server.endpoint()}));
+
+    result r;
+    dns_resolver::handle h = resolver.resolve("WWW.example.test", r.callback(ep));
+    EXPECT_TRUE(static_cast<bool>(h));
+    // never from inside resolve()
+    EXPECT_FALSE(r.called);
+
+    ep.run();
+    EXPECT_EQ(r.error, "");
+    EXPECT_EQ(r.addresses, (std::vector<ip_address>{ip_address("10.0.0.1"), ip_address("10.0.0.2"), ip_address("2001:db8::1")}));
+    EXPECT_EQ(server.udp_queries, 2u);
+    EXPECT_FALSE(static_cast<bool>(h));
+}
+
+TEST(dns_resolver, hosts02)
+{
+    epoll ep;
+    stub_server server(ep);
+    dns_resolver::config cfg = make_config({server.endpoint()});
+    cfg.parse_hosts("10.1.2.3 host.example\n");
+    dns_resolver resolver(ep, cfg);
+
+    result r;
+    dns_resolver::handle h = resolver.resolve("Host.Example.", r.callback(ep));
+    EXPECT_FALSE(r.called);
+
+    ep.run();
+    EXPECT_EQ(r.error, "");
+    EXPECT_EQ(r.addresses, std::vector<ip_address>{ip_address("10.1.2.3")});
+    EXPECT_EQ(server.udp_queries, 0u);
+}
+
+TEST(dns_resolver, literal01)
+{
+    epoll ep;
+    dns_resolver resolver(ep, make_config({}));
+
+    result r;
+    dns_resolver::handle h = resolver.resolve("::1", r.callback(ep));
+
+    ep.run();
+    EXPECT_EQ(r.error, "");
+    EXPECT_EQ(r.addresses, std::vector<ip_address>{ip_address("::1")});
+}
+
+TEST(dns_resolver, nxdomain01)
+{
+    epoll ep;
+    stub_server server(ep);
+    server.rcode = 3;
+    dns_resolver resolver(ep, make_config({server.endpoint()}));
+
+    result r;
+    dns_resolver::handle h = resolver.resolve("missing.test", r.callback(ep));
+
+    ep.run();
+    EXPECT_TRUE(r.addresses.empty());
+    EXPECT_EQ(r.error, "can not resolve server 'missing.test': Name or service not known");
+    EXPECT_EQ(server.udp_queries, 2u);
+}
+
+TEST(dns_resolver, tcp01)
+{
+    epoll ep;
+    stub_server server(ep);
+    server.truncate_udp = true;
+    server.add_a("big.test", "10.0.0.1");
+    dns_resolver resolver(ep, make_config({server.endpoint()}));
+
+    result r;
+    dns_resolver::handle h = resolver.resolve("big.test", r.callback(ep));
+
+    ep.run();
+    EXPECT_EQ(r.error, "");
+    EXPECT_EQ(r.addresses, std::vector<ip_address>{ip_address("10.0.0.1")});
+    EXPECT_EQ(server.udp_queries, 2u);
+    EXPECT_EQ(server.tcp_queries, 2u);
+}
+
+TEST(dns_resolver, retry01)
+{
+    epoll ep;
+    stub_server silent(ep);
+    silent.silent = true;
+    stub_server server(ep);
+    server.add_a("www.test", "10.0.0.1");
+    dns_resolver::config cfg = make_config({silent.endpoint(), server.endpoint()});
+    cfg.timeout = std::chrono::milliseconds(50);
+    cfg.attempts = 1;
+    dns_resolver resolver(ep, cfg);
+
+    result r;
+    dns_resolver::handle h = resolver.resolve("www.test", r.callback(ep));
+
+    ep.run();
+    EXPECT_EQ(r.error, "");
+    EXPECT_EQ(r.addresses, std::vector<ip_address>{ip_address("10.0.0.1")});
+    EXPECT_EQ(silent.udp_queries, 2u);
+    EXPECT_EQ(server.udp_queries, 2u);
+}
+
+TEST(dns_resolver, timeout01)
+{
+    epoll ep;
+    stub_server silent(ep);
+    silent.silent = true;
+    dns_resolver::config cfg = make_config({silent.endpoint()});
+    cfg.timeout = std::chrono::milliseconds(20);
+    cfg.attempts = 2;
+    dns_resolver resolver(ep, cfg);
+    size_t descriptors = open_descriptors();
+
+    result r;
+    dns_resolver::handle h = resolver.resolve("www.test", r.callback(ep));
+
+    ep.run();
+    EXPECT_TRUE(r.addresses.empty());
+    EXPECT_EQ(r.error, "can not resolve server 'www.test': Temporary failure in name resolution");
+    EXPECT_EQ(silent.udp_queries, 4u);
+    // the socket of every attempt is closed
+    EXPECT_EQ(open_descriptors(), descriptors);
+}
+
+TEST(dns_resolver, search01)
+{
+    epoll ep;
+    stub_server server(ep);
+    server.add_a("www.corp.test", "10.0.0.1");
+    dns_resolver::config cfg = make_config({server.endpoint()});
+    cfg.search = {"other.test", "corp.test"};
+    dns_resolver resolver(ep, cfg);
+
+    result r;
+    dns_resolver::handle h = resolver.resolve("www", r.callback(ep));
+
+    ep.run();
+    EXPECT_EQ(r.error, "");
+    EXPECT_EQ(r.addresses, std::vector<ip_address>{ip_address("10.0.0.1")});
+    // www.other.test answered with no records, then www.corp.test
+    EXPECT_EQ(server.udp_queries, 4u);
+}
+
+TEST(dns_resolver, cancel01)
+{
+    epoll ep;
+    stub_server server(ep);
+    server.add_a("www.test", "10.0.0.1");
+    dns_resolver resolver(ep, make_config({server.endpoint()}));
+
+    result first;
+    result second;
+    dns_resolver::handle h1 = resolver.resolve("www.test", first.callback(ep));
+    dns_resolver::handle h2 = resolver.resolve("www.test", second.callback(ep));
+    h1.cancel();
+    EXPECT_FALSE(static_cast<bool>(h1));
+
+    ep.run();
+    EXPECT_FALSE(first.called);
+    EXPECT_TRUE(second.called);
+}
+
+TEST(dns_resolver, cancel02)
+{
+    epoll ep;
+    stub_server server(ep);
+    server.silent = true;
+
+    result r;
+    {
+        // the handle outlives the resolver
+        dns_resolver::handle h;
+        dns_resolver resolver(ep, make_config({server.endpoint()}));
+        h = resolver.resolve("www.test", r.callback(ep));
+    }
+
+    timer_element stop(ep.get_timer(), std::chrono::milliseconds(50), [&] { ep.stop(); });
+    ep.run();
+    EXPECT_FALSE(r.called);
+}
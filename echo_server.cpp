@@ -1,70 +1,102 @@
 #include "echo_server.h"
 
+#include <stdexcept>
+
 namespace
 {
     constexpr const timer::clock_t::duration timeout = std::chrono::seconds(15);
+    constexpr const size_t pipe_capacity = 256 * 1024;
+    // a message is a datagram or a GRO train of them
+    constexpr const size_t udp_batch_size = 32;
+    constexpr const size_t udp_message_size = 64 * 1024;
+    // the socket is level triggered, the rest waits for the next iteration
+    constexpr const size_t udp_batches_per_wakeup = 16;
 }
 
 echo_server::connection::connection(echo_server *parent)
     : parent(parent)
-    , socket(parent->ss.accept([this] {
-        this->parent->connections.erase(this);
-    }, [this] {
-        process(true);
-    }, client_socket::on_ready_t{}))
-    , timer(parent->ep.get_timer(), timeout, [this] {
-        this->parent->connections.erase(this);
+    , socket(parent->ss.accept(parent->splice_mode ? client_socket::trigger_mode::level
+                                                   : client_socket::trigger_mode::edge, [this] {
+        this->parent->destroy(this);
+    }, client_socket::on_ready_t{}, client_socket::on_ready_t{}))
+    , timer(parent->timeouts, [this] {
+        this->parent->destroy(this);
     })
-    , start_offset()
-    , end_offset()
-{}
+    , buf(nullptr)
+    , pipe(nullptr)
+{
+    if (parent->splice_mode)
+    {
+        socket.set_on_read([this] { process_splice(); });
+        return;
+    }
+
+    if (parent->zerocopy_min_size != 0 && socket.set_zerocopy(parent->zerocopy_min_size))
+    {
+        socket.set_on_read([this] { process_queued(); });
+        return;
+    }
+
+    socket.set_on_read([this] { process(true); });
+}
 
-void echo_server::connection::try_read()
+echo_server::connection::~connection()
 {
-    assert(start_offset == 0);
-    assert(end_offset == 0);
-    end_offset = socket.read_some(buf, sizeof buf);
+    if (buf)
+        release_buffer();
+    if (pipe)
+        release_pipe();
+}
+
+void echo_server::connection::try_read(size_t wanted)
+{
+    assert(!buf);
+    buf = parent->buffers.acquire(wanted);
+    buf->end = socket.read_some(buf->data(), buf->capacity());
+    if (buf->end == 0)
+        release_buffer();
 }
 
 void echo_server::connection::try_write()
 {
-    assert(start_offset < end_offset);
-    assert(end_offset != 0);
+    assert(buf);
+    assert(buf->start < buf->end);
 
-    size_t written = socket.write_some(buf + start_offset, end_offset - start_offset);
+    size_t written = socket.write_some(buf->data() + buf->start, buf->end - buf->start);
     if (written == 0)
         return;
 
-    timer.restart(parent->ep.get_timer(), timeout);
-    start_offset += written;
-    if (start_offset == end_offset)
-    {
-        start_offset = 0;
-        end_offset = 0;
-    }
+    timer.restart(parent->timeouts);
+    buf->start += written;
+    if (buf->start == buf->end)
+        release_buffer();
 }
 
 void echo_server::connection::process(bool read)
 {
-    bool incomplete_read = false;
+    bool incomplete_read;
+    size_t wanted = 0;
 
     if (!read)
         goto process_write;
 
     for (;;)
     {
-        try_read();
-        if (end_offset == 0)
+        try_read(wanted);
+        if (!buf)
         {
             socket.set_on_read_write([this] { process(true); }, client_socket::on_ready_t{});
             return;
         }
 
-        incomplete_read = (end_offset != sizeof buf);
-
     process_write:
+        // a read that fills the buffer is likely followed by more
+        // data, the next one is taken from a bigger class
+        incomplete_read = (buf->end != buf->capacity());
+        wanted = incomplete_read ? 0 : buf->capacity() + 1;
+
         try_write();
-        if (end_offset != 0)
+        if (buf)
         {
             socket.set_on_read_write(client_socket::on_ready_t{}, [this] { process(false); });
             return;
@@ -78,24 +110,185 @@ void echo_server::connection::process(bool read)
     }
 }
 
+void echo_server::connection::process_splice()
+{
+    // the pipe is empty whenever more is read, so a splice that moves
+    // nothing means the socket is drained
+    for (;;)
+    {
+        if (!pipe)
+        {
+            pipe = parent->pipes.acquire();
+            pipe->size = socket.splice_read(pipe->fds.in, parent->pipes.get_capacity());
+            if (pipe->size == 0)
+            {
+                release_pipe();
+                socket.set_on_read_write([this] { process_splice(); }, client_socket::on_ready_t{});
+                return;
+            }
+        }
+
+        size_t written = socket.splice_write(pipe->fds.out, pipe->size);
+        if (written != 0)
+            timer.restart(parent->timeouts);
+        pipe->size -= written;
+
+        if (pipe->size != 0)
+        {
+            socket.set_on_read_write(client_socket::on_ready_t{}, [this] { process_splice(); });
+            return;
+        }
+
+        release_pipe();
+    }
+}
+
+void echo_server::connection::process_queued()
+{
+    // the buffers are handed over to the output queue, the socket is
+    // read again only when the queue is written
+    size_t wanted = 0;
+    for (;;)
+    {
+        try_read(wanted);
+        if (!buf)
+        {
+            socket.set_on_read([this] { process_queued(); });
+            return;
+        }
+
+        timer.restart(parent->timeouts);
+        wanted = buf->end == buf->capacity() ? buf->capacity() + 1 : 0;
+
+        io_buffer* b = buf;
+        buf = nullptr;
+        buffer_pool& pool = parent->buffers;
+        socket.queue_output_shared(std::shared_ptr<void const>(b->data(), [&pool, b](void const*) {
+            pool.release(b);
+        }), b->data() + b->start, b->end - b->start);
+
+        if (!socket.flush_output())
+        {
+            socket.set_on_read(client_socket::on_ready_t{});
+            socket.set_on_output_drained([this] {
+                socket.set_on_output_drained(client_socket::on_ready_t{});
+                process_queued();
+            });
+            return;
+        }
+    }
+}
+
+void echo_server::connection::release_buffer()
+{
+    parent->buffers.release(buf);
+    buf = nullptr;
+}
+
+void echo_server::connection::release_pipe()
+{
+    parent->pipes.release(pipe);
+    pipe = nullptr;
+}
+
 echo_server::echo_server(epoll& ep)
-    : ep(ep)
-    , ss{ep, std::bind(&echo_server::on_new_connection, this)}
+    : echo_server(ep, ipv4_endpoint(0, ipv4_address::any()))
 {}
 
-echo_server::echo_server(epoll &ep, ipv4_endpoint const& local_endpoint)
+echo_server::echo_server(epoll& ep, socket_address const& local_endpoint)
+    : echo_server(ep, local_endpoint, socket_options{})
+{}
+
+echo_server::echo_server(epoll& ep, socket_address const& local_endpoint, bool reuse_port)
+    : echo_server(ep, server_socket::listen(local_endpoint, reuse_port))
+{}
+
+echo_server::echo_server(epoll& ep, socket_address const& local_endpoint, socket_options const& options)
+    : echo_server(ep, server_socket::listen(local_endpoint, options))
+{}
+
+echo_server::echo_server(epoll& ep, echo_server const& listener)
+    : echo_server(ep, listener.ss.duplicate())
+{}
+
+echo_server::echo_server(epoll& ep, file_descriptor listener)
     : ep(ep)
-    , ss{ep, local_endpoint, std::bind(&echo_server::on_new_connection, this)}
+    , ss{ep, std::move(listener), [this] { on_new_connection(); }}
+    , timeouts(ep.get_timer(), timeout)
+    , splice_mode(false)
+    , zerocopy_min_size(0)
+    , connection_allocator(ep.get_slab_allocator(sizeof(connection)))
+    , buffers(ep.get_buffer_pool())
+    , pipes(pipe_capacity)
+    , udp_sent(0)
 {}
 
-ipv4_endpoint echo_server::local_endpoint() const
+echo_server::~echo_server()
+{
+    while (!connections.empty())
+        destroy(&connections.front());
+}
+
+socket_address echo_server::local_endpoint() const
 {
     return ss.local_endpoint();
 }
 
+void echo_server::set_splice_mode(bool enabled)
+{
+    splice_mode = enabled;
+}
+
+void echo_server::set_zerocopy(size_t min_size)
+{
+    zerocopy_min_size = min_size;
+}
+
+void echo_server::enable_udp(socket_options const& options)
+{
+    socket_address local = local_endpoint();
+    if (local.family() == AF_UNIX)
+        throw std::invalid_argument("UDP echo needs an IP listener, not " + local.to_string());
+
+    udp.reset(new datagram_socket(ep, local, options));
+    udp->set_gro(true);
+    udp_batch.reset(new datagram_batch(udp_batch_size, udp_message_size));
+    udp_sent = 0;
+    udp->set_on_read_write([this] { process_datagrams(); }, datagram_socket::on_ready_t{});
+}
+
+void echo_server::process_datagrams()
+{
+    for (size_t i = 0; i != udp_batches_per_wakeup; ++i)
+    {
+        if (udp_sent == udp_batch->size())
+        {
+            udp_sent = 0;
+            if (udp->receive(*udp_batch) == 0)
+                break;
+        }
+
+        // the batch goes back as received: the peers are the senders and
+        // GRO trains are split again by GSO
+        udp_sent += udp->send(*udp_batch, udp_sent);
+        if (udp_sent != udp_batch->size())
+        {
+            udp->set_on_read_write(datagram_socket::on_ready_t{}, [this] { process_datagrams(); });
+            return;
+        }
+    }
+
+    udp->set_on_read_write([this] { process_datagrams(); }, datagram_socket::on_ready_t{});
+}
+
 void echo_server::on_new_connection()
 {
-    std::unique_ptr<connection> cc(new connection(this));
-    connection* pcc = cc.get();
-    connections.emplace(pcc, std::move(cc));
+    slab_ptr<connection> cc = make_slab_object<connection>(connection_allocator, this);
+    connections.push_back(*cc.release());
+}
+
+void echo_server::destroy(connection* c)
+{
+    c->unlink();
+    slab_deleter<connection>{connection_allocator}(c);
 }
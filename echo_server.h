@@ -1,41 +1,91 @@
 #ifndef ECHO_SERVER_H
 #define ECHO_SERVER_H
 
-#include <map>
+#include <memory>
+#include "intrusive_list.h"
+#include "pipe.h"
 #include "socket.h"
 
 struct echo_server
 {
-    struct connection
+    struct connection : intrusive_list_element<>
     {
         connection(echo_server* parent);
+        ~connection();
 
-        void try_read();
+        void try_read(size_t wanted);
         void try_write();
 
         void process(bool read);
+        void process_splice();
+        void process_queued();
+
+    private:
+        void release_buffer();
+        void release_pipe();
 
     private:
         echo_server* parent;
         client_socket socket;
-        timer_element timer;
-        size_t start_offset;
-        size_t end_offset;
-        char buf[1500];
+        fixed_timeout_element timer;
+        // borrowed from the loop only while data read from the socket
+        // waits to be written back, an idle connection holds nothing
+        io_buffer* buf;
+        // splice mode only, data is moved socket -> pipe -> socket
+        // through a pipe borrowed the same way
+        pooled_pipe* pipe;
     };
 
     echo_server(epoll& ep);
-    echo_server(epoll& ep, ipv4_endpoint const& local_endpoint);
+    echo_server(epoll& ep, socket_address const& local_endpoint);
+    echo_server(epoll& ep, socket_address const& local_endpoint, bool reuse_port);
+    echo_server(epoll& ep, socket_address const& local_endpoint, socket_options const& options);
+    // accepts from the listener of another server, see server_socket
+    echo_server(epoll& ep, echo_server const& listener);
+    echo_server(echo_server const&) = delete;
+    echo_server& operator=(echo_server const&) = delete;
+    ~echo_server();
+
+    socket_address local_endpoint() const;
+
+    // echo the data of new connections with splice() through a per
+    // connection pipe, instead of copying it through a buffer
+    void set_splice_mode(bool enabled);
 
-    ipv4_endpoint local_endpoint() const;
+    // echo the data of new connections through the output queue with
+    // MSG_ZEROCOPY, for reads of at least min_size bytes; a buffer goes
+    // back to the pool once the kernel reports the completion. 0 disables,
+    // splice mode takes precedence
+    void set_zerocopy(size_t min_size);
+
+    // also echo UDP datagrams sent to the port of the listener, received
+    // and sent back in batches, coalesced with GRO/GSO when supported
+    void enable_udp(socket_options const& options);
 
 private:
+    // all the public constructors end up here
+    echo_server(epoll& ep, file_descriptor listener);
+
     void on_new_connection();
+    void destroy(connection* c);
+    void process_datagrams();
 
 private:
     epoll& ep;
     server_socket ss;
-    std::map<connection*, std::unique_ptr<connection>> connections;
+    fixed_timeout_list timeouts;
+    bool splice_mode;
+    size_t zerocopy_min_size;
+    // connections and their sockets are allocated from slabs of the loop
+    slab_allocator& connection_allocator;
+    buffer_pool& buffers;
+    pipe_pool pipes;
+
+    std::unique_ptr<datagram_socket> udp;
+    std::unique_ptr<datagram_batch> udp_batch;
+    // messages of udp_batch already sent back
+    size_t udp_sent;
+    intrusive_list<connection> connections;
 };
 
 #endif // ECHO_SERVER_H
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "echo_server.h"
+
+namespace
+{
+    // sends data to the server and returns what is echoed back once
+    // there is as much of it
+    std::string round_trip(epoll& ep, echo_server& server, std::string const& data)
+    {
+        std::string received;
+        bool expired = false;
+        client_socket s = client_socket::connect(ep, server.local_endpoint(), [&] {
+            ep.stop();
+        });
+        s.set_on_read([&] {
+            char buf[65536];
+            received.append(buf, s.read_some(buf, sizeof buf));
+            if (received.size() >= data.size())
+                ep.stop();
+        });
+        s.queue_output(data);
+
+        timer_element deadline(ep.get_timer(), std::chrono::seconds(10), [&] {
+            expired = true;
+            ep.stop();
+        });
+        ep.run();
+        EXPECT_FALSE(expired);
+        return received;
+    }
+
+    // larger than the socket buffers and the pipe, so both directions
+    // block several times
+    std::string make_payload(size_t size)
+    {
+        std::string result(size, '\0');
+        for (size_t i = 0; i != size; ++i)
+            result[i] = static_cast<char>('a' + i % 26);
+        return result;
+    }
+}
+
+TEST(echo_server, echo01)
+{
+    epoll ep;
+    echo_server server(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")));
+    std::string data = make_payload(4 << 20);
+    EXPECT_TRUE(round_trip(ep, server, data) == data);
+}
+
+TEST(echo_server, splice01)
+{
+    epoll ep;
+    echo_server server(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")));
+    server.set_splice_mode(true);
+    std::string data = make_payload(4 << 20);
+    EXPECT_TRUE(round_trip(ep, server, data) == data);
+}
+
+TEST(echo_server, splice02)
+{
+    epoll ep;
+    echo_server server(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")));
+    server.set_splice_mode(true);
+
+    // the pipes of closed connections go back to the pool, a reused one
+    // must not carry data of its previous connection
+    for (size_t i = 0; i != 3; ++i)
+    {
+        std::string data = make_payload(100000 + i);
+        EXPECT_TRUE(round_trip(ep, server, data) == data);
+    }
+}
+
+TEST(echo_server, zerocopy01)
+{
+    epoll ep;
+    echo_server server(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")));
+    server.set_zerocopy(1);
+    std::string data = make_payload(4 << 20);
+    EXPECT_TRUE(round_trip(ep, server, data) == data);
+
+    // the buffers held by the output queue of the closed connection are
+    // back in the pool
+    timer_element stop(ep.get_timer(), std::chrono::milliseconds(50), [&ep] { ep.stop(); });
+    ep.run();
+    EXPECT_EQ(ep.get_buffer_pool().in_use(), 0u);
+}
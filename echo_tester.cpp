@@ -1,10 +1,43 @@
 #include "echo_tester.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 
-echo_tester::connection::connection(echo_tester* parent, ipv4_endpoint const& remote, uint32_t number)
+namespace
+{
+    constexpr const timer::clock_t::duration connect_timeout = std::chrono::seconds(5);
+
+    constexpr const size_t udp_batch_size = 32;
+    constexpr const size_t udp_max_message_size = 64 * 1024;
+    // UDP_MAX_SEGMENTS of the kernel
+    constexpr const size_t udp_max_segments = 64;
+    constexpr const size_t udp_window = 4096;
+    constexpr const timer::clock_t::duration udp_report_interval = std::chrono::seconds(1);
+
+    // runs before the members computed from the size are initialized
+    size_t checked_datagram_size(size_t datagram_size)
+    {
+        if (datagram_size < sizeof(uint64_t) || datagram_size > udp_max_message_size - 1024)
+            throw std::invalid_argument("invalid datagram size");
+        return datagram_size;
+    }
+
+    // the local side of a socket talking to a peer of the family
+    socket_address any_endpoint(int family)
+    {
+        if (family == AF_INET6)
+            return ipv6_endpoint(0, ipv6_address::any());
+        return ipv4_endpoint(0, ipv4_address::any());
+    }
+}
+
+echo_tester::connection::connection(echo_tester* parent, socket_address const& remote, uint32_t number)
     : parent(parent)
-    , socket(client_socket::connect(parent->ep, remote, [this] {
+    , socket(client_socket::connect(parent->ep, remote, parent->options, connect_timeout, [this] {
+        goto_new_state();
+    }, [this] {
         std::cerr << "connection " << this->number << " was disconnected" << std::endl;
         this->parent->connections.erase(this);
     }))
@@ -12,9 +45,8 @@ echo_tester::connection::connection(echo_tester* parent, ipv4_endpoint const& re
     , number(number)
     , sent(0)
     , received(0)
-{
-    goto_new_state();
-}
+    , state(state_t::idle)
+{}
 
 void echo_tester::connection::do_send()
 {
@@ -132,10 +164,15 @@ uint32_t echo_tester::connection::get_number() const
     return number;
 }
 
-echo_tester::echo_tester(epoll &ep, ipv4_endpoint remote_endpoint)
+echo_tester::echo_tester(epoll &ep, socket_address const& remote_endpoint)
+    : echo_tester(ep, remote_endpoint, socket_options{})
+{}
+
+echo_tester::echo_tester(epoll &ep, socket_address const& remote_endpoint, socket_options const& options)
     : ep(ep)
     , timer([this] { tick(); })
     , remote_endpoint(remote_endpoint)
+    , options(options)
     , next_connection_number(0)
     , desired_number_of_connections(500)
     , number_of_permanent_connections(0)
@@ -170,3 +207,143 @@ void echo_tester::tick()
     }
     timer.restart(this->ep.get_timer(), std::chrono::milliseconds(rand() % 40));
 }
+
+udp_echo_tester::udp_echo_tester(epoll& ep, socket_address const& remote_endpoint, socket_options const& options,
+                                 size_t datagram_size, bool gso)
+    : ep(ep)
+    , remote_endpoint(remote_endpoint)
+    , datagram_size(checked_datagram_size(datagram_size))
+    , segments(gso ? std::min(udp_max_segments, udp_max_message_size / datagram_size) : 1)
+    , window(udp_window)
+    , socket(ep, any_endpoint(remote_endpoint.family()), options)
+    , send_batch(udp_batch_size, segments * datagram_size)
+    , receive_batch(udp_batch_size, gso ? udp_max_message_size : datagram_size)
+    , message(segments * datagram_size)
+    , next_sequence(0)
+    , in_flight(0)
+    , sent(0)
+    , received(0)
+    , mismatched(0)
+    , lost(0)
+    , sent_reported(0)
+    , received_reported(0)
+    , report_timer(ep.get_timer(), udp_report_interval, [this] { report(); })
+{
+    socket.connect(remote_endpoint);
+    if (gso && !socket.set_gro(true))
+        std::cerr << "UDP_GRO is not supported, echoed datagrams are received one by one" << std::endl;
+    pump();
+}
+
+void udp_echo_tester::pump()
+{
+    receive_some();
+    send_some();
+
+    // the socket is almost always writable, write readiness is only
+    // waited for while the window has room
+    if (in_flight + segments <= window)
+        socket.set_on_read_write([this] { pump(); }, [this] { pump(); });
+    else
+        socket.set_on_read_write([this] { pump(); }, datagram_socket::on_ready_t{});
+}
+
+void udp_echo_tester::send_some()
+{
+    while (in_flight + segments <= window)
+    {
+        uint64_t first_sequence = next_sequence;
+        send_batch.clear();
+        for (uint64_t queued = 0; in_flight + queued + segments <= window; queued += segments)
+        {
+            char* p = message.data();
+            for (size_t i = 0; i != segments; ++i)
+            {
+                uint64_t sequence = next_sequence + i;
+                memcpy(p, &sequence, sizeof sequence);
+                for (size_t j = sizeof sequence; j != datagram_size; ++j)
+                    p[j] = static_cast<char>(sequence + j);
+                p += datagram_size;
+            }
+
+            if (!send_batch.push(message.data(), message.size(), remote_endpoint, segments > 1 ? datagram_size : 0))
+                break;
+            next_sequence += segments;
+        }
+
+        size_t messages_sent = socket.send(send_batch, 0);
+        uint64_t datagrams_sent = messages_sent * segments;
+        // sequence numbers of the messages left in the batch are reused
+        next_sequence = first_sequence + datagrams_sent;
+        in_flight += datagrams_sent;
+        sent += datagrams_sent;
+
+        if (messages_sent != send_batch.size())
+            break;
+    }
+}
+
+void udp_echo_tester::receive_some()
+{
+    for (;;)
+    {
+        size_t n = socket.receive(receive_batch);
+        if (n == 0)
+            break;
+
+        for (size_t i = 0; i != n; ++i)
+        {
+            char const* p = receive_batch.data(i);
+            size_t size = receive_batch.message_size(i);
+            size_t segment_size = receive_batch.segment_size(i);
+            if (segment_size == 0)
+                segment_size = size;
+
+            for (size_t offset = 0; offset < size; offset += segment_size)
+                check_datagram(p + offset, std::min(segment_size, size - offset));
+        }
+    }
+}
+
+void udp_echo_tester::check_datagram(char const* data, size_t size)
+{
+    ++received;
+    if (in_flight != 0)
+        --in_flight;
+
+    uint64_t sequence;
+    bool ok = size == datagram_size;
+    if (ok)
+    {
+        memcpy(&sequence, data, sizeof sequence);
+        ok = sequence < next_sequence;
+        for (size_t j = sizeof sequence; ok && j != size; ++j)
+            ok = data[j] == static_cast<char>(sequence + j);
+    }
+
+    if (!ok)
+    {
+        ++mismatched;
+        std::cerr << "datagram mismatch, size: " << size << std::endl;
+    }
+}
+
+void udp_echo_tester::report()
+{
+    double seconds = std::chrono::duration<double>(udp_report_interval).count();
+    if (received == received_reported && in_flight != 0)
+    {
+        // nothing came back for a whole interval, what is in flight is lost
+        lost += in_flight;
+        in_flight = 0;
+    }
+
+    std::cout << "sent " << static_cast<uint64_t>((sent - sent_reported) / seconds) << " pps, received "
+              << static_cast<uint64_t>((received - received_reported) / seconds) << " pps, lost "
+              << lost << ", mismatched " << mismatched << std::endl;
+
+    sent_reported = sent;
+    received_reported = received;
+    report_timer.restart(ep.get_timer(), udp_report_interval);
+    pump();
+}
@@ -5,6 +5,7 @@
 #include "address.h"
 #include "socket.h"
 #include <map>
+#include <vector>
 
 struct echo_tester
 {
@@ -20,7 +21,7 @@ struct echo_tester
             max
         };
 
-        connection(echo_tester* parent, ipv4_endpoint const& remote, uint32_t number);
+        connection(echo_tester* parent, socket_address const& remote, uint32_t number);
 
         void do_send();
         void do_receive();
@@ -44,7 +45,8 @@ struct echo_tester
         state_t state;
     };
 
-    echo_tester(epoll& ep, ipv4_endpoint remote_endpoint);
+    echo_tester(epoll& ep, socket_address const& remote_endpoint);
+    echo_tester(epoll& ep, socket_address const& remote_endpoint, socket_options const& options);
 
 private:
     void tick();
@@ -52,11 +54,52 @@ private:
 private:
     epoll& ep;
     timer_element timer;
-    ipv4_endpoint remote_endpoint;
+    socket_address remote_endpoint;
+    // applied to every connection before connect
+    socket_options options;
     std::map<connection*, std::unique_ptr<connection>> connections;
     uint32_t next_connection_number;
     size_t desired_number_of_connections;
     size_t number_of_permanent_connections;
 };
 
+// Sends numbered datagrams to a UDP echo server and checks the echoed
+// ones, keeping a window of datagrams in flight. Prints the rates and the
+// losses every second.
+struct udp_echo_tester
+{
+    // with gso datagrams are sent and received as segments of large
+    // messages, which needs UDP GSO/GRO support in the kernel
+    udp_echo_tester(epoll& ep, socket_address const& remote_endpoint, socket_options const& options,
+                    size_t datagram_size, bool gso);
+
+private:
+    void pump();
+    void send_some();
+    void receive_some();
+    void check_datagram(char const* data, size_t size);
+    void report();
+
+private:
+    epoll& ep;
+    socket_address remote_endpoint;
+    size_t datagram_size;
+    // datagrams per sent message, 1 without gso
+    size_t segments;
+    size_t window;
+    datagram_socket socket;
+    datagram_batch send_batch;
+    datagram_batch receive_batch;
+    std::vector<char> message;
+    uint64_t next_sequence;
+    uint64_t in_flight;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t mismatched;
+    uint64_t lost;
+    uint64_t sent_reported;
+    uint64_t received_reported;
+    timer_element report_timer;
+};
+
 #endif // ECHO_TESTER_H
@@ -1,88 +1,202 @@
 #include "epoll.h"
 
 #include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 
+#include "socket.h"
 #include "throw_error.h"
+#include "uring.h"
 
 using namespace sysapi;
 
-epoll::epoll()
+namespace
 {
-    int r = ::epoll_create1(EPOLL_CLOEXEC);
-    if (r == -1)
-        throw_error(errno, "epoll_create1()");
+    unsigned const uring_entries = 256;
+    // upper bound of posted actions run per iteration, the rest waits
+    // until the events of the iteration are dispatched
+    size_t const max_posted_actions = 1024;
+
+    timer::clock_t::duration const infinite_timeout = timer::clock_t::duration::max();
+    // how soon interest changes the kernel refused are tried again
+    timer::clock_t::duration const update_retry_interval = std::chrono::milliseconds(10);
+
+    uint64_t to_nanoseconds(timer::clock_t::duration d)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+
+    timespec to_timespec(timer::clock_t::duration d)
+    {
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        return timespec{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+    }
+
+    int to_milliseconds_rounded_up(timer::clock_t::duration d)
+    {
+        if (d == infinite_timeout)
+            return -1;
 
-    assert(r >= 0);
+        // truncating would wake up before the deadline and spin
+        // with zero timeout until it is reached
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(d);
+        if (ms < d)
+            ++ms;
 
-    fd_.reset(r);
+        return static_cast<int>(ms.count());
+    }
+
+    int epoll_pwait2(int epfd, epoll_event* events, int max_events, timespec const* timeout)
+    {
+#ifdef __NR_epoll_pwait2
+        return static_cast<int>(::syscall(__NR_epoll_pwait2, epfd, events, max_events, timeout, nullptr, 0));
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
 }
 
-epoll::epoll(epoll&& rhs)
-    : fd_(std::move(rhs.fd_))
+epoll::epoll()
+    : epoll(epoll_backend::epoll)
 {}
 
-epoll& epoll::operator=(epoll rhs)
+epoll::epoll(epoll_backend backend)
+    : stats_enabled_(false)
+    , high_resolution_timers_(false)
+    , epoll_pwait2_supported_(true)
+    , running_(false)
+    , timer_slack_lowered_(false)
+    , saved_timer_slack_()
+    , dispatch_current_()
+    , dispatch_end_()
+    , stop_requested_(false)
+    , sleeping_(false)
 {
-    swap(rhs);
-    return *this;
+    if (backend == epoll_backend::io_uring)
+    {
+        uring_.reset(new uring_poller(uring_entries));
+    }
+    else
+    {
+        int r = ::epoll_create1(EPOLL_CLOEXEC);
+        if (r == -1)
+            throw_error(errno, "epoll_create1()");
+
+        assert(r >= 0);
+
+        fd_.reset(r);
+    }
+
+    // posted actions are run from run(), the eventfd only interrupts the wait
+    wakeup_.reset(new eventfd(*this, false, [] {}));
 }
 
-void epoll::swap(epoll& other)
+epoll::~epoll()
+{}
+
+epoll_backend epoll::get_backend() const
 {
-    using std::swap;
-    swap(fd_, other.fd_);
+    return uring_ ? epoll_backend::io_uring : epoll_backend::epoll;
 }
 
 void epoll::run()
 {
-    for (;;)
+    // marks the loop as running, with the timer slack of the mode, until
+    // run() is left, also by an exception
+    struct running_scope
     {
-        std::array<epoll_event, 100> ev;
-
-    again:
-        int timeout = run_timers_calculate_timeout();
-        int r = ::epoll_wait(fd_.getfd(), ev.data(), ev.size(), timeout);
+        explicit running_scope(epoll& ep)
+            : ep(ep)
+        {
+            ep.running_ = true;
+            ep.update_timer_slack();
+        }
 
-        if (r < 0)
+        ~running_scope()
         {
-            int err = errno;
+            ep.running_ = false;
+            ep.update_timer_slack();
+        }
 
-            if (err == EINTR)
-                goto again;
+        epoll& ep;
+    };
 
-            throw_error(err, "epoll_wait()");
-        }
+    std::array<epoll_event, 100> ev;
+    timer::clock_t::time_point woken_up = timer_.update_now();
+    running_scope running(*this);
+
+    while (!stop_requested_)
+    {
+        run_posted_actions();
+        if (stop_requested_)
+            break;
 
-        if (r == 0)
-            goto again;
+        timer::clock_t::duration timeout = run_timers_calculate_timeout();
+        flush_updates();
+        if (!pending_updates_.empty())
+            timeout = std::min(timeout, update_retry_interval);
 
-        assert(r > 0);
-        size_t num_events = static_cast<size_t>(r);
+        sleeping_.store(true);
+        if (!posted_.empty())
+            timeout = timer::clock_t::duration::zero();
+
+        timer::clock_t::time_point going_to_sleep;
+        if (stats_enabled_)
+        {
+            going_to_sleep = timer::clock_t::now();
+            stats_.iteration_time.record(to_nanoseconds(going_to_sleep - woken_up));
+        }
+
+        size_t num_events = wait(ev.data(), ev.size(), timeout);
         assert(num_events <= ev.size());
 
-        for (auto i = ev.begin(); i != ev.begin() + num_events; ++i)
+        sleeping_.store(false, std::memory_order_relaxed);
+
+        woken_up = timer_.update_now();
+        if (stats_enabled_)
         {
-            try
-            {
-                epoll_event const& ee = *i;
-                static_cast<epoll_registration*>(ee.data.ptr)->callback(ee.events);
-            }
-            catch (std::exception const& e)
-            {
-                std::cerr << "error: " << e.what() << std::endl;
-            }
-            catch (...)
+            stats_.wait_time.record(to_nanoseconds(woken_up - going_to_sleep));
+            stats_.events_per_wakeup.record(num_events);
+        }
+
+        dispatch_current_ = ev.data();
+        dispatch_end_ = ev.data() + num_events;
+
+        timer::clock_t::time_point callback_started = woken_up;
+        while (dispatch_current_ != dispatch_end_)
+        {
+            epoll_event const& ee = *dispatch_current_++;
+            epoll_registration* reg = static_cast<epoll_registration*>(ee.data.ptr);
+            if (reg == nullptr)
+                continue;
+
+            int fd = reg->fd;
+            dispatch(reg, ee.events);
+
+            if (stats_enabled_)
             {
-                std::cerr << "unknown exception in message loop" << std::endl;
+                timer::clock_t::time_point callback_finished = timer::clock_t::now();
+                stats_.record_callback(to_nanoseconds(callback_finished - callback_started), fd);
+                callback_started = callback_finished;
             }
         }
+
+        dispatch_current_ = nullptr;
+        dispatch_end_ = nullptr;
     }
+
+    stop_requested_ = false;
 }
 
 timer& epoll::get_timer()
@@ -90,8 +204,53 @@ timer& epoll::get_timer()
     return timer_;
 }
 
+slab_allocator& epoll::get_slab_allocator(size_t object_size)
+{
+    // a handful of distinct sizes is expected
+    for (std::unique_ptr<slab_allocator> const& a : slab_allocators_)
+        if (a->get_object_size() >= object_size && a->get_object_size() < object_size + alignof(std::max_align_t))
+            return *a;
+
+    slab_allocators_.emplace_back(new slab_allocator(object_size));
+    return *slab_allocators_.back();
+}
+
+buffer_pool& epoll::get_buffer_pool()
+{
+    return buffer_pool_;
+}
+
+zerocopy_graveyard& epoll::get_zerocopy_graveyard()
+{
+    if (!zerocopy_graveyard_)
+        zerocopy_graveyard_.reset(new zerocopy_graveyard(*this));
+    return *zerocopy_graveyard_;
+}
+
+void epoll::post(action_t action)
+{
+    posted_.push(std::move(action));
+
+    // the loop is awake, it checks the queue before going to sleep again
+    if (sleeping_.exchange(false))
+        wakeup_->notify();
+}
+
+void epoll::stop()
+{
+    post([this] {
+        stop_requested_ = true;
+    });
+}
+
 void epoll::add(int fd, uint32_t events, epoll_registration* reg)
 {
+    if (uring_)
+    {
+        uring_->add(fd, events, reg);
+        return;
+    }
+
     epoll_event ev = {0, 0};
     ev.data.ptr = reg;
     ev.events   = events;
@@ -103,6 +262,12 @@ void epoll::add(int fd, uint32_t events, epoll_registration* reg)
 
 void epoll::modify(int fd, uint32_t events, epoll_registration* reg)
 {
+    if (uring_)
+    {
+        uring_->modify(fd, events, reg);
+        return;
+    }
+
     epoll_event ev = {0, 0};
     ev.data.ptr = reg;
     ev.events   = events;
@@ -114,35 +279,307 @@ void epoll::modify(int fd, uint32_t events, epoll_registration* reg)
 
 void epoll::remove(int fd)
 {
+    if (uring_)
+    {
+        uring_->remove(fd);
+        return;
+    }
+
     int r = ::epoll_ctl(fd_.getfd(), EPOLL_CTL_DEL, fd, nullptr);
     if (r < 0)
         throw_error(errno, "epoll_ctl(EPOLL_CTL_DEL)");
 }
 
-int epoll::run_timers_calculate_timeout()
+void epoll::schedule_update(epoll_registration* reg)
+{
+    if (reg->pending_index != epoll_registration::not_pending)
+        return;
+
+    reg->pending_index = pending_updates_.size();
+    pending_updates_.push_back(reg);
+}
+
+void epoll::cancel_update(epoll_registration* reg)
+{
+    size_t index = reg->pending_index;
+    if (index == epoll_registration::not_pending)
+        return;
+
+    assert(pending_updates_[index] == reg);
+    epoll_registration* last = pending_updates_.back();
+    pending_updates_[index] = last;
+    last->pending_index = index;
+    pending_updates_.pop_back();
+    reg->pending_index = epoll_registration::not_pending;
+}
+
+void epoll::flush_updates()
+{
+    // registrations whose change the kernel refused are moved to the
+    // front and stay pending, the change is reissued on the next flush
+    size_t failed = 0;
+    for (size_t i = 0; i != pending_updates_.size(); ++i)
+    {
+        epoll_registration* reg = pending_updates_[i];
+        reg->pending_index = epoll_registration::not_pending;
+
+        // several changes that end up with the interest the kernel
+        // already has cost nothing
+        if (reg->events == reg->registered_events && !reg->force_update)
+            continue;
+
+        try
+        {
+            modify(reg->fd, reg->events, reg);
+            reg->registered_events = reg->events;
+            reg->force_update = false;
+        }
+        catch (std::exception const&)
+        {
+            reg->force_update = true;
+            reg->pending_index = failed;
+            pending_updates_[failed++] = reg;
+        }
+    }
+
+    pending_updates_.resize(failed);
+}
+
+void epoll::retarget(epoll_registration* a, epoll_registration* b)
+{
+    for (epoll_event* i = dispatch_current_; i != dispatch_end_; ++i)
+    {
+        if (i->data.ptr == a)
+            i->data.ptr = b;
+        else if (b != nullptr && i->data.ptr == b)
+            i->data.ptr = a;
+    }
+}
+
+void epoll::set_stats_enabled(bool enabled)
+{
+    stats_enabled_ = enabled;
+    timer_.set_stats(enabled ? &stats_ : nullptr);
+}
+
+loop_stats const& epoll::get_stats() const
+{
+    return stats_;
+}
+
+void epoll::set_high_resolution_timers(bool enabled)
+{
+    high_resolution_timers_ = enabled;
+    if (!enabled)
+        timer_fd_reg_.reset();
+    update_timer_slack();
+}
+
+void epoll::update_timer_slack()
+{
+    // the slack is per thread, it is changed only while run() is on it;
+    // the default one of 50us would make the high resolution timeouts
+    // pointless
+    bool lower = running_ && high_resolution_timers_;
+    if (lower == timer_slack_lowered_)
+        return;
+
+    if (lower)
+    {
+        int r = ::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+        if (r == -1)
+            throw_error(errno, "prctl(PR_GET_TIMERSLACK)");
+        saved_timer_slack_ = static_cast<unsigned long>(r);
+        ::prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+    }
+    else
+    {
+        ::prctl(PR_SET_TIMERSLACK, saved_timer_slack_, 0UL, 0UL, 0UL);
+    }
+
+    timer_slack_lowered_ = lower;
+}
+
+size_t epoll::wait(epoll_event* events, size_t max_events, timer::clock_t::duration timeout)
+{
+    if (uring_)
+    {
+        // io_uring takes a timespec, it is precise in any mode
+        timespec ts = to_timespec(timeout);
+        return uring_->wait(events, max_events, timeout == infinite_timeout ? nullptr : &ts);
+    }
+
+    if (high_resolution_timers_)
+        return wait_high_resolution(events, max_events, timeout);
+
+    int r = ::epoll_wait(fd_.getfd(), events, static_cast<int>(max_events), to_milliseconds_rounded_up(timeout));
+    if (r < 0)
+    {
+        int err = errno;
+
+        if (err == EINTR)
+            return 0;
+
+        throw_error(err, "epoll_wait()");
+    }
+
+    return static_cast<size_t>(r);
+}
+
+size_t epoll::wait_high_resolution(epoll_event* events, size_t max_events, timer::clock_t::duration timeout)
+{
+    int r;
+
+    if (epoll_pwait2_supported_)
+    {
+        timespec ts = to_timespec(timeout);
+        r = epoll_pwait2(fd_.getfd(), events, static_cast<int>(max_events), timeout == infinite_timeout ? nullptr : &ts);
+        if (r < 0 && errno == ENOSYS)
+            epoll_pwait2_supported_ = false;
+    }
+
+    if (!epoll_pwait2_supported_)
+    {
+        // the timerfd is part of the epoll set, its expiration interrupts
+        // the wait, epoll_wait itself only gets zero or infinite timeout
+        bool zero = timeout == timer::clock_t::duration::zero();
+        if (!zero)
+            arm_timer_fd(timer_.empty() ? timer::clock_t::time_point::max() : timer_.top());
+        r = ::epoll_wait(fd_.getfd(), events, static_cast<int>(max_events), zero ? 0 : -1);
+    }
+
+    if (r < 0)
+    {
+        int err = errno;
+
+        if (err == EINTR)
+            return 0;
+
+        throw_error(err, "epoll_pwait2()");
+    }
+
+    return static_cast<size_t>(r);
+}
+
+void epoll::arm_timer_fd(timer::clock_t::time_point deadline)
+{
+    if (!timer_fd_reg_)
+    {
+        int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd == -1)
+            throw_error(errno, "timerfd_create()");
+        timer_fd_.reset(fd);
+        timer_fd_deadline_ = timer::clock_t::time_point::max();
+
+        // timers themselves are run at the beginning of the next iteration
+        timer_fd_reg_.reset(new epoll_registration(*this, fd, EPOLLIN, [this](uint32_t) {
+            uint64_t expirations;
+            ssize_t res = ::read(timer_fd_.getfd(), &expirations, sizeof expirations);
+            if (res == -1 && errno != EAGAIN)
+                throw_error(errno, "read(timerfd)");
+        }));
+    }
+
+    if (deadline == timer_fd_deadline_)
+        return;
+
+    // steady_clock is CLOCK_MONOTONIC, the deadline can be passed as is;
+    // zero it_value disarms the timer
+    itimerspec its{};
+    if (deadline != timer::clock_t::time_point::max())
+    {
+        its.it_value = to_timespec(deadline.time_since_epoch());
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;
+    }
+
+    int res = ::timerfd_settime(timer_fd_.getfd(), TFD_TIMER_ABSTIME, &its, nullptr);
+    if (res == -1)
+        throw_error(errno, "timerfd_settime()");
+
+    timer_fd_deadline_ = deadline;
+}
+
+void epoll::dispatch(epoll_registration* reg, uint32_t events)
+{
+    try
+    {
+        reg->callback(events);
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+    }
+    catch (...)
+    {
+        std::cerr << "unknown exception in message loop" << std::endl;
+    }
+}
+
+void epoll::run_posted_actions()
+{
+    timer::clock_t::time_point started;
+    if (stats_enabled_)
+        started = timer::clock_t::now();
+
+    action_t action;
+    for (size_t i = 0; i != max_posted_actions && posted_.pop(action); ++i)
+    {
+        try
+        {
+            action();
+        }
+        catch (std::exception const& e)
+        {
+            std::cerr << "error: " << e.what() << std::endl;
+        }
+        catch (...)
+        {
+            std::cerr << "unknown exception in posted action" << std::endl;
+        }
+        action = action_t();
+
+        if (stats_enabled_)
+        {
+            timer::clock_t::time_point finished = timer::clock_t::now();
+            stats_.record_callback(to_nanoseconds(finished - started), -1);
+            started = finished;
+        }
+    }
+}
+
+timer::clock_t::duration epoll::run_timers_calculate_timeout()
 {
     if (timer_.empty())
-        return -1;
+        return infinite_timeout;
 
-    timer::clock_t::time_point now = timer::clock_t::now();
+    // the clock was sampled on wakeup; the time spent in callbacks since
+    // then only matters when the timers are asked to be precise
+    timer::clock_t::time_point now = high_resolution_timers_ ? timer_.update_now() : timer_.now();
     timer_.notify(now);
 
     if (timer_.empty())
-        return -1;
+        return infinite_timeout;
 
-    return std::chrono::duration_cast<std::chrono::milliseconds>(timer_.top() - now).count();
+    return timer_.top() - now;
 }
 
 epoll_registration::epoll_registration()
     : ep()
     , fd(-1)
     , events()
+    , registered_events()
+    , force_update(false)
+    , pending_index(not_pending)
 {}
 
 epoll_registration::epoll_registration(epoll& ep, int fd, uint32_t events, callback_t callback)
     : ep(&ep)
     , fd(fd)
     , events(events)
+    , registered_events(events)
+    , force_update(false)
+    , pending_index(not_pending)
     , callback(std::move(callback))
 {
     ep.add(fd, events, this);
@@ -152,12 +589,21 @@ epoll_registration::epoll_registration(epoll_registration&& rhs)
     : ep(rhs.ep)
     , fd(rhs.fd)
     , events(rhs.events)
+    , registered_events(rhs.registered_events)
+    , force_update(false)
+    , pending_index(not_pending)
     , callback(std::move(rhs.callback))
 {
+    if (ep)
+    {
+        ep->cancel_update(&rhs);
+        ep->retarget(&rhs, this);
+    }
     update();
     rhs.ep = nullptr;
     rhs.fd = -1;
     rhs.events = 0;
+    rhs.registered_events = 0;
     rhs.callback = callback_t();
 }
 
@@ -179,16 +625,37 @@ void epoll_registration::modify(uint32_t new_events)
     if (events == new_events)
         return;
 
-    ep->modify(fd, new_events, this);
     events = new_events;
+    ep->schedule_update(this);
+}
+
+void epoll_registration::rearm()
+{
+    assert(ep);
+
+    force_update = true;
+    ep->schedule_update(this);
 }
 
 void epoll_registration::swap(epoll_registration& other)
 {
-    std::swap(ep,       other.ep);
-    std::swap(fd,       other.fd);
-    std::swap(events,   other.events);
-    std::swap(callback, other.callback);
+    if (ep)
+    {
+        ep->cancel_update(this);
+        ep->retarget(this, &other);
+    }
+    if (other.ep)
+    {
+        other.ep->cancel_update(&other);
+        if (other.ep != ep)
+            other.ep->retarget(&other, this);
+    }
+
+    std::swap(ep,                other.ep);
+    std::swap(fd,                other.fd);
+    std::swap(events,            other.events);
+    std::swap(registered_events, other.registered_events);
+    std::swap(callback,          other.callback);
     update();
     other.update();
 }
@@ -197,10 +664,15 @@ void epoll_registration::clear()
 {
     if (ep)
     {
+        // a pending modification is dropped, only the removal is issued
+        ep->cancel_update(this);
+        ep->retarget(this, nullptr);
         ep->remove(fd);
         ep = nullptr;
         fd = -1;
         events = 0;
+        registered_events = 0;
+        force_update = false;
     }
 }
 
@@ -211,6 +683,11 @@ epoll& epoll_registration::get_epoll() const
 
 void epoll_registration::update()
 {
+    // the kernel keeps a pointer to the registration, it has to be
+    // updated after the registration is moved
     if (ep)
-        ep->modify(fd, events, this);
+    {
+        force_update = true;
+        ep->schedule_update(this);
+    }
 }
@@ -1,48 +1,150 @@
 #ifndef EPOLL_H
 #define EPOLL_H
 
+#include "buffer_pool.h"
 #include "file_descriptor.h"
+#include "loop_stats.h"
+#include "mpsc_queue.h"
+#include "slab_allocator.h"
+#include "small_function.h"
 #include "timer.h"
 
-#include <functional>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <vector>
+
+struct epoll_event;
+struct eventfd;
+struct zerocopy_graveyard;
 
 namespace sysapi
 {
     struct epoll;
     struct epoll_registration;
+    struct uring_poller;
+
+    enum class epoll_backend
+    {
+        epoll,
+        // readiness is polled with io_uring, all interest changes of an
+        // iteration are submitted together with the wait
+        io_uring,
+    };
 
     struct epoll
     {
-        typedef std::function<void ()> action_t;
+        typedef small_function<void ()> action_t;
         epoll();
+        explicit epoll(epoll_backend backend);
+        // registrations of the loop keep pointers to it
         epoll(epoll const&) = delete;
-        epoll(epoll&&);
+        epoll& operator=(epoll const&) = delete;
+        ~epoll();
 
-        epoll& operator=(epoll);
-
-        void swap(epoll& other);
+        epoll_backend get_backend() const;
 
         void run();
         timer& get_timer();
 
+        // can be called from any thread, the action is run on the loop
+        // thread during one of the next iterations
+        void post(action_t action);
+        // can be called from any thread, makes run() return
+        void stop();
+
+        // statistics are collected only while enabled; must be called
+        // from the loop thread or before run()
+        void set_stats_enabled(bool enabled);
+        // can be used from any thread to take a snapshot
+        loop_stats const& get_stats() const;
+
+        // allocator of objects of the given size for this loop, objects
+        // must be allocated and freed on the loop thread and must not
+        // outlive the loop
+        slab_allocator& get_slab_allocator(size_t object_size);
+
+        // I/O buffers lent to the connections of this loop, used on the
+        // loop thread only
+        buffer_pool& get_buffer_pool();
+
+        // where client sockets destroyed with zerocopy sends in flight
+        // wait for the completions, used on the loop thread only
+        zerocopy_graveyard& get_zerocopy_graveyard();
+
+        // by default the wait timeout has millisecond granularity (rounded
+        // up). In high resolution mode timers are honored with microsecond
+        // precision using epoll_pwait2, or a timerfd on kernels before 5.11.
+        // While run() is in this mode the timer slack of the loop thread is
+        // lowered, the previous one is restored when the mode is disabled or
+        // run() returns. Must be called from the loop thread or before run()
+        void set_high_resolution_timers(bool enabled);
+
     private:
         void add(int fd, uint32_t events, epoll_registration*);
         void modify(int fd, uint32_t events, epoll_registration*);
         void remove(int fd);
 
-        int run_timers_calculate_timeout();
+        // interest changes are collected here and applied once per
+        // iteration, right before epoll_wait; a change the kernel
+        // refuses is retried, the wait is kept short meanwhile
+        void schedule_update(epoll_registration*);
+        void cancel_update(epoll_registration*);
+        void flush_updates();
+
+        // fixes up events of the batch being dispatched when
+        // a registration is moved or destroyed
+        void retarget(epoll_registration* a, epoll_registration* b);
+
+        // returns infinite_timeout when there are no timers
+        timer::clock_t::duration run_timers_calculate_timeout();
+        void run_posted_actions();
+        size_t wait(epoll_event* events, size_t max_events, timer::clock_t::duration timeout);
+        size_t wait_high_resolution(epoll_event* events, size_t max_events, timer::clock_t::duration timeout);
+        void arm_timer_fd(timer::clock_t::time_point deadline);
+        // makes the timer slack of the thread match running_ and the mode
+        void update_timer_slack();
+        void dispatch(epoll_registration* reg, uint32_t events);
 
     private:
+        std::vector<std::unique_ptr<slab_allocator>> slab_allocators_;
+        buffer_pool buffer_pool_;
         file_descriptor fd_;
+        std::unique_ptr<uring_poller> uring_;
         timer timer_;
+        bool stats_enabled_;
+        loop_stats stats_;
+        bool high_resolution_timers_;
+        bool epoll_pwait2_supported_;
+        bool running_;
+        bool timer_slack_lowered_;
+        unsigned long saved_timer_slack_;
+        std::vector<epoll_registration*> pending_updates_;
+        epoll_event* dispatch_current_;
+        epoll_event* dispatch_end_;
+        bool stop_requested_;
+
+        mpsc_queue<action_t> posted_;
+        // set while the loop is blocked (or about to block) in the wait,
+        // only the poster that resets it writes to the eventfd
+        std::atomic<bool> sleeping_;
+        std::unique_ptr<eventfd> wakeup_;
+
+        // fallback for high resolution timers without epoll_pwait2
+        file_descriptor timer_fd_;
+        std::unique_ptr<epoll_registration> timer_fd_reg_;
+        timer::clock_t::time_point timer_fd_deadline_;
+
+        // created on first use; declared last, its sockets use the rest
+        // of the loop until they are released
+        std::unique_ptr<zerocopy_graveyard> zerocopy_graveyard_;
 
         friend struct epoll_registration;
     };
 
     struct epoll_registration
     {
-        typedef std::function<void (uint32_t)> callback_t;
+        typedef small_function<void (uint32_t)> callback_t;
 
         epoll_registration();
         epoll_registration(epoll&, int fd, uint32_t events, callback_t callback);
@@ -53,6 +155,9 @@ namespace sysapi
         epoll_registration& operator=(epoll_registration);
 
         void modify(uint32_t new_events);
+        // reissues the current interest, for EPOLLET registrations this
+        // reports the readiness again if it is still present
+        void rearm();
 
         void swap(epoll_registration& other);
 
@@ -63,9 +168,14 @@ namespace sysapi
         void update();
 
     private:
+        static size_t const not_pending = static_cast<size_t>(-1);
+
         epoll* ep;
         int fd;
         uint32_t events;
+        uint32_t registered_events;
+        bool force_update;
+        size_t pending_index;
         callback_t callback;
 
         friend struct epoll;
@@ -73,6 +183,7 @@ namespace sysapi
 }
 
 using sysapi::epoll;
+using sysapi::epoll_backend;
 using sysapi::epoll_registration;
 
 #endif
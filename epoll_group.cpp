@@ -0,0 +1,103 @@
+#include "epoll_group.h"
+
+#include <cassert>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+using namespace sysapi;
+
+epoll_group::epoll_group(size_t number_of_loops)
+    : epoll_group(number_of_loops, epoll_backend::epoll)
+{}
+
+epoll_group::epoll_group(size_t number_of_loops, epoll_backend backend)
+{
+    assert(number_of_loops != 0);
+
+    loops.reserve(number_of_loops);
+    for (size_t i = 0; i != number_of_loops; ++i)
+        loops.emplace_back(new epoll(backend));
+}
+
+size_t epoll_group::size() const
+{
+    return loops.size();
+}
+
+epoll& epoll_group::get_epoll(size_t index)
+{
+    assert(index < loops.size());
+    return *loops[index];
+}
+
+void epoll_group::run()
+{
+    std::mutex m;
+    std::exception_ptr error;
+
+    auto run_loop = [&](epoll& ep) {
+        try
+        {
+            ep.run();
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lg(m);
+                if (!error)
+                    error = std::current_exception();
+            }
+            stop();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(loops.size() - 1);
+
+    try
+    {
+        for (size_t i = 1; i != loops.size(); ++i)
+            threads.emplace_back(run_loop, std::ref(*loops[i]));
+    }
+    catch (...)
+    {
+        stop();
+        for (std::thread& t : threads)
+            t.join();
+        throw;
+    }
+
+    run_loop(*loops[0]);
+
+    for (std::thread& t : threads)
+        t.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void epoll_group::stop()
+{
+    for (std::unique_ptr<epoll> const& ep : loops)
+        ep->stop();
+}
+
+void epoll_group::set_stats_enabled(bool enabled)
+{
+    for (std::unique_ptr<epoll> const& ep : loops)
+        ep->set_stats_enabled(enabled);
+}
+
+void epoll_group::print_stats(std::ostream& os) const
+{
+    for (size_t i = 0; i != loops.size(); ++i)
+        os << "loop " << i << ":\n" << loops[i]->get_stats().snapshot();
+    os.flush();
+}
+
+size_t epoll_group::default_number_of_loops()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
@@ -0,0 +1,47 @@
+#ifndef EPOLL_GROUP_H
+#define EPOLL_GROUP_H
+
+#include "epoll.h"
+
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace sysapi
+{
+    // N independent event loops, each run on its own thread.
+    // Objects registered in a loop (sockets, timers) belong to
+    // that loop and must be used only from its thread.
+    struct epoll_group
+    {
+        explicit epoll_group(size_t number_of_loops);
+        epoll_group(size_t number_of_loops, epoll_backend backend);
+        epoll_group(epoll_group const&) = delete;
+        epoll_group& operator=(epoll_group const&) = delete;
+
+        size_t size() const;
+        epoll& get_epoll(size_t index);
+
+        // runs loop 0 on the calling thread and the rest on
+        // additional threads, returns when all loops are stopped.
+        // If one of the loops fails the others are stopped and the
+        // error is rethrown
+        void run();
+        // can be called from any thread
+        void stop();
+
+        // must be called before run()
+        void set_stats_enabled(bool enabled);
+        // can be called from any thread
+        void print_stats(std::ostream& os) const;
+
+        static size_t default_number_of_loops();
+
+    private:
+        std::vector<std::unique_ptr<epoll>> loops;
+    };
+}
+
+using sysapi::epoll_group;
+
+#endif // EPOLL_GROUP_H
@@ -0,0 +1,314 @@
+#include <gtest/gtest.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "epoll.h"
+
+namespace
+{
+    // connected pair of non-blocking stream sockets, the first one is
+    // readable
+    std::pair<file_descriptor, file_descriptor> make_readable_pair()
+    {
+        int fds[2];
+        int res = ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds);
+        EXPECT_EQ(res, 0);
+        write(weak_file_descriptor(fds[1]), "x", 1);
+        return std::make_pair(file_descriptor(fds[0]), file_descriptor(fds[1]));
+    }
+
+    // runs the loop for a while
+    void run_for(epoll& ep, timer::clock_t::duration d)
+    {
+        timer_element stop(ep.get_timer(), d, [&ep] { ep.stop(); });
+        ep.run();
+    }
+}
+
+TEST(epoll, coalesce01)
+{
+    epoll ep;
+    auto fds = make_readable_pair();
+    size_t calls = 0;
+    epoll_registration reg(ep, fds.first.getfd(), EPOLLIN, [&](uint32_t) { ++calls; });
+
+    // the pending modification is dropped, only the removal is issued,
+    // the descriptor is already closed when the updates are flushed
+    reg.modify(EPOLLIN | EPOLLOUT);
+    reg.clear();
+    fds.first = file_descriptor();
+
+    testing::internal::CaptureStderr();
+    run_for(ep, std::chrono::milliseconds(10));
+    EXPECT_EQ(testing::internal::GetCapturedStderr(), "");
+    EXPECT_EQ(calls, 0u);
+}
+
+TEST(epoll, coalesce02)
+{
+    epoll ep;
+    auto fds = make_readable_pair();
+    size_t calls = 0;
+    epoll_registration reg(ep, fds.first.getfd(), 0, [&](uint32_t) {
+        ++calls;
+        ep.stop();
+    });
+
+    // changes that end up with the interest registered already
+    reg.modify(EPOLLIN);
+    reg.modify(0);
+    run_for(ep, std::chrono::milliseconds(10));
+    EXPECT_EQ(calls, 0u);
+
+    reg.modify(EPOLLIN);
+    run_for(ep, std::chrono::seconds(5));
+    EXPECT_EQ(calls, 1u);
+}
+
+TEST(epoll, update_retry01)
+{
+    epoll ep;
+    auto fds = make_readable_pair();
+    int fd = fds.first.getfd();
+    size_t calls = 0;
+    epoll_registration reg(ep, fd, 0, [&](uint32_t) {
+        ++calls;
+        ep.stop();
+    });
+
+    // the file stays registered through a duplicate while its number is
+    // closed, the kernel refuses the change until the number is back
+    file_descriptor copy(::dup(fd));
+    fds.first.close();
+    reg.modify(EPOLLIN);
+    run_for(ep, std::chrono::milliseconds(20));
+    EXPECT_EQ(calls, 0u);
+
+    ASSERT_EQ(::dup2(copy.getfd(), fd), fd);
+    fds.first = file_descriptor(fd);
+    run_for(ep, std::chrono::seconds(5));
+    EXPECT_EQ(calls, 1u);
+}
+
+TEST(epoll, destroy_in_callback01)
+{
+    epoll ep;
+    auto a = make_readable_pair();
+    auto b = make_readable_pair();
+
+    // both events are in one batch, the first callback destroys both
+    // registrations, the event of the other one must not be dispatched
+    size_t calls = 0;
+    std::unique_ptr<epoll_registration> regs[2];
+    for (size_t i = 0; i != 2; ++i)
+    {
+        regs[i].reset(new epoll_registration(ep, (i == 0 ? a : b).first.getfd(), EPOLLIN, [&](uint32_t) {
+            // the callback itself is destroyed, its captures with it
+            std::unique_ptr<epoll_registration>* r = regs;
+            epoll& e = ep;
+            ++calls;
+            r[0].reset();
+            r[1].reset();
+            e.stop();
+        }));
+    }
+
+    ep.run();
+    EXPECT_EQ(calls, 1u);
+}
+
+TEST(epoll, move_in_callback01)
+{
+    epoll ep;
+    auto a = make_readable_pair();
+    auto b = make_readable_pair();
+
+    // the first callback moves the other registration, its event still
+    // in the batch follows it to the new place
+    size_t calls[2] = {0, 0};
+    std::unique_ptr<epoll_registration> regs[2];
+    epoll_registration moved;
+    for (size_t i = 0; i != 2; ++i)
+    {
+        regs[i].reset(new epoll_registration(ep, (i == 0 ? a : b).first.getfd(), EPOLLIN, [&, i](uint32_t) {
+            ++calls[i];
+            if (calls[0] + calls[1] == 1)
+            {
+                moved = std::move(*regs[1 - i]);
+                regs[1 - i].reset();
+            }
+            ep.stop();
+        }));
+    }
+
+    ep.run();
+    EXPECT_EQ(calls[0], 1u);
+    EXPECT_EQ(calls[1], 1u);
+}
+
+TEST(epoll, post_wakeup01)
+{
+    epoll ep;
+    std::thread::id loop_thread = std::this_thread::get_id();
+    bool run_on_loop_thread = false;
+
+    // the loop is asleep without timers by the time the action is posted,
+    // only the eventfd can wake it up
+    std::thread poster([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ep.post([&] {
+            run_on_loop_thread = std::this_thread::get_id() == loop_thread;
+            ep.stop();
+        });
+    });
+
+    ep.run();
+    poster.join();
+    EXPECT_TRUE(run_on_loop_thread);
+}
+
+TEST(epoll, post_producers01)
+{
+    epoll ep;
+    size_t const producers = 4;
+    size_t const per_producer = 10000;
+
+    // every action is run once, actions of a producer in the order they
+    // were posted
+    std::vector<size_t> next(producers, 0);
+    size_t total = 0;
+    bool in_order = true;
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p != producers; ++p)
+    {
+        threads.emplace_back([&, p] {
+            for (size_t i = 0; i != per_producer; ++i)
+            {
+                ep.post([&, p, i] {
+                    if (next[p]++ != i)
+                        in_order = false;
+                    if (++total == producers * per_producer)
+                        ep.stop();
+                });
+            }
+        });
+    }
+
+    timer_element deadline(ep.get_timer(), std::chrono::seconds(10), [&ep] { ep.stop(); });
+    ep.run();
+    for (std::thread& t : threads)
+        t.join();
+
+    EXPECT_EQ(total, producers * per_producer);
+    EXPECT_TRUE(in_order);
+    for (size_t p = 0; p != producers; ++p)
+        EXPECT_EQ(next[p], per_producer);
+}
+
+TEST(epoll, high_resolution01)
+{
+    epoll ep;
+    ep.set_high_resolution_timers(true);
+
+    // with millisecond granularity each of the timeouts would be rounded
+    // up to a full millisecond
+    size_t const rounds = 10;
+    size_t fired = 0;
+    bool early = false;
+    timer::clock_t::time_point deadline = timer::clock_t::now() + std::chrono::microseconds(100);
+    timer_element t;
+    t.set_callback([&] {
+        if (timer::clock_t::now() < deadline)
+            early = true;
+        if (++fired == rounds)
+        {
+            ep.stop();
+            return;
+        }
+        deadline = timer::clock_t::now() + std::chrono::microseconds(100);
+        t.restart(ep.get_timer(), deadline);
+    });
+
+    timer::clock_t::time_point start = timer::clock_t::now();
+    t.restart(ep.get_timer(), deadline);
+    ep.run();
+    EXPECT_EQ(fired, rounds);
+    EXPECT_FALSE(early);
+    EXPECT_LT(timer::clock_t::now() - start, std::chrono::milliseconds(rounds - 2));
+}
+
+TEST(epoll, timer_slack01)
+{
+    epoll ep;
+    int original = ::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+    ASSERT_GT(original, 1);
+
+    // the slack is lowered only while the loop runs in high resolution
+    // mode, toggling the mode from the loop applies and restores it
+    std::vector<int> seen;
+    ep.post([&] {
+        seen.push_back(::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL));
+        ep.set_high_resolution_timers(true);
+        seen.push_back(::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL));
+        ep.set_high_resolution_timers(false);
+        seen.push_back(::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL));
+        ep.set_high_resolution_timers(true);
+        ep.stop();
+    });
+    ep.run();
+
+    ASSERT_EQ(seen.size(), 3u);
+    EXPECT_EQ(seen[0], original);
+    EXPECT_EQ(seen[1], 1);
+    EXPECT_EQ(seen[2], original);
+    EXPECT_EQ(::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL), original);
+
+    // enabled before run()
+    ep.post([&] {
+        seen.push_back(::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL));
+        ep.stop();
+    });
+    ep.run();
+    ASSERT_EQ(seen.size(), 4u);
+    EXPECT_EQ(seen[3], 1);
+    EXPECT_EQ(::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL), original);
+}
+
+TEST(epoll, timer_slack02)
+{
+    int original = ::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+    ASSERT_GT(original, 1);
+
+    // the descriptor of the loop is the lowest free one when it is
+    // created
+    int loop_fd = ::dup(0);
+    ASSERT_NE(loop_fd, -1);
+    ::close(loop_fd);
+    epoll ep;
+    char link[64] = {};
+    ASSERT_GT(::readlink(("/proc/self/fd/" + std::to_string(loop_fd)).c_str(), link, sizeof link - 1), 0);
+    ASSERT_EQ(std::string(link), "anon_inode:[eventpoll]");
+
+    // the descriptor is replaced while the loop runs, the failed wait
+    // leaves run() with an exception
+    file_descriptor saved(::dup(loop_fd));
+    auto other = make_readable_pair();
+    ep.set_high_resolution_timers(true);
+    ep.post([&] {
+        ::dup2(other.first.getfd(), loop_fd);
+    });
+    EXPECT_THROW(ep.run(), std::exception);
+    ::dup2(saved.getfd(), loop_fd);
+
+    // restored, and the loop is not considered running anymore
+    EXPECT_EQ(::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL), original);
+    ep.set_high_resolution_timers(false);
+    ep.set_high_resolution_timers(true);
+    EXPECT_EQ(::prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL), original);
+}
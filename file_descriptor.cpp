@@ -67,8 +67,12 @@ file_descriptor::~file_descriptor() noexcept
 
 file_descriptor& file_descriptor::operator=(file_descriptor&& rhs) noexcept
 {
+    if (this == &rhs)
+        return *this;
+
     weak& that = *this;
 
+    this->close();
     that = rhs.release();
     return *this;
 }
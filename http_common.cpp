@@ -14,6 +14,8 @@ char const* status_code_as_string(http_status_code status_code)
         return "Internal Server Error";
     case http_status_code::not_implemented:
         return "Not Implemented";
+    case http_status_code::service_unavailable:
+        return "Service Unavailable";
     default:
         return "Unknown Status Code";
     }
@@ -41,6 +41,7 @@ enum class http_status_code : unsigned
 
     internal_server_error   = 500,
     not_implemented         = 501,
+    service_unavailable     = 503,
 };
 
 struct http_status_line
@@ -11,6 +11,7 @@
 namespace
 {
     constexpr const timer::clock_t::duration timeout = std::chrono::seconds(15);
+    constexpr const size_t max_request_size = 4000;
     char crlf_crlf[4] = {'\r', '\n', '\r', '\n'};
 }
 
@@ -33,33 +34,49 @@ std::string const& http_server::http_error::get_reason_phrase() const
 http_server::inbound_connection::inbound_connection(http_server* parent)
     : parent(parent)
     , socket(parent->ss.accept([this] {
-        this->parent->connections.erase(this);
+        this->parent->destroy(this);
     }, [this] {
         try_read();
     }, client_socket::on_ready_t{}))
-    , timer(parent->ep.get_timer(), timeout, [this] {
-        this->parent->connections.erase(this);
+    , timer(parent->timeouts, [this] {
+        this->parent->destroy(this);
     })
-    , request_received(0)
-    , response_size(0)
-    , response_sent(0)
+    , request(nullptr)
 {}
 
+http_server::inbound_connection::~inbound_connection()
+{
+    if (request)
+        release_request();
+}
+
 void http_server::inbound_connection::try_read()
 {
-    size_t received_now = socket.read_some(request_buffer + request_received, sizeof request_buffer - request_received);
+    if (!request)
+        request = parent->buffers.acquire(max_request_size);
+
+    char* request_buffer = request->data();
+    size_t request_received = request->end;
+    size_t received_now = socket.read_some(request_buffer + request_received, max_request_size - request_received);
     if (received_now == 0)
+    {
+        if (request_received == 0)
+            release_request();
         return;
+    }
 
-    auto i = std::search(request_buffer + request_received - 3,
+    timer.restart(parent->timeouts);
+
+    auto i = std::search(request_buffer + (request_received < 3 ? 0 : request_received - 3),
                          request_buffer + request_received + received_now,
                          std::begin(crlf_crlf),
                          std::end(crlf_crlf));
 
     request_received += received_now;
+    request->end = static_cast<uint32_t>(request_received);
     if (i == request_buffer + request_received)
     {
-        if (request_received == sizeof request_buffer)
+        if (request_received == max_request_size)
         {
             socket.set_on_read(client_socket::on_ready_t{});
             send_header(http_status_code::bad_request, "Bad Request: request is too large");
@@ -88,7 +105,7 @@ void http_server::inbound_connection::try_read()
 
 void http_server::inbound_connection::drop()
 {
-    parent->connections.erase(this);
+    parent->destroy(this);
 }
 
 void http_server::inbound_connection::new_request(char const* begin, char const* end)
@@ -128,36 +145,77 @@ void http_server::inbound_connection::new_request(char const* begin, char const*
 
     std::string const& host = i->second[0];
 
+    if (request.request_line.method == http_request_method::HEAD)
+    {
+        send_ok(std::string());
+        return;
+    }
+
+    if (parent->resolver)
+    {
+        pool_lookup = parent->resolver->resolve(parent->ep, host, [this](std::vector<ip_address> const& addresses, std::string const& error) {
+            on_resolved(addresses, error);
+        });
+        if (!pool_lookup)
+            throw http_error(http_status_code::service_unavailable, "too many pending name lookups");
+    }
+    else
+    {
+        lookup = parent->dns.resolve(host, [this](std::vector<ip_address> const& addresses, std::string const& error) {
+            on_resolved(addresses, error);
+        });
+    }
+
+    // the host is copied into the query, the buffer isn't needed anymore
+    release_request();
+}
+
+void http_server::inbound_connection::on_resolved(std::vector<ip_address> const& addresses, std::string const& error)
+{
+    if (!error.empty())
+    {
+        send_header(http_status_code::internal_server_error, error);
+        return;
+    }
+
+    std::stringstream body;
+    for (ip_address const& addr : addresses)
+    {
+        body << addr << std::endl;
+    }
+
+    send_ok(body.str());
+}
+
+void http_server::inbound_connection::send_ok(std::string const& body)
+{
     http_response response;
     response.status_line.version = http_version::HTTP_10;
     response.status_line.status_code = http_status_code::ok;
     response.status_line.reason_phrase = sub_string::literal("OK");
 
-    std::stringstream ss;
-    ss << response;
+    std::stringstream header;
+    header << response;
 
-    if (request.request_line.method == http_request_method::GET)
-    {
-        for (ipv4_address const& addr : ipv4_address::resolve(host))
-        {
-            ss << addr << std::endl;
-        }
-    }
-
-    std::string const& str = ss.str();
-    memcpy(response_buffer, str.data(), str.size());
-    response_size = str.size();
-    try_write();
+    socket.queue_output(header.str());
+    socket.queue_output(body);
+    send_response();
 }
 
-void http_server::inbound_connection::try_write()
+void http_server::inbound_connection::send_response()
 {
-    response_sent += socket.write_some(response_buffer, response_size - response_sent);
+    // the response doesn't refer to the request
+    if (request)
+        release_request();
 
-    if (response_sent != response_size)
-        socket.set_on_write([this] { try_write(); });
-    else
+    if (socket.flush_output())
+    {
         drop();
+        return;
+    }
+
+    timer.restart(parent->timeouts);
+    socket.set_on_output_drained([this] { drop(); });
 }
 
 void http_server::inbound_connection::send_header(http_status_code status_code, std::string const& message)
@@ -176,30 +234,70 @@ void http_server::inbound_connection::send_header(http_status_code status_code,
 
     std::stringstream ss;
     ss << response;
-    std::string const& str = ss.str();
-    memcpy(response_buffer, str.data(), str.size());
-    response_size = str.size();
-    try_write();
+    socket.queue_output(ss.str());
+    send_response();
 }
 
-http_server::http_server(sysapi::epoll &ep)
-    : ep(ep)
-    , ss{ep, std::bind(&http_server::on_new_connection, this)}
+void http_server::inbound_connection::release_request()
+{
+    parent->buffers.release(request);
+    request = nullptr;
+}
+
+http_server::http_server(epoll& ep)
+    : http_server(ep, ipv4_endpoint(0, ipv4_address::any()))
+{}
+
+http_server::http_server(epoll& ep, socket_address const& local_endpoint)
+    : http_server(ep, local_endpoint, socket_options{})
 {}
 
-http_server::http_server(sysapi::epoll &ep, const ipv4_endpoint &local_endpoint)
+http_server::http_server(epoll& ep, socket_address const& local_endpoint, bool reuse_port)
+    : http_server(ep, server_socket::listen(local_endpoint, reuse_port))
+{}
+
+http_server::http_server(epoll& ep, socket_address const& local_endpoint, socket_options const& options)
+    : http_server(ep, server_socket::listen(local_endpoint, options))
+{}
+
+http_server::http_server(epoll& ep, http_server const& listener)
+    : http_server(ep, listener.ss.duplicate())
+{}
+
+http_server::http_server(epoll& ep, file_descriptor listener)
     : ep(ep)
-    , ss{ep, local_endpoint, std::bind(&http_server::on_new_connection, this)}
+    , ss{ep, std::move(listener), [this] { on_new_connection(); }}
+    , timeouts(ep.get_timer(), timeout)
+    , connection_allocator(ep.get_slab_allocator(sizeof(inbound_connection)))
+    , buffers(ep.get_buffer_pool())
+    , dns(ep)
+    , resolver(nullptr)
 {}
 
-ipv4_endpoint http_server::local_endpoint() const
+http_server::~http_server()
+{
+    while (!connections.empty())
+        destroy(&connections.front());
+}
+
+socket_address http_server::local_endpoint() const
 {
     return ss.local_endpoint();
 }
 
+void http_server::set_resolver(resolver_pool* pool)
+{
+    resolver = pool;
+}
+
 void http_server::on_new_connection()
 {
-    std::unique_ptr<inbound_connection> cc(new inbound_connection(this));
-    inbound_connection* pcc = cc.get();
-    connections.emplace(pcc, std::move(cc));
+    slab_ptr<inbound_connection> cc = make_slab_object<inbound_connection>(connection_allocator, this);
+    connections.push_back(*cc.release());
+}
+
+void http_server::destroy(inbound_connection* c)
+{
+    c->unlink();
+    slab_deleter<inbound_connection>{connection_allocator}(c);
 }
@@ -1,8 +1,10 @@
 #ifndef HTTP_SERVER_H
 #define HTTP_SERVER_H
 
-#include <map>
 #include <memory>
+#include "dns_resolver.h"
+#include "intrusive_list.h"
+#include "resolver_pool.h"
 #include "socket.h"
 #include "http_common.h"
 
@@ -20,43 +22,71 @@ struct http_server
         std::string reason_phrase;
     };
 
-    struct inbound_connection
+    struct inbound_connection : intrusive_list_element<>
     {
         inbound_connection(http_server* parent);
+        ~inbound_connection();
 
         void try_read();
         void drop();
 
     private:
         void new_request(char const* begin, char const* end);
-        void try_write();
+        void on_resolved(std::vector<ip_address> const& addresses, std::string const& error);
+        void send_ok(std::string const& body);
+        void send_response();
         void send_header(http_status_code status_code, std::string const& message);
+        void release_request();
 
     private:
         http_server* parent;
         client_socket socket;
-        timer_element timer;
-        size_t request_received;
-        char request_buffer[4000];
-        size_t response_size;
-        size_t response_sent;
-        char response_buffer[4000];
+        fixed_timeout_element timer;
+        // borrowed from the loop from the first byte of the request until
+        // the response is queued, the received part is start..end
+        io_buffer* request;
+        // while the host is being resolved, reads are paused until the
+        // response is sent, the timeout stays armed
+        dns_resolver::handle lookup;
+        resolver_pool::handle pool_lookup;
 
         std::unique_ptr<client_socket> target;
     };
 
     http_server(epoll& ep);
-    http_server(epoll& ep, ipv4_endpoint const& local_endpoint);
+    http_server(epoll& ep, socket_address const& local_endpoint);
+    http_server(epoll& ep, socket_address const& local_endpoint, bool reuse_port);
+    http_server(epoll& ep, socket_address const& local_endpoint, socket_options const& options);
+    // accepts from the listener of another server, see server_socket
+    http_server(epoll& ep, http_server const& listener);
+    http_server(http_server const&) = delete;
+    http_server& operator=(http_server const&) = delete;
+    ~http_server();
 
-    ipv4_endpoint local_endpoint() const;
+    socket_address local_endpoint() const;
+
+    // host names are resolved with getaddrinfo() by the pool instead of
+    // the DNS resolver of the loop, a request that doesn't fit into its
+    // queue gets 503; the pool must outlive the server
+    void set_resolver(resolver_pool* pool);
 
 private:
+    // all the public constructors end up here
+    http_server(epoll& ep, file_descriptor listener);
+
     void on_new_connection();
+    void destroy(inbound_connection* c);
 
 private:
     epoll& ep;
     server_socket ss;
-    std::map<inbound_connection*, std::unique_ptr<inbound_connection>> connections;
+    fixed_timeout_list timeouts;
+    // connections and their sockets are allocated from slabs of the loop
+    slab_allocator& connection_allocator;
+    buffer_pool& buffers;
+    dns_resolver dns;
+    resolver_pool* resolver;
+    intrusive_list<inbound_connection> connections;
 };
 
 #endif // HTTP_SERVER_H
@@ -0,0 +1,259 @@
+#ifndef INTRUSIVE_LIST_H
+#define INTRUSIVE_LIST_H
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+
+// Doubly linked list whose links are embedded in the elements, so linking
+// and unlinking never allocate and an element can unlink itself in O(1)
+// without knowing the list. T must derive from intrusive_list_element<Tag>;
+// distinct tags allow an object to be in several lists at once.
+template <typename Tag = void>
+struct intrusive_list_element
+{
+    intrusive_list_element() noexcept;
+    intrusive_list_element(intrusive_list_element const&) = delete;
+    intrusive_list_element& operator=(intrusive_list_element const&) = delete;
+    ~intrusive_list_element();
+
+    bool is_linked() const noexcept;
+    void unlink() noexcept;
+
+private:
+    void link_before(intrusive_list_element* pos) noexcept;
+
+    intrusive_list_element* prev;
+    intrusive_list_element* next;
+
+    template <typename T, typename U>
+    friend struct intrusive_list;
+};
+
+template <typename T, typename Tag = void>
+struct intrusive_list
+{
+    typedef intrusive_list_element<Tag> element_t;
+
+    struct iterator : std::iterator<std::bidirectional_iterator_tag, T>
+    {
+        iterator() noexcept;
+        explicit iterator(element_t* e) noexcept;
+
+        T& operator*() const noexcept;
+        T* operator->() const noexcept;
+        iterator& operator++() noexcept;
+        iterator operator++(int) noexcept;
+        iterator& operator--() noexcept;
+        iterator operator--(int) noexcept;
+
+        friend bool operator==(iterator a, iterator b) noexcept
+        {
+            return a.e == b.e;
+        }
+
+        friend bool operator!=(iterator a, iterator b) noexcept
+        {
+            return a.e != b.e;
+        }
+
+    private:
+        element_t* e;
+    };
+
+    intrusive_list() noexcept;
+    intrusive_list(intrusive_list const&) = delete;
+    intrusive_list& operator=(intrusive_list const&) = delete;
+    ~intrusive_list();
+
+    bool empty() const noexcept;
+
+    T& front() noexcept;
+    T& back() noexcept;
+
+    void push_back(T& e) noexcept;
+    void push_front(T& e) noexcept;
+    void pop_front() noexcept;
+
+    iterator begin() noexcept;
+    iterator end() noexcept;
+
+    // unlinks all elements
+    void clear() noexcept;
+
+private:
+    static T& to_value(element_t* e) noexcept;
+
+    element_t head;
+};
+
+template <typename Tag>
+intrusive_list_element<Tag>::intrusive_list_element() noexcept
+    : prev(nullptr)
+    , next(nullptr)
+{}
+
+template <typename Tag>
+intrusive_list_element<Tag>::~intrusive_list_element()
+{
+    assert(!is_linked());
+}
+
+template <typename Tag>
+bool intrusive_list_element<Tag>::is_linked() const noexcept
+{
+    return next != nullptr;
+}
+
+template <typename Tag>
+void intrusive_list_element<Tag>::unlink() noexcept
+{
+    assert(is_linked());
+    prev->next = next;
+    next->prev = prev;
+    prev = nullptr;
+    next = nullptr;
+}
+
+template <typename Tag>
+void intrusive_list_element<Tag>::link_before(intrusive_list_element* pos) noexcept
+{
+    assert(!is_linked());
+    prev = pos->prev;
+    next = pos;
+    prev->next = this;
+    pos->prev = this;
+}
+
+template <typename T, typename Tag>
+intrusive_list<T, Tag>::iterator::iterator() noexcept
+    : e(nullptr)
+{}
+
+template <typename T, typename Tag>
+intrusive_list<T, Tag>::iterator::iterator(element_t* e) noexcept
+    : e(e)
+{}
+
+template <typename T, typename Tag>
+T& intrusive_list<T, Tag>::iterator::operator*() const noexcept
+{
+    return to_value(e);
+}
+
+template <typename T, typename Tag>
+T* intrusive_list<T, Tag>::iterator::operator->() const noexcept
+{
+    return &to_value(e);
+}
+
+template <typename T, typename Tag>
+typename intrusive_list<T, Tag>::iterator& intrusive_list<T, Tag>::iterator::operator++() noexcept
+{
+    e = e->next;
+    return *this;
+}
+
+template <typename T, typename Tag>
+typename intrusive_list<T, Tag>::iterator intrusive_list<T, Tag>::iterator::operator++(int) noexcept
+{
+    iterator old = *this;
+    ++*this;
+    return old;
+}
+
+template <typename T, typename Tag>
+typename intrusive_list<T, Tag>::iterator& intrusive_list<T, Tag>::iterator::operator--() noexcept
+{
+    e = e->prev;
+    return *this;
+}
+
+template <typename T, typename Tag>
+typename intrusive_list<T, Tag>::iterator intrusive_list<T, Tag>::iterator::operator--(int) noexcept
+{
+    iterator old = *this;
+    --*this;
+    return old;
+}
+
+template <typename T, typename Tag>
+intrusive_list<T, Tag>::intrusive_list() noexcept
+{
+    head.prev = &head;
+    head.next = &head;
+}
+
+template <typename T, typename Tag>
+intrusive_list<T, Tag>::~intrusive_list()
+{
+    clear();
+    head.prev = nullptr;
+    head.next = nullptr;
+}
+
+template <typename T, typename Tag>
+bool intrusive_list<T, Tag>::empty() const noexcept
+{
+    return head.next == &head;
+}
+
+template <typename T, typename Tag>
+T& intrusive_list<T, Tag>::front() noexcept
+{
+    assert(!empty());
+    return to_value(head.next);
+}
+
+template <typename T, typename Tag>
+T& intrusive_list<T, Tag>::back() noexcept
+{
+    assert(!empty());
+    return to_value(head.prev);
+}
+
+template <typename T, typename Tag>
+void intrusive_list<T, Tag>::push_back(T& e) noexcept
+{
+    static_cast<element_t&>(e).link_before(&head);
+}
+
+template <typename T, typename Tag>
+void intrusive_list<T, Tag>::push_front(T& e) noexcept
+{
+    static_cast<element_t&>(e).link_before(head.next);
+}
+
+template <typename T, typename Tag>
+void intrusive_list<T, Tag>::pop_front() noexcept
+{
+    assert(!empty());
+    head.next->unlink();
+}
+
+template <typename T, typename Tag>
+typename intrusive_list<T, Tag>::iterator intrusive_list<T, Tag>::begin() noexcept
+{
+    return iterator(head.next);
+}
+
+template <typename T, typename Tag>
+typename intrusive_list<T, Tag>::iterator intrusive_list<T, Tag>::end() noexcept
+{
+    return iterator(&head);
+}
+
+template <typename T, typename Tag>
+void intrusive_list<T, Tag>::clear() noexcept
+{
+    while (!empty())
+        pop_front();
+}
+
+template <typename T, typename Tag>
+T& intrusive_list<T, Tag>::to_value(element_t* e) noexcept
+{
+    return static_cast<T&>(*e);
+}
+
+#endif // INTRUSIVE_LIST_H
@@ -0,0 +1,178 @@
+#include "loop_stats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+    void increment(std::atomic<uint64_t>& counter, uint64_t delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    int highest_bit(uint64_t value)
+    {
+        assert(value != 0);
+        return 63 - __builtin_clzll(value);
+    }
+}
+
+size_t const histogram::sub_bucket_bits;
+size_t const histogram::sub_bucket_count;
+size_t const histogram::bucket_count;
+
+histogram_snapshot::histogram_snapshot()
+    : total()
+    , sum()
+    , max_value()
+{}
+
+uint64_t histogram_snapshot::count() const
+{
+    return total;
+}
+
+uint64_t histogram_snapshot::max() const
+{
+    return max_value;
+}
+
+double histogram_snapshot::mean() const
+{
+    if (total == 0)
+        return 0.;
+
+    return static_cast<double>(sum) / total;
+}
+
+uint64_t histogram_snapshot::value_at_percentile(double percentile) const
+{
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(std::ceil(percentile / 100. * total));
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i != counts.size(); ++i)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return std::min(histogram::bucket_highest_value(i), max_value);
+    }
+
+    return max_value;
+}
+
+histogram::histogram()
+    : total(0)
+    , sum(0)
+    , max_value(0)
+{
+    for (std::atomic<uint64_t>& c : counts)
+        c.store(0, std::memory_order_relaxed);
+}
+
+void histogram::record(uint64_t value)
+{
+    increment(counts[bucket_index(value)], 1);
+    increment(total, 1);
+    increment(sum, value);
+    if (value > max_value.load(std::memory_order_relaxed))
+        max_value.store(value, std::memory_order_relaxed);
+}
+
+histogram_snapshot histogram::snapshot() const
+{
+    histogram_snapshot r;
+    r.counts.resize(bucket_count);
+    for (size_t i = 0; i != bucket_count; ++i)
+        r.counts[i] = counts[i].load(std::memory_order_relaxed);
+    r.total = total.load(std::memory_order_relaxed);
+    r.sum = sum.load(std::memory_order_relaxed);
+    r.max_value = max_value.load(std::memory_order_relaxed);
+    return r;
+}
+
+size_t histogram::bucket_index(uint64_t value)
+{
+    if (value < sub_bucket_count)
+        return static_cast<size_t>(value);
+
+    size_t exponent = static_cast<size_t>(highest_bit(value));
+    size_t shift = exponent - sub_bucket_bits;
+    size_t sub_bucket = static_cast<size_t>(value >> shift) & (sub_bucket_count - 1);
+    return ((shift + 1) << sub_bucket_bits) + sub_bucket;
+}
+
+uint64_t histogram::bucket_lowest_value(size_t index)
+{
+    assert(index < bucket_count);
+
+    if (index < sub_bucket_count)
+        return index;
+
+    size_t shift = (index >> sub_bucket_bits) - 1;
+    uint64_t sub_bucket = index & (sub_bucket_count - 1);
+    return (sub_bucket_count + sub_bucket) << shift;
+}
+
+uint64_t histogram::bucket_highest_value(size_t index)
+{
+    if (index + 1 == bucket_count)
+        return UINT64_MAX;
+
+    return bucket_lowest_value(index + 1) - 1;
+}
+
+loop_stats::loop_stats()
+    : slowest_callback_time(0)
+    , slowest_callback_fd(-1)
+{}
+
+void loop_stats::record_callback(uint64_t time, int fd)
+{
+    callback_time.record(time);
+    if (time > slowest_callback_time.load(std::memory_order_relaxed))
+    {
+        slowest_callback_time.store(time, std::memory_order_relaxed);
+        slowest_callback_fd.store(fd, std::memory_order_relaxed);
+    }
+}
+
+loop_stats_snapshot loop_stats::snapshot() const
+{
+    loop_stats_snapshot r;
+    r.iteration_time = iteration_time.snapshot();
+    r.wait_time = wait_time.snapshot();
+    r.callback_time = callback_time.snapshot();
+    r.events_per_wakeup = events_per_wakeup.snapshot();
+    r.timer_lateness = timer_lateness.snapshot();
+    r.slowest_callback_time = slowest_callback_time.load(std::memory_order_relaxed);
+    r.slowest_callback_fd = slowest_callback_fd.load(std::memory_order_relaxed);
+    return r;
+}
+
+std::ostream& operator<<(std::ostream& os, histogram_snapshot const& h)
+{
+    os << "count: " << h.count()
+       << ", mean: " << static_cast<uint64_t>(h.mean())
+       << ", p50: " << h.value_at_percentile(50)
+       << ", p99: " << h.value_at_percentile(99)
+       << ", p99.9: " << h.value_at_percentile(99.9)
+       << ", max: " << h.max();
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, loop_stats_snapshot const& stats)
+{
+    os << "iteration time (ns)    " << stats.iteration_time << '\n'
+       << "wait time (ns)         " << stats.wait_time << '\n'
+       << "callback time (ns)     " << stats.callback_time << '\n'
+       << "events per wakeup      " << stats.events_per_wakeup << '\n'
+       << "timer lateness (ns)    " << stats.timer_lateness << '\n'
+       << "slowest callback (ns)  " << stats.slowest_callback_time << ", fd: " << stats.slowest_callback_fd << '\n';
+    return os;
+}
@@ -0,0 +1,99 @@
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+struct histogram_snapshot
+{
+    histogram_snapshot();
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+    // highest value equivalent to the bucket where the percentile falls
+    uint64_t value_at_percentile(double percentile) const;
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max_value;
+};
+
+// Log-linear (HDR style) histogram of unsigned values. Values below
+// sub_bucket_count are counted exactly, above that each power of two is
+// split into sub_bucket_count buckets, so the relative error is below
+// 1/sub_bucket_count.
+//
+// record() must be called from a single thread. Counters are updated
+// with relaxed loads and stores (no read-modify-write), which lets another
+// thread take a snapshot at no cost for the writer.
+struct histogram
+{
+    static size_t const sub_bucket_bits = 4;
+    static size_t const sub_bucket_count = size_t(1) << sub_bucket_bits;
+    static size_t const bucket_count = (65 - sub_bucket_bits) << sub_bucket_bits;
+
+    histogram();
+    histogram(histogram const&) = delete;
+    histogram& operator=(histogram const&) = delete;
+
+    void record(uint64_t value);
+    histogram_snapshot snapshot() const;
+
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_lowest_value(size_t index);
+    static uint64_t bucket_highest_value(size_t index);
+
+private:
+    std::atomic<uint64_t> counts[bucket_count];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max_value;
+};
+
+struct loop_stats_snapshot
+{
+    histogram_snapshot iteration_time;
+    histogram_snapshot wait_time;
+    histogram_snapshot callback_time;
+    histogram_snapshot events_per_wakeup;
+    histogram_snapshot timer_lateness;
+    uint64_t slowest_callback_time;
+    int slowest_callback_fd;
+};
+
+// Statistics of one event loop, written by the loop thread only.
+// All times are in nanoseconds.
+struct loop_stats
+{
+    loop_stats();
+
+    // time spent handling one wakeup: events, timers, posted actions
+    histogram iteration_time;
+    // time blocked waiting for events
+    histogram wait_time;
+    // duration of a single callback
+    histogram callback_time;
+    histogram events_per_wakeup;
+    // delay between the deadline of a timer and the call of its callback
+    histogram timer_lateness;
+
+    // the file descriptor whose callback took the longest so far,
+    // -1 for timers and posted actions
+    void record_callback(uint64_t time, int fd);
+
+    loop_stats_snapshot snapshot() const;
+
+private:
+    std::atomic<uint64_t> slowest_callback_time;
+    std::atomic<int> slowest_callback_fd;
+};
+
+std::ostream& operator<<(std::ostream& os, histogram_snapshot const& h);
+std::ostream& operator<<(std::ostream& os, loop_stats_snapshot const& stats);
+
+#endif // LOOP_STATS_H
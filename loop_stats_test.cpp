@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include "loop_stats.h"
+
+TEST(histogram_buckets, exact01)
+{
+    for (uint64_t i = 0; i != histogram::sub_bucket_count; ++i)
+    {
+        EXPECT_EQ(histogram::bucket_index(i), i);
+        EXPECT_EQ(histogram::bucket_lowest_value(i), i);
+        EXPECT_EQ(histogram::bucket_highest_value(i), i);
+    }
+}
+
+TEST(histogram_buckets, bounds01)
+{
+    uint64_t values[] = {16, 17, 31, 32, 33, 1000, 1023, 1024, 123456789, UINT64_MAX / 3, UINT64_MAX};
+    for (uint64_t v : values)
+    {
+        size_t i = histogram::bucket_index(v);
+        ASSERT_LT(i, histogram::bucket_count);
+        EXPECT_LE(histogram::bucket_lowest_value(i), v);
+        EXPECT_GE(histogram::bucket_highest_value(i), v);
+    }
+}
+
+TEST(histogram_buckets, contiguous01)
+{
+    for (size_t i = 0; i + 1 != histogram::bucket_count; ++i)
+    {
+        EXPECT_EQ(histogram::bucket_highest_value(i) + 1, histogram::bucket_lowest_value(i + 1));
+        EXPECT_EQ(histogram::bucket_index(histogram::bucket_lowest_value(i)), i);
+    }
+    EXPECT_EQ(histogram::bucket_index(UINT64_MAX), histogram::bucket_count - 1);
+}
+
+TEST(histogram_buckets, relative_error01)
+{
+    for (size_t i = histogram::sub_bucket_count; i != histogram::bucket_count; ++i)
+    {
+        uint64_t lo = histogram::bucket_lowest_value(i);
+        uint64_t width = histogram::bucket_highest_value(i) - lo;
+        EXPECT_LE(width, lo / histogram::sub_bucket_count);
+    }
+}
+
+TEST(histogram, percentiles01)
+{
+    histogram h;
+    for (uint64_t i = 1; i <= 1000; ++i)
+        h.record(i);
+
+    histogram_snapshot s = h.snapshot();
+    EXPECT_EQ(s.count(), 1000u);
+    EXPECT_EQ(s.max(), 1000u);
+    EXPECT_DOUBLE_EQ(s.mean(), 500.5);
+
+    uint64_t p50 = s.value_at_percentile(50);
+    EXPECT_GE(p50, 500u);
+    EXPECT_LE(p50, 500u + 500u / histogram::sub_bucket_count);
+    EXPECT_EQ(s.value_at_percentile(100), 1000u);
+}
+
+TEST(histogram, empty01)
+{
+    histogram h;
+    histogram_snapshot s = h.snapshot();
+    EXPECT_EQ(s.count(), 0u);
+    EXPECT_EQ(s.value_at_percentile(99), 0u);
+}
+
+TEST(loop_stats, slowest_callback01)
+{
+    loop_stats stats;
+    stats.record_callback(10, 5);
+    stats.record_callback(30, 7);
+    stats.record_callback(20, 9);
+
+    loop_stats_snapshot s = stats.snapshot();
+    EXPECT_EQ(s.slowest_callback_time, 30u);
+    EXPECT_EQ(s.slowest_callback_fd, 7);
+    EXPECT_EQ(s.callback_time.count(), 3u);
+}
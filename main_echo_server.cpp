@@ -1,19 +1,117 @@
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
-#include "epoll.h"
+#include <unistd.h>
+
+#include "epoll_group.h"
 #include "echo_server.h"
 
-int main()
+namespace
+{
+    constexpr const timer::clock_t::duration stats_interval = std::chrono::seconds(10);
+}
+
+int main(int argc, char* argv[])
 {
     try
     {
-        sysapi::epoll ep;
-        echo_server echo_server(ep, ipv4_endpoint(0, ipv4_address::any()));
+        size_t number_of_threads = epoll_group::default_number_of_loops();
+        epoll_backend backend = epoll_backend::epoll;
+        bool print_stats = false;
+        socket_options options;
+        std::string unix_path;
+        bool ipv6 = false;
+        bool splice_mode = false;
+        bool hugepages = false;
+        bool udp = false;
+        size_t zerocopy_min_size = 0;
+
+        for (int i = 1; i != argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--io-uring")
+                backend = epoll_backend::io_uring;
+            else if (arg == "--stats")
+                print_stats = true;
+            else if (arg == "--sockopt" && i + 1 != argc)
+                options = socket_options::parse(argv[++i]);
+            else if (arg == "--unix" && i + 1 != argc)
+                unix_path = argv[++i];
+            else if (arg == "--ipv6")
+                ipv6 = true;
+            else if (arg == "--splice")
+                splice_mode = true;
+            else if (arg == "--hugepages")
+                hugepages = true;
+            else if (arg == "--udp")
+                udp = true;
+            else if (arg == "--zerocopy" && i + 1 != argc)
+                zerocopy_min_size = std::stoul(argv[++i]);
+            else if (!arg.empty() && arg[0] != '-')
+                number_of_threads = std::stoul(arg);
+            else
+            {
+                std::cerr << "usage: " << argv[0] << " [--io-uring] [--stats] [--splice] [--hugepages] [--udp] [--zerocopy min_size] [--sockopt option[=value],...] [--unix path|@name] [--ipv6] [number_of_threads]\n";
+                return EXIT_SUCCESS;
+            }
+        }
+
+        if (number_of_threads == 0)
+            number_of_threads = 1;
+
+        epoll_group group(number_of_threads, backend);
+        std::vector<std::unique_ptr<echo_server>> servers;
+
+        // every loop gets its own listener on the same port, the kernel
+        // distributes incoming connections between them. A Unix socket
+        // can't be bound more than once, its listener is shared instead
+        options.reuse_port = true;
+        socket_address endpoint = ipv4_endpoint(0, ipv4_address::any());
+        // [::] without v6only takes IPv4 connections as well
+        if (ipv6)
+            endpoint = ipv6_endpoint(0, ipv6_address::any());
+        if (!unix_path.empty())
+        {
+            unix_endpoint path(unix_path);
+            // a socket file left by a previous run would fail bind()
+            if (!path.is_abstract())
+                ::unlink(unix_path.c_str());
+            endpoint = path;
+        }
+
+        for (size_t i = 0; i != group.size(); ++i)
+        {
+            group.get_epoll(i).get_buffer_pool().set_hugepages(hugepages);
+            if (i == 0 || unix_path.empty())
+                servers.emplace_back(new echo_server(group.get_epoll(i), endpoint, options));
+            else
+                servers.emplace_back(new echo_server(group.get_epoll(i), *servers[0]));
+            servers.back()->set_splice_mode(splice_mode);
+            servers.back()->set_zerocopy(zerocopy_min_size);
+            if (udp)
+                servers.back()->enable_udp(options);
+            if (i == 0)
+                endpoint = servers[0]->local_endpoint();
+        }
+
+        std::cout << "bound to " << endpoint << ", " << group.size() << " thread(s)" << std::endl;
+
+        timer_element stats_reporter;
+        if (print_stats)
+        {
+            group.set_stats_enabled(true);
 
-        ipv4_endpoint echo_server_endpoint = echo_server.local_endpoint();
-        std::cout << "bound to " << echo_server_endpoint << std::endl;
+            timer& t = group.get_epoll(0).get_timer();
+            stats_reporter.set_callback([&] {
+                group.print_stats(std::cerr);
+                stats_reporter.restart(t, stats_interval);
+            });
+            stats_reporter.restart(t, stats_interval);
+        }
 
-        ep.run();
+        group.run();
     }
     catch (std::exception const& e)
     {
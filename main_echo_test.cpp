@@ -1,4 +1,6 @@
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #include "epoll.h"
 #include "echo_tester.h"
@@ -7,16 +9,52 @@ int main(int argc, char* argv[])
 {
     try
     {
-        if (argc != 3)
+        socket_options options;
+        bool udp = false;
+        bool gso = false;
+        size_t datagram_size = 64;
+        // "--unix path" takes the place of "hostname port"
+        bool unix_socket = argc >= 3 && std::string(argv[1]) == "--unix";
+        bool valid = argc >= 3;
+        for (int i = 3; valid && i != argc; ++i)
         {
-            std::cerr << "usage: " << argv[0] << " hostname port\n";
+            std::string arg = argv[i];
+            if (arg == "--sockopt" && i + 1 != argc)
+                options = socket_options::parse(argv[++i]);
+            else if (arg == "--udp")
+                udp = true;
+            else if (arg == "--gso")
+                gso = true;
+            else if (arg == "--size" && i + 1 != argc)
+                datagram_size = std::stoul(argv[++i]);
+            else
+                valid = false;
+        }
+
+        if (!valid)
+        {
+            std::cerr << "usage: " << argv[0] << " (hostname port | --unix path|@name) [--sockopt option[=value],...]"
+                      << " [--udp [--gso] [--size datagram_size]]\n";
             return 0;
         }
 
-        ipv4_endpoint endpoint(std::stod(argv[2]), ipv4_address(argv[1]));
+        socket_address endpoint;
+        if (unix_socket)
+            endpoint = unix_endpoint(argv[2]);
+        else
+            endpoint = socket_address(ip_address(argv[1]), std::stod(argv[2]));
         std::cout << endpoint << std::endl;
         sysapi::epoll tep;
-        echo_tester tester{tep, endpoint};
+        tep.set_high_resolution_timers(true);
+        if (udp)
+        {
+            if (endpoint.family() == AF_UNIX)
+                throw std::invalid_argument("UDP mode needs an IP address");
+            udp_echo_tester tester{tep, endpoint, options, datagram_size, gso};
+            tep.run();
+            return EXIT_SUCCESS;
+        }
+        echo_tester tester{tep, endpoint, options};
         tep.run();
     }
     catch (std::exception const& e)
@@ -1,19 +1,119 @@
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
-#include "epoll.h"
+#include <unistd.h>
+
+#include "epoll_group.h"
 #include "http_server.h"
 
-int main()
+namespace
+{
+    constexpr const timer::clock_t::duration stats_interval = std::chrono::seconds(10);
+    constexpr const size_t default_resolver_threads = 8;
+    // lookups waiting for a resolver thread, per thread
+    constexpr const size_t resolver_queue_per_thread = 128;
+}
+
+int main(int argc, char* argv[])
 {
     try
     {
-        sysapi::epoll ep;
-        http_server http_server(ep, ipv4_endpoint(0, ipv4_address::any()));
+        size_t number_of_threads = epoll_group::default_number_of_loops();
+        epoll_backend backend = epoll_backend::epoll;
+        bool print_stats = false;
+        socket_options options;
+        std::string unix_path;
+        bool ipv6 = false;
+        bool use_getaddrinfo = false;
+        size_t resolver_threads = default_resolver_threads;
+
+        for (int i = 1; i != argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--io-uring")
+                backend = epoll_backend::io_uring;
+            else if (arg == "--stats")
+                print_stats = true;
+            else if (arg == "--sockopt" && i + 1 != argc)
+                options = socket_options::parse(argv[++i]);
+            else if (arg == "--unix" && i + 1 != argc)
+                unix_path = argv[++i];
+            else if (arg == "--ipv6")
+                ipv6 = true;
+            else if (arg == "--getaddrinfo")
+                use_getaddrinfo = true;
+            else if (arg == "--resolver-threads" && i + 1 != argc)
+                resolver_threads = std::stoul(argv[++i]);
+            else if (!arg.empty() && arg[0] != '-')
+                number_of_threads = std::stoul(arg);
+            else
+            {
+                std::cerr << "usage: " << argv[0] << " [--io-uring] [--stats] [--sockopt option[=value],...] [--unix path|@name] [--ipv6] [--getaddrinfo [--resolver-threads n]] [number_of_threads]\n";
+                return EXIT_SUCCESS;
+            }
+        }
+
+        if (number_of_threads == 0)
+            number_of_threads = 1;
+
+        if (resolver_threads == 0)
+            resolver_threads = 1;
 
-        ipv4_endpoint server_endpoint = http_server.local_endpoint();
-        std::cout << "bound to " << server_endpoint << std::endl;
+        epoll_group group(number_of_threads, backend);
+        // host names are resolved by the DNS resolver of every loop, with
+        // --getaddrinfo by a pool shared by all loops, destroyed before them
+        std::unique_ptr<resolver_pool> resolver;
+        if (use_getaddrinfo)
+            resolver.reset(new resolver_pool(resolver_threads, resolver_threads * resolver_queue_per_thread));
+        std::vector<std::unique_ptr<http_server>> servers;
 
-        ep.run();
+        // every loop gets its own listener on the same port, the kernel
+        // distributes incoming connections between them. A Unix socket
+        // can't be bound more than once, its listener is shared instead
+        options.reuse_port = true;
+        socket_address endpoint = ipv4_endpoint(0, ipv4_address::any());
+        // [::] without v6only takes IPv4 connections as well
+        if (ipv6)
+            endpoint = ipv6_endpoint(0, ipv6_address::any());
+        if (!unix_path.empty())
+        {
+            unix_endpoint path(unix_path);
+            // a socket file left by a previous run would fail bind()
+            if (!path.is_abstract())
+                ::unlink(unix_path.c_str());
+            endpoint = path;
+        }
+
+        for (size_t i = 0; i != group.size(); ++i)
+        {
+            if (i == 0 || unix_path.empty())
+                servers.emplace_back(new http_server(group.get_epoll(i), endpoint, options));
+            else
+                servers.emplace_back(new http_server(group.get_epoll(i), *servers[0]));
+            if (resolver)
+                servers.back()->set_resolver(resolver.get());
+            if (i == 0)
+                endpoint = servers[0]->local_endpoint();
+        }
+
+        std::cout << "bound to " << endpoint << ", " << group.size() << " thread(s)" << std::endl;
+
+        timer_element stats_reporter;
+        if (print_stats)
+        {
+            group.set_stats_enabled(true);
+
+            timer& t = group.get_epoll(0).get_timer();
+            stats_reporter.set_callback([&] {
+                group.print_stats(std::cerr);
+                stats_reporter.restart(t, stats_interval);
+            });
+            stats_reporter.restart(t, stats_interval);
+        }
+
+        group.run();
     }
     catch (std::exception const& e)
     {
@@ -28,4 +128,3 @@ int main()
 
     return EXIT_SUCCESS;
 }
-
@@ -0,0 +1,96 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <utility>
+
+// Multiple producer single consumer queue (Dmitry Vyukov's algorithm).
+// push is wait-free and may be called from any thread, pop and
+// empty only from the consumer thread.
+template <typename T>
+struct mpsc_queue
+{
+    mpsc_queue();
+    mpsc_queue(mpsc_queue const&) = delete;
+    mpsc_queue& operator=(mpsc_queue const&) = delete;
+    ~mpsc_queue();
+
+    void push(T value);
+
+    // returns false when the queue is empty or when the only element is
+    // being pushed right now, in the latter case empty() is already false
+    bool pop(T& value);
+    bool empty() const;
+
+private:
+    struct node
+    {
+        node();
+        explicit node(T value);
+
+        std::atomic<node*> next;
+        T value;
+    };
+
+    std::atomic<node*> head_;
+    // the consumed node, its value was already moved out
+    node* tail_;
+};
+
+template <typename T>
+mpsc_queue<T>::node::node()
+    : next(nullptr)
+{}
+
+template <typename T>
+mpsc_queue<T>::node::node(T value)
+    : next(nullptr)
+    , value(std::move(value))
+{}
+
+template <typename T>
+mpsc_queue<T>::mpsc_queue()
+    : head_(new node())
+    , tail_(head_.load(std::memory_order_relaxed))
+{}
+
+template <typename T>
+mpsc_queue<T>::~mpsc_queue()
+{
+    while (tail_)
+    {
+        node* next = tail_->next.load(std::memory_order_relaxed);
+        delete tail_;
+        tail_ = next;
+    }
+}
+
+template <typename T>
+void mpsc_queue<T>::push(T value)
+{
+    node* n = new node(std::move(value));
+    node* prev = head_.exchange(n, std::memory_order_seq_cst);
+    prev->next.store(n, std::memory_order_release);
+}
+
+template <typename T>
+bool mpsc_queue<T>::pop(T& value)
+{
+    node* next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+        return false;
+
+    value = std::move(next->value);
+    delete tail_;
+    tail_ = next;
+    return true;
+}
+
+template <typename T>
+bool mpsc_queue<T>::empty() const
+{
+    return head_.load(std::memory_order_seq_cst) == tail_;
+}
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,223 @@
+#include "output_queue.h"
+
+#include <cassert>
+
+namespace
+{
+    // sequence numbers of zerocopy sends wrap around
+    bool seq_before(uint32_t a, uint32_t b)
+    {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+}
+
+output_queue::output_queue()
+    : head(0)
+    , total(0)
+    , retired_head(0)
+    , completion_seq(0)
+{}
+
+bool output_queue::empty() const
+{
+    return total == 0;
+}
+
+size_t output_queue::size() const
+{
+    return total;
+}
+
+void output_queue::push(std::string data)
+{
+    if (data.empty())
+        return;
+
+    size_t size = data.size();
+    segments.push_back(segment{std::move(data), nullptr, nullptr, size, 0, false, 0});
+    total += size;
+}
+
+void output_queue::push_borrowed(void const* data, size_t size)
+{
+    if (size == 0)
+        return;
+
+    segments.push_back(segment{std::string(), nullptr, static_cast<char const*>(data), size, 0, false, 0});
+    total += size;
+}
+
+void output_queue::push_shared(std::shared_ptr<void const> owner, void const* data, size_t size)
+{
+    if (size == 0)
+        return;
+
+    segments.push_back(segment{std::string(), std::move(owner), static_cast<char const*>(data), size, 0, false, 0});
+    total += size;
+}
+
+size_t output_queue::fill_iovec(iovec* iov, size_t max_iov) const
+{
+    bool zerocopy;
+    return fill_iovec(iov, max_iov, 0, zerocopy);
+}
+
+size_t output_queue::fill_iovec(iovec* iov, size_t max_iov, size_t zerocopy_min_size, bool& zerocopy) const
+{
+    zerocopy = zerocopy_min_size != 0
+            && head != segments.size()
+            && segments[head].zerocopy_eligible(zerocopy_min_size);
+
+    size_t n = 0;
+    for (size_t i = head; i != segments.size() && n != max_iov; ++i, ++n)
+    {
+        segment const& s = segments[i];
+        if (zerocopy_min_size != 0 && s.zerocopy_eligible(zerocopy_min_size) != zerocopy)
+            break;
+
+        iov[n].iov_base = const_cast<char*>(s.begin() + s.offset);
+        iov[n].iov_len = s.size - s.offset;
+    }
+    return n;
+}
+
+void output_queue::consume(size_t n)
+{
+    consume(n, false, 0);
+}
+
+void output_queue::consume_zerocopy(size_t n, uint32_t seq)
+{
+    consume(n, true, seq);
+}
+
+void output_queue::complete_zerocopy(uint32_t lo, uint32_t hi)
+{
+    if (seq_before(completion_seq, lo))
+    {
+        early_completions.push_back(std::make_pair(lo, hi));
+        return;
+    }
+
+    if (!seq_before(hi, completion_seq))
+        completion_seq = hi + 1;
+
+    for (bool merged = true; merged;)
+    {
+        merged = false;
+        for (size_t i = 0; i != early_completions.size(); ++i)
+        {
+            std::pair<uint32_t, uint32_t> range = early_completions[i];
+            if (seq_before(completion_seq, range.first))
+                continue;
+
+            if (!seq_before(range.second, completion_seq))
+                completion_seq = range.second + 1;
+            early_completions.erase(early_completions.begin() + i);
+            merged = true;
+            break;
+        }
+    }
+
+    release_completed();
+}
+
+size_t output_queue::zerocopy_pending() const
+{
+    return retired.size() - retired_head;
+}
+
+void output_queue::clear()
+{
+    // data the kernel may still reference has to wait for the completion
+    for (size_t i = head; i != segments.size(); ++i)
+    {
+        segment& s = segments[i];
+        if (s.zerocopy)
+            retired.push_back(retired_segment{s.zerocopy_seq, std::move(s.owned), std::move(s.shared)});
+    }
+
+    segments.clear();
+    head = 0;
+    total = 0;
+
+    if (retired_head != retired.size())
+        release_completed();
+}
+
+void output_queue::consume(size_t n, bool zerocopy, uint32_t seq)
+{
+    assert(n <= total);
+    total -= n;
+
+    while (n != 0)
+    {
+        segment& s = segments[head];
+        if (zerocopy)
+        {
+            s.zerocopy = true;
+            s.zerocopy_seq = seq;
+        }
+
+        size_t left = s.size - s.offset;
+        if (n < left)
+        {
+            s.offset += n;
+            break;
+        }
+
+        n -= left;
+        if (s.zerocopy)
+            retired.push_back(retired_segment{s.zerocopy_seq, std::move(s.owned), std::move(s.shared)});
+        // release the memory as soon as it is written
+        s = segment{std::string(), nullptr, nullptr, 0, 0, false, 0};
+        ++head;
+    }
+
+    if (head == segments.size())
+    {
+        segments.clear();
+        head = 0;
+    }
+    else if (head >= 64 && head * 2 >= segments.size())
+    {
+        segments.erase(segments.begin(), segments.begin() + head);
+        head = 0;
+    }
+
+    // the completion may have been reported before the rest of the
+    // segment was written
+    if (retired_head != retired.size())
+        release_completed();
+}
+
+void output_queue::release_completed()
+{
+    while (retired_head != retired.size() && seq_before(retired[retired_head].seq, completion_seq))
+    {
+        retired[retired_head] = retired_segment{0, std::string(), nullptr};
+        ++retired_head;
+    }
+
+    if (retired_head == retired.size())
+    {
+        retired.clear();
+        retired_head = 0;
+    }
+    else if (retired_head >= 64 && retired_head * 2 >= retired.size())
+    {
+        retired.erase(retired.begin(), retired.begin() + retired_head);
+        retired_head = 0;
+    }
+}
+
+char const* output_queue::segment::begin() const
+{
+    return data ? data : owned.data();
+}
+
+bool output_queue::segment::zerocopy_eligible(size_t min_size) const
+{
+    bool borrowed = data != nullptr && !shared;
+    return !borrowed && size - offset >= min_size;
+}
@@ -0,0 +1,89 @@
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Queue of buffer segments waiting to be written to a socket. Segments are
+// either owned by the queue, borrowed (the caller keeps the memory valid
+// until it is written) or shared (the queue holds a reference). Storage is
+// a vector with a head index, so steady state queuing does not allocate.
+//
+// Owned and shared segments can be sent with MSG_ZEROCOPY, such segments
+// are kept alive after they are written until the kernel reports the
+// completion of the send.
+struct output_queue
+{
+    output_queue();
+
+    bool empty() const;
+    // number of bytes not yet written
+    size_t size() const;
+
+    void push(std::string data);
+    void push_borrowed(void const* data, size_t size);
+    void push_shared(std::shared_ptr<void const> owner, void const* data, size_t size);
+
+    // fills at most max_iov entries describing the head of the queue,
+    // returns the number of entries filled. With a non-zero
+    // zerocopy_min_size the entries are either a run of segments that can
+    // be sent with MSG_ZEROCOPY (zerocopy is set) or a run of ones that
+    // can't.
+    size_t fill_iovec(iovec* iov, size_t max_iov) const;
+    size_t fill_iovec(iovec* iov, size_t max_iov, size_t zerocopy_min_size, bool& zerocopy) const;
+    // drops the first n bytes, that were written
+    void consume(size_t n);
+    // the first n bytes were written by the zerocopy send number seq
+    void consume_zerocopy(size_t n, uint32_t seq);
+    // the kernel no longer references the data of sends lo..hi
+    void complete_zerocopy(uint32_t lo, uint32_t hi);
+    // number of written segments waiting for a completion
+    size_t zerocopy_pending() const;
+
+    void clear();
+
+private:
+    struct segment
+    {
+        std::string owned;
+        std::shared_ptr<void const> shared;
+        // nullptr for owned segments, their data can move with the string
+        char const* data;
+        size_t size;
+        size_t offset;
+        // a part of the segment was sent with MSG_ZEROCOPY
+        bool zerocopy;
+        // the last zerocopy send that referenced the segment
+        uint32_t zerocopy_seq;
+
+        char const* begin() const;
+        bool zerocopy_eligible(size_t min_size) const;
+    };
+
+    struct retired_segment
+    {
+        uint32_t seq;
+        std::string owned;
+        std::shared_ptr<void const> shared;
+    };
+
+    void consume(size_t n, bool zerocopy, uint32_t seq);
+    void release_completed();
+
+    std::vector<segment> segments;
+    size_t head;
+    size_t total;
+
+    std::vector<retired_segment> retired;
+    size_t retired_head;
+    // completions are normally reported in order, the ones that arrive
+    // ahead of completion_seq are kept until the gap is filled
+    uint32_t completion_seq;
+    std::vector<std::pair<uint32_t, uint32_t>> early_completions;
+};
+
+#endif // OUTPUT_QUEUE_H
@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include "output_queue.h"
+
+namespace
+{
+    std::string gather(output_queue const& q)
+    {
+        iovec iov[16];
+        size_t n = q.fill_iovec(iov, 16);
+        std::string result;
+        for (size_t i = 0; i != n; ++i)
+            result.append(static_cast<char const*>(iov[i].iov_base), iov[i].iov_len);
+        return result;
+    }
+}
+
+TEST(output_queue, empty01)
+{
+    output_queue q;
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(q.size(), 0u);
+    q.push(std::string());
+    q.push_borrowed("abc", 0);
+    EXPECT_TRUE(q.empty());
+    iovec iov[4];
+    EXPECT_EQ(q.fill_iovec(iov, 4), 0u);
+}
+
+TEST(output_queue, segments01)
+{
+    static char const borrowed[] = "borrowed|";
+    std::shared_ptr<std::string> shared = std::make_shared<std::string>("shared");
+
+    output_queue q;
+    q.push("owned|");
+    q.push_borrowed(borrowed, strlen(borrowed));
+    q.push_shared(shared, shared->data(), shared->size());
+    EXPECT_EQ(q.size(), 21u);
+    EXPECT_EQ(gather(q), "owned|borrowed|shared");
+    EXPECT_EQ(shared.use_count(), 2);
+
+    q.consume(3);
+    EXPECT_EQ(gather(q), "ed|borrowed|shared");
+    q.consume(12);
+    EXPECT_EQ(gather(q), "shared");
+    EXPECT_EQ(shared.use_count(), 2);
+    q.consume(6);
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(shared.use_count(), 1);
+}
+
+TEST(output_queue, max_iov01)
+{
+    output_queue q;
+    for (size_t i = 0; i != 10; ++i)
+        q.push(std::string(1, char('0' + i)));
+
+    iovec iov[4];
+    EXPECT_EQ(q.fill_iovec(iov, 4), 4u);
+    q.consume(4);
+    EXPECT_EQ(gather(q), "456789");
+}
+
+TEST(output_queue, long_running01)
+{
+    // the consumed prefix of the storage is reclaimed
+    output_queue q;
+    std::string expected;
+    for (size_t i = 0; i != 1000; ++i)
+    {
+        q.push(std::string(3, char('a' + i % 26)));
+        q.push(std::string(2, char('A' + i % 26)));
+        q.consume(4);
+        expected += std::string(3, char('a' + i % 26));
+        expected += std::string(2, char('A' + i % 26));
+        expected.erase(0, 4);
+    }
+    EXPECT_EQ(q.size(), expected.size());
+    EXPECT_EQ(q.size(), 1000u);
+}
+
+TEST(output_queue, zerocopy_runs01)
+{
+    static char const borrowed[] = "borrowed";
+    output_queue q;
+    q.push(std::string(100, 'a'));
+    q.push(std::string(10, 'b'));
+    q.push_borrowed(borrowed, 8);
+    q.push(std::string(100, 'c'));
+
+    iovec iov[8];
+    bool zerocopy = false;
+    EXPECT_EQ(q.fill_iovec(iov, 8, 50, zerocopy), 1u);
+    EXPECT_TRUE(zerocopy);
+    q.consume_zerocopy(100, 0);
+
+    EXPECT_EQ(q.fill_iovec(iov, 8, 50, zerocopy), 2u);
+    EXPECT_FALSE(zerocopy);
+    q.consume(18);
+
+    EXPECT_EQ(q.fill_iovec(iov, 8, 50, zerocopy), 1u);
+    EXPECT_TRUE(zerocopy);
+}
+
+TEST(output_queue, zerocopy_completion01)
+{
+    std::shared_ptr<std::string> a = std::make_shared<std::string>(100, 'a');
+    std::shared_ptr<std::string> b = std::make_shared<std::string>(100, 'b');
+    std::shared_ptr<std::string> c = std::make_shared<std::string>(100, 'c');
+
+    output_queue q;
+    q.push_shared(a, a->data(), a->size());
+    q.push_shared(b, b->data(), b->size());
+    q.push_shared(c, c->data(), c->size());
+
+    q.consume_zerocopy(150, 0);
+    q.consume_zerocopy(100, 1);
+    q.consume_zerocopy(50, 2);
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(q.zerocopy_pending(), 3u);
+    EXPECT_EQ(a.use_count(), 2);
+
+    // b was last referenced by send 1, c by send 2
+    q.complete_zerocopy(2, 2);
+    EXPECT_EQ(q.zerocopy_pending(), 3u);
+    q.complete_zerocopy(0, 0);
+    EXPECT_EQ(q.zerocopy_pending(), 2u);
+    EXPECT_EQ(a.use_count(), 1);
+    q.complete_zerocopy(1, 1);
+    EXPECT_EQ(q.zerocopy_pending(), 0u);
+    EXPECT_EQ(b.use_count(), 1);
+    EXPECT_EQ(c.use_count(), 1);
+}
+
+TEST(output_queue, zerocopy_completed_early01)
+{
+    std::shared_ptr<std::string> a = std::make_shared<std::string>(100, 'a');
+    output_queue q;
+    q.push_shared(a, a->data(), a->size());
+    q.consume_zerocopy(60, 0);
+    q.complete_zerocopy(0, 0);
+    EXPECT_EQ(a.use_count(), 2);
+    q.consume(40);
+    EXPECT_EQ(q.zerocopy_pending(), 0u);
+    EXPECT_EQ(a.use_count(), 1);
+}
@@ -6,6 +6,24 @@
 
 #include "throw_error.h"
 
+size_t pipe_pair::get_capacity() const
+{
+    int res = ::fcntl(in.getfd(), F_GETPIPE_SZ);
+    if (res == -1)
+        throw_error(errno, "fcntl(F_GETPIPE_SZ)");
+
+    return static_cast<size_t>(res);
+}
+
+size_t pipe_pair::set_capacity(size_t capacity)
+{
+    int res = ::fcntl(in.getfd(), F_SETPIPE_SZ, static_cast<int>(capacity));
+    if (res == -1)
+        throw_error(errno, "fcntl(F_SETPIPE_SZ)");
+
+    return static_cast<size_t>(res);
+}
+
 pipe_pair make_pipe(bool non_block)
 {
     int fds[2];
@@ -17,5 +35,41 @@ pipe_pair make_pipe(bool non_block)
         throw_error(errno, "pipe2()");
     }
 
-    return pipe_pair{weak_file_descriptor{fds[0]}, weak_file_descriptor{fds[1]}};
+    return pipe_pair{file_descriptor{fds[0]}, file_descriptor{fds[1]}};
+}
+
+size_t const pipe_pool::max_idle;
+
+pipe_pool::pipe_pool(size_t capacity)
+    : capacity(capacity)
+{
+    idle.reserve(max_idle);
+}
+
+size_t pipe_pool::get_capacity() const
+{
+    return capacity;
+}
+
+pooled_pipe* pipe_pool::acquire()
+{
+    if (!idle.empty())
+    {
+        pooled_pipe* p = idle.back().release();
+        idle.pop_back();
+        return p;
+    }
+
+    std::unique_ptr<pooled_pipe> p(new pooled_pipe{make_pipe(true), 0});
+    capacity = p->fds.set_capacity(capacity);
+    return p.release();
+}
+
+void pipe_pool::release(pooled_pipe* p) noexcept
+{
+    std::unique_ptr<pooled_pipe> pp(p);
+    if (pp->size != 0 || idle.size() == max_idle)
+        return;
+
+    idle.push_back(std::move(pp));
 }
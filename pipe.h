@@ -1,14 +1,58 @@
 #ifndef PIPE_H
 #define PIPE_H
 
+#include <cstddef>
+#include <memory>
+#include <vector>
+
 #include "file_descriptor.h"
 
 struct pipe_pair
 {
-    weak_file_descriptor out;
-    weak_file_descriptor in;
+    // read end
+    file_descriptor out;
+    // write end
+    file_descriptor in;
+
+    // F_GETPIPE_SZ/F_SETPIPE_SZ; the kernel rounds the capacity up to a
+    // power of two pages, the actual capacity is returned
+    size_t get_capacity() const;
+    size_t set_capacity(size_t capacity);
 };
 
 pipe_pair make_pipe(bool non_block);
 
+// Pipe borrowed from a pipe_pool
+struct pooled_pipe
+{
+    pipe_pair fds;
+    // number of bytes in the pipe
+    size_t size;
+};
+
+// Non-blocking pipes of one capacity kept for reuse, so a connection that
+// splices through a pipe holds one (and its two descriptors) only while
+// data is in flight.
+// Not thread safe: an instance belongs to one loop.
+struct pipe_pool
+{
+    explicit pipe_pool(size_t capacity);
+    pipe_pool(pipe_pool const&) = delete;
+    pipe_pool& operator=(pipe_pool const&) = delete;
+
+    // the capacity actually set on the pipes
+    size_t get_capacity() const;
+
+    // returns an empty pipe
+    pooled_pipe* acquire();
+    // pipes that still hold data and the ones over max_idle are closed
+    void release(pooled_pipe* p) noexcept;
+
+    static size_t const max_idle = 64;
+
+private:
+    size_t capacity;
+    std::vector<std::unique_ptr<pooled_pipe>> idle;
+};
+
 #endif // PIPE_H
@@ -1,19 +1,43 @@
 #include "address.h"
+#include "dns_resolver.h"
 
 #include <iostream>
 #include <stdexcept>
+#include <string>
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    bool use_getaddrinfo = argc == 3 && std::string(argv[1]) == "--getaddrinfo";
+    if (argc != 2 && !use_getaddrinfo)
     {
-        std::cerr << "usage: " << argv[0] << " <hostname>" << std::endl;
+        std::cerr << "usage: " << argv[0] << " [--getaddrinfo] <hostname>" << std::endl;
         return EXIT_SUCCESS;
     }
 
     try
     {
-        for (ipv4_address const& addr : ipv4_address::resolve(argv[1]))
+        std::vector<ip_address> addresses;
+        if (use_getaddrinfo)
+        {
+            addresses = ip_address::resolve(argv[2]);
+        }
+        else
+        {
+            epoll ep;
+            dns_resolver resolver(ep);
+            std::string error;
+            dns_resolver::handle h = resolver.resolve(argv[1], [&](std::vector<ip_address> const& result, std::string const& message) {
+                addresses = result;
+                error = message;
+                ep.stop();
+            });
+            ep.run();
+
+            if (!error.empty())
+                throw std::runtime_error(error);
+        }
+
+        for (ip_address const& addr : addresses)
         {
             std::cout << addr << std::endl;
         }
@@ -0,0 +1,160 @@
+#include "resolver_pool.h"
+
+#include <cassert>
+#include <exception>
+
+resolver_pool::query::query(epoll& ep, std::string hostname, on_resolved_t on_resolved)
+    : ep(ep)
+    , hostname(std::move(hostname))
+    , on_resolved(std::move(on_resolved))
+    , cancelled(false)
+{}
+
+resolver_pool::handle::handle()
+{}
+
+resolver_pool::handle::handle(std::shared_ptr<query> q)
+    : q(std::move(q))
+{}
+
+resolver_pool::handle::handle(handle&& other)
+    : q(std::move(other.q))
+{}
+
+resolver_pool::handle& resolver_pool::handle::operator=(handle&& other)
+{
+    cancel();
+    q = std::move(other.q);
+    return *this;
+}
+
+resolver_pool::handle::~handle()
+{
+    cancel();
+}
+
+void resolver_pool::handle::cancel()
+{
+    if (!q)
+        return;
+
+    q->cancelled.store(true, std::memory_order_relaxed);
+    q->on_resolved = on_resolved_t{};
+    q.reset();
+}
+
+resolver_pool::handle::operator bool() const
+{
+    return q && !q->cancelled.load(std::memory_order_relaxed);
+}
+
+resolver_pool::resolver_pool(size_t number_of_threads, size_t max_queued)
+    : max_queued(max_queued)
+    , stopping(false)
+{
+    assert(number_of_threads != 0);
+
+    workers.reserve(number_of_threads);
+    try
+    {
+        for (size_t i = 0; i != number_of_threads; ++i)
+            workers.emplace_back([this] { run_worker(); });
+    }
+    catch (...)
+    {
+        stop_workers();
+        throw;
+    }
+}
+
+resolver_pool::~resolver_pool()
+{
+    stop_workers();
+}
+
+void resolver_pool::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> lg(m);
+        stopping = true;
+        queue.clear();
+    }
+    has_work.notify_all();
+
+    for (std::thread& t : workers)
+        t.join();
+    workers.clear();
+}
+
+resolver_pool::handle resolver_pool::resolve(epoll& ep, std::string hostname, on_resolved_t on_resolved)
+{
+    std::shared_ptr<query> q = std::make_shared<query>(ep, std::move(hostname), std::move(on_resolved));
+    {
+        std::lock_guard<std::mutex> lg(m);
+        if (queue.size() >= max_queued)
+            return handle{};
+        queue.push_back(q);
+    }
+    has_work.notify_one();
+    return handle{std::move(q)};
+}
+
+size_t resolver_pool::queued() const
+{
+    std::lock_guard<std::mutex> lg(m);
+    return queue.size();
+}
+
+void resolver_pool::run_worker()
+{
+    for (;;)
+    {
+        std::shared_ptr<query> q;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            has_work.wait(lk, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            q = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        if (!q->cancelled.load(std::memory_order_relaxed))
+            run_query(q);
+    }
+}
+
+void resolver_pool::run_query(std::shared_ptr<query> const& q)
+{
+    std::vector<ip_address> addresses;
+    std::string error;
+    try
+    {
+        addresses = ip_address::resolve(q->hostname);
+    }
+    catch (std::exception const& e)
+    {
+        error = e.what();
+    }
+
+    // the query is checked again on the loop, the handle may be
+    // cancelled after the answer is posted
+    struct completion
+    {
+        std::shared_ptr<query> q;
+        std::vector<ip_address> addresses;
+        std::string error;
+
+        void operator()()
+        {
+            if (q->cancelled.load(std::memory_order_relaxed))
+                return;
+            q->cancelled.store(true, std::memory_order_relaxed);
+
+            on_resolved_t on_resolved = std::move(q->on_resolved);
+            on_resolved(addresses, error);
+        }
+    };
+
+    q->ep.post(completion{q, std::move(addresses), std::move(error)});
+}
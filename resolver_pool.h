@@ -0,0 +1,90 @@
+#ifndef RESOLVER_POOL_H
+#define RESOLVER_POOL_H
+
+#include "address.h"
+#include "epoll.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs blocking getaddrinfo() lookups on a fixed set of worker threads,
+// so a slow lookup doesn't stall the loop that needs it. The answer is
+// posted back to that loop.
+//
+// The pool must be destroyed before the loops it posts to; queries
+// still waiting then are dropped without calling their callbacks.
+struct resolver_pool
+{
+    // addresses on success, otherwise error is the reason of the failure
+    typedef small_function<void (std::vector<ip_address> const& addresses, std::string const& error)> on_resolved_t;
+
+    struct query;
+
+    // Owned by the one waiting for the answer. Destroying or cancelling
+    // it guarantees the callback isn't called anymore, even if the answer
+    // is already posted to the loop. Must be used on that loop only.
+    struct handle
+    {
+        handle();
+        handle(handle&& other);
+        handle& operator=(handle&& other);
+        ~handle();
+
+        void cancel();
+        // false for a cancelled or finished query and when the pool was full
+        explicit operator bool() const;
+
+    private:
+        explicit handle(std::shared_ptr<query> q);
+
+        std::shared_ptr<query> q;
+
+        friend struct resolver_pool;
+    };
+
+    // at most max_queued queries wait for a free thread
+    resolver_pool(size_t number_of_threads, size_t max_queued);
+    resolver_pool(resolver_pool const&) = delete;
+    resolver_pool& operator=(resolver_pool const&) = delete;
+    ~resolver_pool();
+
+    // can be called from any loop thread, on_resolved is called on the
+    // thread of ep. Returns an empty handle when the queue is full
+    handle resolve(epoll& ep, std::string hostname, on_resolved_t on_resolved);
+
+    // queries waiting for a thread, can be called from any thread
+    size_t queued() const;
+
+private:
+    void stop_workers();
+    void run_worker();
+    void run_query(std::shared_ptr<query> const& q);
+
+private:
+    size_t max_queued;
+    mutable std::mutex m;
+    std::condition_variable has_work;
+    std::deque<std::shared_ptr<query>> queue;
+    bool stopping;
+    std::vector<std::thread> workers;
+};
+
+struct resolver_pool::query
+{
+    query(epoll& ep, std::string hostname, on_resolved_t on_resolved);
+
+    epoll& ep;
+    std::string hostname;
+    // only touched on the loop thread, cleared when cancelled
+    on_resolved_t on_resolved;
+    // lets the workers skip queries nobody waits for anymore
+    std::atomic<bool> cancelled;
+};
+
+#endif // RESOLVER_POOL_H
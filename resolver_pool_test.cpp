@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include "resolver_pool.h"
+
+TEST(resolver_pool, resolve01)
+{
+    epoll ep;
+    resolver_pool pool(2, 16);
+
+    std::vector<ip_address> result;
+    std::string result_error = "not called";
+    resolver_pool::handle h = pool.resolve(ep, "127.0.0.1", [&](std::vector<ip_address> const& addresses, std::string const& error) {
+        result = addresses;
+        result_error = error;
+        ep.stop();
+    });
+    EXPECT_TRUE(static_cast<bool>(h));
+
+    ep.run();
+    EXPECT_EQ(result_error, "");
+    ASSERT_EQ(result.size(), 1u);
+    EXPECT_EQ(result[0], ip_address("127.0.0.1"));
+    // finished
+    EXPECT_FALSE(static_cast<bool>(h));
+}
+
+TEST(resolver_pool, error01)
+{
+    epoll ep;
+    resolver_pool pool(1, 16);
+
+    // a label longer than 63 bytes can't be encoded in a query,
+    // getaddrinfo() fails without asking any nameserver
+    std::string result_error;
+    resolver_pool::handle h = pool.resolve(ep, std::string(64, 'a') + ".invalid", [&](std::vector<ip_address> const& addresses, std::string const& error) {
+        EXPECT_TRUE(addresses.empty());
+        result_error = error;
+        ep.stop();
+    });
+
+    ep.run();
+    EXPECT_NE(result_error, "");
+}
+
+TEST(resolver_pool, cancel01)
+{
+    epoll ep;
+    // one thread answers in order, the second answer comes after the first
+    resolver_pool pool(1, 16);
+
+    bool first_called = false;
+    resolver_pool::handle first = pool.resolve(ep, "127.0.0.1", [&](std::vector<ip_address> const&, std::string const&) {
+        first_called = true;
+    });
+    resolver_pool::handle second = pool.resolve(ep, "127.0.0.2", [&](std::vector<ip_address> const&, std::string const&) {
+        ep.stop();
+    });
+    first.cancel();
+    EXPECT_FALSE(static_cast<bool>(first));
+
+    ep.run();
+    EXPECT_FALSE(first_called);
+}
+
+TEST(resolver_pool, cancel02)
+{
+    epoll ep;
+    epoll other;
+    // one thread answers in order, once the query posted to other is
+    // answered the answer to the first one is already posted to ep
+    resolver_pool pool(1, 16);
+
+    bool called = false;
+    std::unique_ptr<resolver_pool::handle> h(new resolver_pool::handle(pool.resolve(ep, "127.0.0.1", [&](std::vector<ip_address> const&, std::string const&) {
+        called = true;
+    })));
+    resolver_pool::handle marker = pool.resolve(other, "127.0.0.2", [&](std::vector<ip_address> const&, std::string const&) {
+        other.stop();
+    });
+    other.run();
+    h.reset();
+
+    ep.post([&] { ep.stop(); });
+    ep.run();
+    EXPECT_FALSE(called);
+}
+
+TEST(resolver_pool, full01)
+{
+    epoll ep;
+    resolver_pool pool(1, 0);
+
+    resolver_pool::handle h = pool.resolve(ep, "127.0.0.1", [](std::vector<ip_address> const&, std::string const&) {
+        ADD_FAILURE();
+    });
+    EXPECT_FALSE(static_cast<bool>(h));
+}
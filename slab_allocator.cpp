@@ -0,0 +1,59 @@
+#include "slab_allocator.h"
+
+#include <algorithm>
+
+namespace
+{
+    size_t const alignment = alignof(std::max_align_t);
+}
+
+size_t const slab_allocator::slab_size;
+
+slab_allocator::slab_allocator(size_t object_size)
+    : object_size((std::max(object_size, sizeof(free_node)) + alignment - 1) / alignment * alignment)
+    , free_list(nullptr)
+{}
+
+slab_allocator::~slab_allocator()
+{
+    for (void* slab : slabs)
+        ::operator delete(slab);
+}
+
+size_t slab_allocator::get_object_size() const
+{
+    return object_size;
+}
+
+void* slab_allocator::allocate()
+{
+    if (!free_list)
+        add_slab();
+
+    free_node* node = free_list;
+    free_list = node->next;
+    return node;
+}
+
+void slab_allocator::deallocate(void* p) noexcept
+{
+    free_node* node = static_cast<free_node*>(p);
+    node->next = free_list;
+    free_list = node;
+}
+
+void slab_allocator::add_slab()
+{
+    size_t count = std::max<size_t>(slab_size / object_size, 1);
+    slabs.reserve(slabs.size() + 1);
+    char* slab = static_cast<char*>(::operator new(count * object_size));
+    slabs.push_back(slab);
+
+    // objects are handed out in address order
+    for (size_t i = count; i != 0; --i)
+    {
+        free_node* node = reinterpret_cast<free_node*>(slab + (i - 1) * object_size);
+        node->next = free_list;
+        free_list = node;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Allocator of fixed size objects. Memory is taken from the heap in slabs
+// of many objects and freed objects are kept on a free list, so in steady
+// state allocation and deallocation are a couple of pointer operations.
+// Not thread safe: an instance belongs to one loop.
+struct slab_allocator
+{
+    explicit slab_allocator(size_t object_size);
+    slab_allocator(slab_allocator const&) = delete;
+    slab_allocator& operator=(slab_allocator const&) = delete;
+    ~slab_allocator();
+
+    size_t get_object_size() const;
+
+    void* allocate();
+    void deallocate(void* p) noexcept;
+
+    static size_t const slab_size = 64 * 1024;
+
+private:
+    struct free_node
+    {
+        free_node* next;
+    };
+
+    void add_slab();
+
+private:
+    size_t object_size;
+    free_node* free_list;
+    std::vector<void*> slabs;
+};
+
+template <typename T>
+struct slab_deleter
+{
+    slab_deleter() noexcept
+        : allocator(nullptr)
+    {}
+
+    explicit slab_deleter(slab_allocator& allocator) noexcept
+        : allocator(&allocator)
+    {}
+
+    void operator()(T* p) const noexcept
+    {
+        p->~T();
+        allocator->deallocate(p);
+    }
+
+private:
+    slab_allocator* allocator;
+};
+
+template <typename T>
+using slab_ptr = std::unique_ptr<T, slab_deleter<T>>;
+
+template <typename T, typename... Args>
+slab_ptr<T> make_slab_object(slab_allocator& allocator, Args&&... args)
+{
+    assert(sizeof(T) <= allocator.get_object_size());
+    void* p = allocator.allocate();
+    try
+    {
+        return slab_ptr<T>(new (p) T(std::forward<Args>(args)...), slab_deleter<T>(allocator));
+    }
+    catch (...)
+    {
+        allocator.deallocate(p);
+        throw;
+    }
+}
+
+#endif // SLAB_ALLOCATOR_H
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <vector>
+#include "slab_allocator.h"
+
+namespace
+{
+    struct counted
+    {
+        counted(int& counter, int value)
+            : counter(counter)
+            , value(value)
+        {
+            ++counter;
+        }
+
+        ~counted()
+        {
+            --counter;
+        }
+
+        int& counter;
+        int value;
+    };
+
+    struct throwing
+    {
+        throwing()
+        {
+            throw std::runtime_error("throwing");
+        }
+    };
+}
+
+TEST(slab_allocator, object_size01)
+{
+    slab_allocator a(1);
+    EXPECT_GE(a.get_object_size(), sizeof(void*));
+    EXPECT_EQ(a.get_object_size() % alignof(std::max_align_t), 0u);
+
+    slab_allocator b(100);
+    EXPECT_GE(b.get_object_size(), 100u);
+}
+
+TEST(slab_allocator, distinct01)
+{
+    slab_allocator a(48);
+    std::set<void*> seen;
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i != 10000; ++i)
+    {
+        void* p = a.allocate();
+        EXPECT_TRUE(seen.insert(p).second);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % alignof(std::max_align_t), 0u);
+        ptrs.push_back(p);
+    }
+    for (void* p : ptrs)
+        a.deallocate(p);
+}
+
+TEST(slab_allocator, reuse01)
+{
+    slab_allocator a(64);
+    void* p = a.allocate();
+    a.deallocate(p);
+    EXPECT_EQ(a.allocate(), p);
+}
+
+TEST(slab_allocator, large_objects01)
+{
+    slab_allocator a(slab_allocator::slab_size * 2);
+    void* p = a.allocate();
+    void* q = a.allocate();
+    EXPECT_NE(p, q);
+    a.deallocate(p);
+    a.deallocate(q);
+}
+
+TEST(slab_allocator, make_object01)
+{
+    slab_allocator a(sizeof(counted));
+    int counter = 0;
+    {
+        slab_ptr<counted> p = make_slab_object<counted>(a, counter, 42);
+        EXPECT_EQ(counter, 1);
+        EXPECT_EQ(p->value, 42);
+    }
+    EXPECT_EQ(counter, 0);
+}
+
+TEST(slab_allocator, make_object_throws01)
+{
+    slab_allocator a(16);
+    EXPECT_THROW(make_slab_object<throwing>(a), std::runtime_error);
+    void* p = a.allocate();
+    a.deallocate(p);
+}
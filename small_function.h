@@ -0,0 +1,232 @@
+#ifndef SMALL_FUNCTION_H
+#define SMALL_FUNCTION_H
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature>
+struct small_function;
+
+// Move-only replacement for std::function. Callables of up to two
+// pointers (a lambda capturing this and a value) are stored inline, so
+// constructing and moving them does not allocate. The type dependent
+// operations are reached through a single pointer to a static table, which
+// keeps the whole object at three pointers. A call is a single indirect
+// call through the table, an empty function throws std::bad_function_call
+// just like std::function.
+template <typename R, typename... Args>
+struct small_function<R (Args...)>
+{
+    small_function() noexcept;
+    small_function(std::nullptr_t) noexcept;
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, small_function>::value>::type>
+    small_function(F&& f);
+
+    small_function(small_function const&) = delete;
+    small_function(small_function&& other) noexcept;
+    ~small_function();
+
+    small_function& operator=(small_function const&) = delete;
+    small_function& operator=(small_function&& other) noexcept;
+
+    explicit operator bool() const noexcept;
+    R operator()(Args... args) const;
+
+private:
+    static size_t const inline_size = 2 * sizeof(void*);
+    typedef typename std::aligned_storage<inline_size, alignof(void*)>::type storage_t;
+
+    struct operations
+    {
+        R (*invoke)(storage_t&, Args&&...);
+        // moves the callable from src to dst (when dst != nullptr) and
+        // destroys the one in src; nullptr for the empty function
+        void (*relocate)(storage_t& src, storage_t* dst);
+    };
+
+    template <typename F>
+    struct stores_inline : std::integral_constant<bool,
+                                                  sizeof(F) <= inline_size
+                                               && alignof(storage_t) % alignof(F) == 0
+                                               && std::is_nothrow_move_constructible<F>::value>
+    {};
+
+    template <typename F>
+    void init(F&& f, std::true_type);
+    template <typename F>
+    void init(F&& f, std::false_type);
+
+    static R invoke_empty(storage_t&, Args&&...);
+    static operations const* empty_operations();
+
+    template <typename F>
+    static operations const* inline_operations();
+    template <typename F>
+    static operations const* heap_operations();
+
+    template <typename F>
+    static R invoke_inline(storage_t& s, Args&&... args);
+    template <typename F>
+    static void relocate_inline(storage_t& src, storage_t* dst);
+
+    template <typename F>
+    static R invoke_heap(storage_t& s, Args&&... args);
+    template <typename F>
+    static void relocate_heap(storage_t& src, storage_t* dst);
+
+private:
+    mutable storage_t storage;
+    operations const* ops;
+};
+
+template <typename R, typename... Args>
+small_function<R (Args...)>::small_function() noexcept
+    : ops(empty_operations())
+{}
+
+template <typename R, typename... Args>
+small_function<R (Args...)>::small_function(std::nullptr_t) noexcept
+    : ops(empty_operations())
+{}
+
+template <typename R, typename... Args>
+template <typename F, typename>
+small_function<R (Args...)>::small_function(F&& f)
+{
+    typedef typename std::decay<F>::type func_t;
+    init(std::forward<F>(f), stores_inline<func_t>());
+}
+
+template <typename R, typename... Args>
+small_function<R (Args...)>::small_function(small_function&& other) noexcept
+    : ops(other.ops)
+{
+    if (ops->relocate)
+        ops->relocate(other.storage, &storage);
+    other.ops = empty_operations();
+}
+
+template <typename R, typename... Args>
+small_function<R (Args...)>::~small_function()
+{
+    if (ops->relocate)
+        ops->relocate(storage, nullptr);
+}
+
+template <typename R, typename... Args>
+small_function<R (Args...)>& small_function<R (Args...)>::operator=(small_function&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    if (ops->relocate)
+        ops->relocate(storage, nullptr);
+
+    ops = other.ops;
+    if (ops->relocate)
+        ops->relocate(other.storage, &storage);
+    other.ops = empty_operations();
+    return *this;
+}
+
+template <typename R, typename... Args>
+small_function<R (Args...)>::operator bool() const noexcept
+{
+    return ops->relocate != nullptr;
+}
+
+template <typename R, typename... Args>
+R small_function<R (Args...)>::operator()(Args... args) const
+{
+    return ops->invoke(storage, std::forward<Args>(args)...);
+}
+
+template <typename R, typename... Args>
+template <typename F>
+void small_function<R (Args...)>::init(F&& f, std::true_type)
+{
+    typedef typename std::decay<F>::type func_t;
+    new (&storage) func_t(std::forward<F>(f));
+    ops = inline_operations<func_t>();
+}
+
+template <typename R, typename... Args>
+template <typename F>
+void small_function<R (Args...)>::init(F&& f, std::false_type)
+{
+    typedef typename std::decay<F>::type func_t;
+    func_t* p = new func_t(std::forward<F>(f));
+    new (&storage) func_t*(p);
+    ops = heap_operations<func_t>();
+}
+
+template <typename R, typename... Args>
+R small_function<R (Args...)>::invoke_empty(storage_t&, Args&&...)
+{
+    throw std::bad_function_call();
+}
+
+template <typename R, typename... Args>
+typename small_function<R (Args...)>::operations const* small_function<R (Args...)>::empty_operations()
+{
+    static operations const ops = {&invoke_empty, nullptr};
+    return &ops;
+}
+
+template <typename R, typename... Args>
+template <typename F>
+typename small_function<R (Args...)>::operations const* small_function<R (Args...)>::inline_operations()
+{
+    static operations const ops = {&invoke_inline<F>, &relocate_inline<F>};
+    return &ops;
+}
+
+template <typename R, typename... Args>
+template <typename F>
+typename small_function<R (Args...)>::operations const* small_function<R (Args...)>::heap_operations()
+{
+    static operations const ops = {&invoke_heap<F>, &relocate_heap<F>};
+    return &ops;
+}
+
+template <typename R, typename... Args>
+template <typename F>
+R small_function<R (Args...)>::invoke_inline(storage_t& s, Args&&... args)
+{
+    return (*reinterpret_cast<F*>(&s))(std::forward<Args>(args)...);
+}
+
+template <typename R, typename... Args>
+template <typename F>
+void small_function<R (Args...)>::relocate_inline(storage_t& src, storage_t* dst)
+{
+    F& f = *reinterpret_cast<F*>(&src);
+    if (dst)
+        new (dst) F(std::move(f));
+    f.~F();
+}
+
+template <typename R, typename... Args>
+template <typename F>
+R small_function<R (Args...)>::invoke_heap(storage_t& s, Args&&... args)
+{
+    return (**reinterpret_cast<F**>(&s))(std::forward<Args>(args)...);
+}
+
+template <typename R, typename... Args>
+template <typename F>
+void small_function<R (Args...)>::relocate_heap(storage_t& src, storage_t* dst)
+{
+    F* f = *reinterpret_cast<F**>(&src);
+    if (dst)
+        new (dst) F*(f);
+    else
+        delete f;
+}
+
+#endif // SMALL_FUNCTION_H
@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+#include "small_function.h"
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+
+namespace
+{
+    size_t allocations = 0;
+}
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    struct counted
+    {
+        counted(int& alive)
+            : alive(&alive)
+        {
+            ++alive;
+        }
+
+        counted(counted&& other) noexcept
+            : alive(other.alive)
+        {
+            ++*alive;
+        }
+
+        ~counted()
+        {
+            --*alive;
+        }
+
+        int operator()(int x) const
+        {
+            return x + 1;
+        }
+
+        int* alive;
+    };
+
+    struct large
+    {
+        int operator()(int x) const
+        {
+            return x + static_cast<int>(sizeof data);
+        }
+
+        char data[100];
+    };
+}
+
+TEST(small_function, empty01)
+{
+    small_function<void ()> f;
+    EXPECT_FALSE(static_cast<bool>(f));
+    EXPECT_THROW(f(), std::bad_function_call);
+}
+
+TEST(small_function, empty02)
+{
+    small_function<void ()> f = nullptr;
+    EXPECT_FALSE(static_cast<bool>(f));
+}
+
+TEST(small_function, call01)
+{
+    int x = 0;
+    small_function<void (int)> f = [&x](int v) { x = v; };
+    EXPECT_TRUE(static_cast<bool>(f));
+    f(42);
+    EXPECT_EQ(x, 42);
+}
+
+TEST(small_function, return_value01)
+{
+    small_function<std::string (std::string const&)> f = [](std::string const& s) { return s + s; };
+    EXPECT_EQ(f("ab"), "abab");
+}
+
+TEST(small_function, move_only_callable01)
+{
+    std::unique_ptr<int> p(new int(5));
+    int* raw = p.get();
+    small_function<int ()> f = std::bind([](std::unique_ptr<int> const& p) { return *p; }, std::move(p));
+    EXPECT_EQ(f(), 5);
+    small_function<int ()> g = std::move(f);
+    EXPECT_FALSE(static_cast<bool>(f));
+    EXPECT_EQ(g(), 5);
+    EXPECT_EQ(*raw, 5);
+}
+
+TEST(small_function, lifetime_inline01)
+{
+    int alive = 0;
+    {
+        small_function<int (int)> f = counted(alive);
+        EXPECT_EQ(alive, 1);
+        small_function<int (int)> g = std::move(f);
+        EXPECT_EQ(alive, 1);
+        EXPECT_EQ(g(1), 2);
+        g = nullptr;
+        EXPECT_EQ(alive, 0);
+        g = counted(alive);
+        EXPECT_EQ(alive, 1);
+    }
+    EXPECT_EQ(alive, 0);
+}
+
+TEST(small_function, large01)
+{
+    small_function<int (int)> f = large();
+    EXPECT_EQ(f(1), 101);
+    small_function<int (int)> g;
+    g = std::move(f);
+    EXPECT_EQ(g(2), 102);
+    EXPECT_THROW(f(1), std::bad_function_call);
+}
+
+TEST(small_function, self_move_assign01)
+{
+    int x = 0;
+    small_function<void ()> f = [&x] { ++x; };
+    small_function<void ()>& ref = f;
+    f = std::move(ref);
+    f();
+    EXPECT_EQ(x, 1);
+}
+
+TEST(small_function, inline01)
+{
+    // the callbacks of the I/O paths: this and a value, a reference
+    struct connection
+    {
+        size_t calls;
+    } c{0};
+    size_t wanted = 5;
+    size_t total = 0;
+
+    size_t before = allocations;
+    {
+        small_function<void ()> f = [&c, wanted] { c.calls += wanted; };
+        small_function<void ()> g = std::move(f);
+        f = [&total] { ++total; };
+        g();
+        f();
+        f = std::move(g);
+        f();
+    }
+    size_t after = allocations;
+    EXPECT_EQ(after, before);
+    EXPECT_EQ(c.calls, 10u);
+    EXPECT_EQ(total, 1u);
+}
+
+TEST(small_function, inline02)
+{
+    // three pointers don't fit, they are allocated once and moved
+    // with the pointer
+    int a = 0;
+    int b = 0;
+    int d = 0;
+    size_t before = allocations;
+    {
+        small_function<void ()> f = [&a, &b, &d] { ++a; ++b; ++d; };
+        small_function<void ()> g = std::move(f);
+        g();
+    }
+    size_t after = allocations;
+    EXPECT_EQ(after - before, 1u);
+    EXPECT_EQ(a + b + d, 3);
+}
@@ -1,9 +1,18 @@
 #include "socket.h"
 
 #include <sys/socket.h>
+#include <linux/errqueue.h>
 #include <errno.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
 
 #include "throw_error.h"
 #include <sys/epoll.h>
@@ -27,34 +36,97 @@ namespace
             throw_error(errno, "listen()");
     }
 
-    void bind_socket(int fd, uint16_t port_net, uint32_t addr_net)
+    void set_option(int fd, int level, int name, int value, char const* action)
     {
-        sockaddr_in saddr{};
-        saddr.sin_family = AF_INET;
-        saddr.sin_port = port_net;
-        saddr.sin_addr.s_addr = addr_net;
-        int res = ::bind(fd, reinterpret_cast<sockaddr const*>(&saddr), sizeof saddr);
+        int res = ::setsockopt(fd, level, name, &value, sizeof value);
         if (res == -1)
-            throw_error(errno, "bind()");
+            throw_error(errno, action);
+    }
+
+    void apply_options(int fd, int family, socket_options const& options, bool listener)
+    {
+        // before listen/connect, the window scale is negotiated in the handshake
+        if (options.send_buffer != 0)
+            set_option(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer, "setsockopt(SO_SNDBUF)");
+        if (options.receive_buffer != 0)
+            set_option(fd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer, "setsockopt(SO_RCVBUF)");
+
+        // the rest is about TCP, Unix sockets ignore it
+        if (family == AF_UNIX)
+            return;
+
+        if (listener && options.reuse_port)
+            set_option(fd, SOL_SOCKET, SO_REUSEPORT, 1, "setsockopt(SO_REUSEPORT)");
+        // set either way, the default comes from net.ipv6.bindv6only
+        if (listener && family == AF_INET6)
+            set_option(fd, IPPROTO_IPV6, IPV6_V6ONLY, options.v6only, "setsockopt(IPV6_V6ONLY)");
+        if (options.nodelay)
+            set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "setsockopt(TCP_NODELAY)");
+        if (options.notsent_lowat != 0)
+            set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.notsent_lowat, "setsockopt(TCP_NOTSENT_LOWAT)");
+        if (options.fastopen != 0)
+        {
+            if (listener)
+                set_option(fd, IPPROTO_TCP, TCP_FASTOPEN, options.fastopen, "setsockopt(TCP_FASTOPEN)");
+            else
+                set_option(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, "setsockopt(TCP_FASTOPEN_CONNECT)");
+        }
+        if (listener && options.defer_accept != 0)
+            set_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options.defer_accept, "setsockopt(TCP_DEFER_ACCEPT)");
+    }
+
+    // UDP sockets take only the generic options
+    socket_options datagram_options(socket_options const& options)
+    {
+        socket_options result;
+        result.send_buffer = options.send_buffer;
+        result.receive_buffer = options.receive_buffer;
+        result.reuse_port = options.reuse_port;
+        result.v6only = options.v6only;
+        return result;
+    }
+
+    // room for the UDP_GRO or UDP_SEGMENT control message of a datagram
+    size_t const segment_control_size = CMSG_SPACE(sizeof(int));
+
+    socket_options reuse_port_options(bool reuse_port)
+    {
+        socket_options options;
+        options.reuse_port = reuse_port;
+        return options;
     }
 
-    void connect_socket(int fd, uint16_t port_net, uint32_t addr_net)
+    int parse_option_value(std::string const& name, std::string const& value)
     {
-        sockaddr_in saddr{};
-        saddr.sin_family = AF_INET;
-        saddr.sin_port = port_net;
-        saddr.sin_addr.s_addr = addr_net;
+        size_t end = 0;
+        long result;
+        try
+        {
+            result = std::stol(value, &end);
+        }
+        catch (std::exception const&)
+        {
+            end = 0;
+        }
+
+        if (value.empty() || end != value.size() || result < 0 || result > INT_MAX)
+            throw std::invalid_argument("invalid value of socket option " + name + ": '" + value + "'");
+
+        return static_cast<int>(result);
+    }
 
-        int res = ::connect(fd, reinterpret_cast<sockaddr const*>(&saddr), sizeof saddr);
+    void bind_socket(int fd, socket_address const& local)
+    {
+        int res = ::bind(fd, local.data(), local.size());
         if (res == -1)
-            throw_error(errno, "connect()");
+            throw_error(errno, "bind()");
     }
 
-    file_descriptor create_eventfd(bool semaphore)
+    file_descriptor duplicate_socket(int fd)
     {
-        int res = ::eventfd(0, (semaphore ? EFD_SEMAPHORE : 0) | EFD_CLOEXEC | EFD_NONBLOCK);
+        int res = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
         if (res == -1)
-            throw_error(errno, "eventfd()");
+            throw_error(errno, "fcntl(F_DUPFD_CLOEXEC)");
 
         return file_descriptor{res};
     }
@@ -74,6 +146,109 @@ namespace
         if (res == -1)
             throw_error(errno, "fcntl(F_SETFL)");
     }
+
+    // a Unix socket connects at once or fails with EAGAIN when the
+    // backlog of the listener is full, it is never in progress
+    void connect_socket(int fd, socket_address const& remote)
+    {
+        int res = ::connect(fd, remote.data(), remote.size());
+        if (res == -1 && !(errno == EINPROGRESS && (get_fd_flags(fd) & O_NONBLOCK)))
+            throw_error(errno, "connect()");
+    }
+
+    int get_socket_error(int fd)
+    {
+        int err = 0;
+        socklen_t len = sizeof err;
+        int res = ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (res == -1)
+            return errno;
+
+        return err;
+    }
+
+    file_descriptor create_eventfd(bool semaphore)
+    {
+        int res = ::eventfd(0, (semaphore ? EFD_SEMAPHORE : 0) | EFD_CLOEXEC | EFD_NONBLOCK);
+        if (res == -1)
+            throw_error(errno, "eventfd()");
+
+        return file_descriptor{res};
+    }
+
+    // objects owned by a socket are allocated from the slabs of its loop
+    template <typename T>
+    T* make_loop_object(epoll& ep, client_socket::on_ready_t arg)
+    {
+        return make_slab_object<T>(ep.get_slab_allocator(sizeof(T)), std::move(arg)).release();
+    }
+
+    template <typename T>
+    void destroy_loop_object(epoll& ep, T* p)
+    {
+        slab_deleter<T>{ep.get_slab_allocator(sizeof(T))}(p);
+    }
+}
+
+socket_options::socket_options()
+    : nodelay(false)
+    , send_buffer(0)
+    , receive_buffer(0)
+    , notsent_lowat(0)
+    , fastopen(0)
+    , defer_accept(0)
+    , reuse_port(false)
+    , v6only(false)
+{}
+
+socket_options socket_options::parse(std::string const& spec)
+{
+    socket_options result;
+
+    size_t pos = 0;
+    while (pos < spec.size())
+    {
+        size_t comma = spec.find(',', pos);
+        if (comma == std::string::npos)
+            comma = spec.size();
+
+        std::string item = spec.substr(pos, comma - pos);
+        pos = comma + 1;
+        if (item.empty())
+            continue;
+
+        size_t eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        bool has_value = (eq != std::string::npos);
+        std::string value = has_value ? item.substr(eq + 1) : std::string();
+
+        if (name == "nodelay" || name == "reuse_port" || name == "v6only")
+        {
+            bool enabled = !has_value || parse_option_value(name, value) != 0;
+            if (name == "nodelay")
+                result.nodelay = enabled;
+            else if (name == "reuse_port")
+                result.reuse_port = enabled;
+            else
+                result.v6only = enabled;
+            continue;
+        }
+
+        int* field = name == "sndbuf"        ? &result.send_buffer
+                   : name == "rcvbuf"        ? &result.receive_buffer
+                   : name == "notsent_lowat" ? &result.notsent_lowat
+                   : name == "fastopen"      ? &result.fastopen
+                   : name == "defer_accept"  ? &result.defer_accept
+                   : nullptr;
+        if (!field)
+            throw std::invalid_argument("unknown socket option '" + name + "'");
+        if (!has_value)
+            throw std::invalid_argument("socket option " + name + " needs a value");
+
+        *field = parse_option_value(name, value);
+    }
+
+    return result;
 }
 
 client_socket::client_socket(sysapi::epoll &ep, file_descriptor fd, on_ready_t on_disconnect)
@@ -85,15 +260,69 @@ client_socket::client_socket(epoll& ep,
                              on_ready_t on_disconnect,
                              on_ready_t on_read_ready,
                              on_ready_t on_write_ready)
-    : pimpl(new impl(ep, std::move(fd), std::move(on_disconnect), std::move(on_read_ready), std::move(on_write_ready)))
+    : client_socket(ep, std::move(fd), trigger_mode::level, std::move(on_disconnect), std::move(on_read_ready), std::move(on_write_ready))
 {}
 
-client_socket::impl::impl(sysapi::epoll &ep, file_descriptor fd, on_ready_t on_disconnect, on_ready_t on_read_ready, on_ready_t on_write_ready)
-    : ep(ep)
-    , fd(std::move(fd))
+client_socket::client_socket(epoll& ep,
+                             file_descriptor fd,
+                             trigger_mode mode,
+                             on_ready_t on_disconnect,
+                             on_ready_t on_read_ready,
+                             on_ready_t on_write_ready)
+    : pimpl(make_slab_object<impl>(ep.get_slab_allocator(sizeof(impl)), ep, std::move(fd), mode, std::move(on_disconnect), std::move(on_read_ready), std::move(on_write_ready)).release())
+{}
+
+client_socket::client_socket(client_socket&& other) noexcept
+    : pimpl(other.pimpl)
+{
+    other.pimpl = nullptr;
+}
+
+client_socket& client_socket::operator=(client_socket&& other) noexcept
+{
+    client_socket tmp(std::move(other));
+    std::swap(pimpl, tmp.pimpl);
+    return *this;
+}
+
+client_socket::~client_socket()
+{
+    if (!pimpl)
+        return;
+
+    slab_allocator& allocator = pimpl->reg.get_epoll().get_slab_allocator(sizeof(impl));
+    slab_deleter<impl>{allocator}(pimpl);
+}
+
+struct client_socket::write_state
+{
+    write_state(on_ready_t on_write_ready);
+
+    on_ready_t on_write_ready;
+    on_ready_t on_output_drained;
+    output_queue output;
+    bool zerocopy_enabled;
+    size_t zerocopy_min_size;
+    uint32_t zerocopy_seq;
+};
+
+client_socket::write_state::write_state(on_ready_t on_write_ready)
+    : on_write_ready(std::move(on_write_ready))
+    , zerocopy_enabled(false)
+    , zerocopy_min_size(0)
+    , zerocopy_seq(0)
+{}
+
+client_socket::impl::impl(sysapi::epoll &ep, file_descriptor fd, trigger_mode mode, on_ready_t on_disconnect, on_ready_t on_read_ready, on_ready_t on_write_ready)
+    : fd(std::move(fd))
+    , mode(mode)
+    , readable(false)
+    , writable(false)
+    , io_operations(0)
     , on_disconnect(std::move(on_disconnect))
     , on_read_ready(std::move(on_read_ready))
-    , on_write_ready(std::move(on_write_ready))
+    , destroyed(nullptr)
+    , writes(on_write_ready ? make_loop_object<write_state>(ep, std::move(on_write_ready)) : nullptr)
     , reg(ep, this->fd.getfd(), calculate_flags(), [this](uint32_t events) {
         assert((events & ~(EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) == 0);
         bool is_destroyed = false;
@@ -101,61 +330,453 @@ client_socket::impl::impl(sysapi::epoll &ep, file_descriptor fd, on_ready_t on_d
         destroyed = &is_destroyed;
         try
         {
-            if ((events & EPOLLRDHUP)
-             || (events & EPOLLERR)
-             || (events & EPOLLHUP))
-            {
-                this->on_disconnect();
-                if (is_destroyed)
-                    return;
-            }
-            if (events & EPOLLIN)
+            on_event(events, is_destroyed);
+        }
+        catch (...)
+        {
+            if (!is_destroyed)
+                destroyed = nullptr;
+            throw;
+        }
+        if (!is_destroyed)
+            destroyed = nullptr;
+    })
+{
+}
+
+struct client_socket::connect_state
+{
+    connect_state(on_ready_t on_connected);
+
+    on_ready_t on_connected;
+    timer_element deadline;
+};
+
+client_socket::connect_state::connect_state(on_ready_t on_connected)
+    : on_connected(std::move(on_connected))
+{}
+
+client_socket::impl::~impl()
+{
+    if (destroyed)
+        *destroyed = true;
+
+    if (!writes)
+        return;
+
+    // unsent data is dropped, partly sent zerocopy segments are kept
+    // with the written ones
+    writes->output.clear();
+    epoll& ep = reg.get_epoll();
+    if (writes->output.zerocopy_pending() == 0)
+    {
+        destroy_loop_object(ep, writes);
+        return;
+    }
+
+    // the kernel may still read the segments; the graveyard registers
+    // the same descriptor, the registration goes first
+    reg.clear();
+    ep.get_zerocopy_graveyard().bury(std::move(fd), writes);
+}
+
+void client_socket::impl::on_event(uint32_t events, bool const& is_destroyed)
+{
+    if (connecting)
+    {
+        if (!finish_connect(events, is_destroyed))
+            return;
+
+        // level triggered interest now follows the handlers and is
+        // reported again, an edge is not
+        if (mode == trigger_mode::level)
+            return;
+    }
+
+    if ((events & EPOLLERR) && writes && writes->zerocopy_enabled)
+    {
+        // zerocopy completions are signaled with EPOLLERR too, the
+        // connection is fine unless the socket has an error pending
+        read_error_queue(fd.getfd(), *writes);
+        if ((events & (EPOLLRDHUP | EPOLLHUP)) == 0 && get_socket_error(fd.getfd()) == 0)
+            events &= ~EPOLLERR;
+    }
+
+    if ((events & EPOLLRDHUP)
+     || (events & EPOLLERR)
+     || (events & EPOLLHUP))
+    {
+        on_disconnect();
+        if (is_destroyed)
+            return;
+    }
+
+    if (mode == trigger_mode::level)
+    {
+        if (events & EPOLLIN)
+        {
+            on_read_ready();
+            if (is_destroyed)
+                return;
+        }
+        if (events & EPOLLOUT)
+        {
+            if (!output_empty())
             {
-                this->on_read_ready();
+                on_writable_output(is_destroyed);
                 if (is_destroyed)
                     return;
             }
-            if (events & EPOLLOUT)
+            if (output_empty() && has_write_handler())
             {
-                this->on_write_ready();
+                writes->on_write_ready();
                 if (is_destroyed)
                     return;
             }
         }
-        catch (...)
+        return;
+    }
+
+    if (events & EPOLLIN)
+        readable = true;
+    if (events & EPOLLOUT)
+        writable = true;
+
+    // handlers are called while they make progress, a handler installed
+    // by another one is called in the same round when the socket is already
+    // ready for it; no new edge would be reported otherwise
+    static size_t const max_rounds = 16;
+    for (size_t round = 0; round != max_rounds; ++round)
+    {
+        bool progress = false;
+
+        if (readable && on_read_ready)
         {
-            destroyed = nullptr;
-            throw;
+            uint32_t before = io_operations;
+            on_read_ready();
+            if (is_destroyed)
+                return;
+            progress |= (io_operations != before);
         }
-        destroyed = nullptr;
-    })
-    , destroyed(nullptr)
+
+        if (writable && !output_empty())
+        {
+            uint32_t before = io_operations;
+            on_writable_output(is_destroyed);
+            if (is_destroyed)
+                return;
+            progress |= (io_operations != before);
+        }
+
+        if (writable && output_empty() && has_write_handler())
+        {
+            uint32_t before = io_operations;
+            writes->on_write_ready();
+            if (is_destroyed)
+                return;
+            progress |= (io_operations != before);
+        }
+
+        if (!progress)
+            return;
+    }
+
+    // the budget is exhausted, let the other sockets of the loop run and
+    // ask epoll to report the remaining readiness on the next iteration
+    if ((readable && on_read_ready) || (writable && (has_write_handler() || !output_empty())))
+        reg.rearm();
+}
+
+bool client_socket::impl::finish_connect(uint32_t events, bool const& is_destroyed)
 {
+    int err = get_socket_error(fd.getfd());
+    if (err == 0 && (events & (EPOLLERR | EPOLLHUP)) == 0)
+    {
+        if ((events & EPOLLOUT) == 0)
+            return false;
+
+        std::unique_ptr<connect_state> state = std::move(connecting);
+        update_registration();
+        state->on_connected();
+        return !is_destroyed;
+    }
+
+    connecting.reset();
+    update_registration();
+    on_disconnect();
+    return false;
 }
 
-client_socket::impl::~impl()
+void client_socket::impl::on_connect_timeout()
 {
-    if (destroyed)
-        *destroyed = true;
+    // the state is kept alive until the running callback returns
+    std::unique_ptr<connect_state> state = std::move(connecting);
+    update_registration();
+    on_disconnect();
 }
 
 void client_socket::impl::update_registration()
 {
-    reg.modify(calculate_flags());
+    if (mode == trigger_mode::level)
+    {
+        reg.modify(calculate_flags());
+        return;
+    }
+
+    // inside on_event the handler will be picked up by the next round
+    if (destroyed)
+        return;
+
+    if ((readable && on_read_ready) || (writable && (has_write_handler() || !output_empty())))
+        reg.rearm();
 }
 
 int client_socket::impl::calculate_flags() const
 {
-    return (on_read_ready  ? EPOLLIN : 0)
-         | (on_write_ready ? EPOLLOUT: 0)
-         | EPOLLRDHUP;
+    if (mode == trigger_mode::edge)
+        return EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+    if (connecting)
+        return EPOLLOUT | EPOLLRDHUP;
+
+    int flags = EPOLLRDHUP;
+    if (on_read_ready)
+        flags |= EPOLLIN;
+    if (has_write_handler() || !output_empty())
+        flags |= EPOLLOUT;
+    return flags;
+}
+
+size_t client_socket::impl::read_some(void* data, size_t size)
+{
+    ++io_operations;
+    size_t bytes_read = ::read_some(fd, data, size);
+    // a short read means the receive queue was drained, new data
+    // generates a new edge
+    if (bytes_read < size)
+        readable = false;
+    return bytes_read;
+}
+
+size_t client_socket::impl::write_some(void const* data, size_t size)
+{
+    // keep the order of the bytes, the queue is written first
+    if (!output_empty())
+        return 0;
+
+    ++io_operations;
+    size_t written = ::write_some(fd, data, size);
+    if (written < size)
+        writable = false;
+    return written;
+}
+
+size_t client_socket::impl::splice_read(weak_file_descriptor pipe_in, size_t size)
+{
+    ++io_operations;
+    ssize_t res = ::splice(fd.getfd(), nullptr, pipe_in.getfd(), nullptr, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (res == -1)
+    {
+        int err = errno;
+        if (err != EAGAIN && err != ECONNRESET)
+            throw_error(err, "splice()");
+        res = 0;
+    }
+
+    // unlike read() a short splice can be caused by the pipe running out
+    // of slots, only nothing moved means the socket is drained
+    if (res == 0)
+        readable = false;
+    return static_cast<size_t>(res);
+}
+
+size_t client_socket::impl::splice_write(weak_file_descriptor pipe_out, size_t size)
+{
+    if (!output_empty())
+        return 0;
+
+    ++io_operations;
+    ssize_t res = ::splice(pipe_out.getfd(), nullptr, fd.getfd(), nullptr, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (res == -1)
+    {
+        int err = errno;
+        if (err != EAGAIN && err != ECONNRESET && err != EPIPE)
+            throw_error(err, "splice()");
+        res = 0;
+    }
+
+    size_t written = static_cast<size_t>(res);
+    if (written < size)
+        writable = false;
+    return written;
+}
+
+bool client_socket::impl::flush_output()
+{
+    if (output_empty())
+        return true;
+
+    output_queue& output = writes->output;
+    iovec iov[IOV_MAX];
+    // set when the kernel is out of memory for pinning pages
+    bool copy_only = false;
+
+    ++io_operations;
+    while (!output.empty())
+    {
+        bool zerocopy;
+        size_t iov_count = output.fill_iovec(iov, IOV_MAX, copy_only ? 0 : writes->zerocopy_min_size, zerocopy);
+        size_t requested = 0;
+        for (size_t i = 0; i != iov_count; ++i)
+            requested += iov[i].iov_len;
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+        ssize_t res = ::sendmsg(fd.getfd(), &msg, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (res == -1)
+        {
+            int err = errno;
+            if (err == EINTR)
+                continue;
+            if (err == EAGAIN)
+            {
+                writable = false;
+                break;
+            }
+            if (err == ENOBUFS && zerocopy)
+            {
+                copy_only = true;
+                continue;
+            }
+            // the disconnect is reported by epoll
+            if (err == ECONNRESET || err == EPIPE)
+                break;
+            throw_error(err, "sendmsg()");
+        }
+
+        size_t written = static_cast<size_t>(res);
+        if (zerocopy)
+            output.consume_zerocopy(written, writes->zerocopy_seq++);
+        else
+            output.consume(written);
+
+        if (written < requested)
+        {
+            writable = false;
+            break;
+        }
+    }
+
+    return output.empty();
+}
+
+void client_socket::impl::on_writable_output(bool const& is_destroyed)
+{
+    if (!flush_output())
+        return;
+
+    update_registration();
+    if (writes->on_output_drained)
+    {
+        writes->on_output_drained();
+        if (is_destroyed)
+            return;
+    }
+    release_idle_write_state();
+}
+
+void client_socket::impl::read_error_queue(int fd, write_state& writes)
+{
+    for (;;)
+    {
+        char control[128];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        ssize_t res = ::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (res == -1)
+        {
+            int err = errno;
+            if (err == EINTR)
+                continue;
+            if (err == EAGAIN)
+                break;
+            throw_error(err, "recvmsg(MSG_ERRQUEUE)");
+        }
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+             && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            sock_extended_err ee;
+            memcpy(&ee, CMSG_DATA(cm), sizeof ee);
+            if (ee.ee_errno != 0 || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            writes.output.complete_zerocopy(ee.ee_info, ee.ee_data);
+
+            // the pages were copied, pinning them only costs
+            if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                writes.zerocopy_min_size = 0;
+        }
+    }
+}
+
+bool client_socket::impl::output_empty() const
+{
+    return !writes || writes->output.empty();
+}
+
+bool client_socket::impl::has_write_handler() const
+{
+    return writes && writes->on_write_ready;
+}
+
+void client_socket::impl::set_write_handler(on_ready_t on_write_ready)
+{
+    if (on_write_ready)
+    {
+        get_write_state().on_write_ready = std::move(on_write_ready);
+        return;
+    }
+
+    if (writes)
+    {
+        writes->on_write_ready = on_ready_t{};
+        release_idle_write_state();
+    }
+}
+
+client_socket::write_state& client_socket::impl::get_write_state()
+{
+    if (!writes)
+        writes = make_loop_object<write_state>(reg.get_epoll(), on_ready_t{});
+    return *writes;
+}
+
+void client_socket::impl::release_idle_write_state()
+{
+    if (!writes
+     || writes->on_write_ready
+     || writes->on_output_drained
+     || !writes->output.empty()
+     || writes->output.zerocopy_pending() != 0
+     || writes->zerocopy_enabled)
+        return;
+
+    destroy_loop_object(reg.get_epoll(), writes);
+    writes = nullptr;
 }
 
 void client_socket::set_on_read_write(on_ready_t on_read_ready,
                                       on_ready_t on_write_ready)
 {
     pimpl->on_read_ready = std::move(on_read_ready);
-    pimpl->on_write_ready = std::move(on_write_ready);
+    pimpl->set_write_handler(std::move(on_write_ready));
     pimpl->update_registration();
 }
 
@@ -168,101 +789,669 @@ void client_socket::set_on_read(on_ready_t on_ready)
 
 void client_socket::set_on_write(client_socket::on_ready_t on_ready)
 {
-    pimpl->on_write_ready = std::move(on_ready);
+    pimpl->set_write_handler(std::move(on_ready));
     pimpl->update_registration();
 }
 
 size_t client_socket::write_some(const void *data, size_t size)
 {
-    return ::write_some(pimpl->fd, data, size);
+    return pimpl->write_some(data, size);
 }
 
 size_t client_socket::read_some(void* data, size_t size)
 {
-    return ::read_some(pimpl->fd, data, size);
+    return pimpl->read_some(data, size);
+}
+
+size_t client_socket::splice_read(weak_file_descriptor pipe_in, size_t size)
+{
+    return pimpl->splice_read(pipe_in, size);
+}
+
+size_t client_socket::splice_write(weak_file_descriptor pipe_out, size_t size)
+{
+    return pimpl->splice_write(pipe_out, size);
+}
+
+void client_socket::queue_output(std::string data)
+{
+    bool was_empty = pimpl->output_empty();
+    pimpl->get_write_state().output.push(std::move(data));
+    if (was_empty)
+        pimpl->update_registration();
+}
+
+void client_socket::queue_output_borrowed(void const* data, size_t size)
+{
+    bool was_empty = pimpl->output_empty();
+    pimpl->get_write_state().output.push_borrowed(data, size);
+    if (was_empty)
+        pimpl->update_registration();
+}
+
+void client_socket::queue_output_shared(std::shared_ptr<void const> owner, void const* data, size_t size)
+{
+    bool was_empty = pimpl->output_empty();
+    pimpl->get_write_state().output.push_shared(std::move(owner), data, size);
+    if (was_empty)
+        pimpl->update_registration();
 }
 
-client_socket client_socket::connect(sysapi::epoll &ep, const ipv4_endpoint &remote, on_ready_t on_disconnect)
+bool client_socket::flush_output()
 {
-    file_descriptor fd = make_socket(AF_INET, SOCK_STREAM);
-    connect_socket(fd.getfd(), remote.port_net, remote.addr_net);
+    bool empty = pimpl->flush_output();
+    pimpl->update_registration();
+    pimpl->release_idle_write_state();
+    return empty;
+}
+
+size_t client_socket::output_size() const
+{
+    return pimpl->writes ? pimpl->writes->output.size() : 0;
+}
+
+void client_socket::set_on_output_drained(on_ready_t on_drained)
+{
+    if (on_drained)
+    {
+        pimpl->get_write_state().on_output_drained = std::move(on_drained);
+        return;
+    }
+
+    if (pimpl->writes)
+    {
+        pimpl->writes->on_output_drained = on_ready_t{};
+        pimpl->release_idle_write_state();
+    }
+}
+
+bool client_socket::set_zerocopy(size_t min_size)
+{
+    write_state& state = pimpl->get_write_state();
+    if (min_size != 0 && !state.zerocopy_enabled)
+    {
+        int value = 1;
+        int res = ::setsockopt(pimpl->fd.getfd(), SOL_SOCKET, SO_ZEROCOPY, &value, sizeof value);
+        if (res == -1)
+        {
+            int err = errno;
+            if (err == ENOPROTOOPT || err == EOPNOTSUPP || err == EINVAL)
+            {
+                pimpl->release_idle_write_state();
+                return false;
+            }
+            throw_error(err, "setsockopt(SO_ZEROCOPY)");
+        }
+        state.zerocopy_enabled = true;
+    }
+
+    state.zerocopy_min_size = min_size;
+    pimpl->release_idle_write_state();
+    return true;
+}
+
+client_socket client_socket::connect(sysapi::epoll &ep, const socket_address &remote, on_ready_t on_disconnect)
+{
+    file_descriptor fd = make_socket(remote.family(), SOCK_STREAM);
+    connect_socket(fd.getfd(), remote);
     set_fd_flags(fd.getfd(), get_fd_flags(fd.getfd()) | O_NONBLOCK);
     client_socket res{ep, std::move(fd), std::move(on_disconnect)};
     return res;
 }
 
+client_socket client_socket::connect(epoll& ep,
+                                     socket_address const& remote,
+                                     timer::clock_t::duration timeout,
+                                     on_ready_t on_connected,
+                                     on_ready_t on_disconnect)
+{
+    return connect(ep, remote, socket_options{}, timeout, std::move(on_connected), std::move(on_disconnect));
+}
+
+client_socket client_socket::connect(epoll& ep,
+                                     socket_address const& remote,
+                                     socket_options const& options,
+                                     timer::clock_t::duration timeout,
+                                     on_ready_t on_connected,
+                                     on_ready_t on_disconnect)
+{
+    file_descriptor fd = make_socket(remote.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC);
+    apply_options(fd.getfd(), remote.family(), options, false);
+    connect_socket(fd.getfd(), remote);
+    client_socket res{ep, std::move(fd), std::move(on_disconnect)};
+
+    impl* p = res.pimpl;
+    p->connecting.reset(new connect_state(std::move(on_connected)));
+    p->connecting->deadline.set_callback([p] { p->on_connect_timeout(); });
+    p->connecting->deadline.restart(ep.get_timer(), timeout);
+    p->update_registration();
+    return res;
+}
+
+struct zerocopy_graveyard::entry : intrusive_list_element<>
+{
+    entry(file_descriptor fd, client_socket::write_state* writes);
+
+    file_descriptor fd;
+    client_socket::write_state* writes;
+    epoll_registration reg;
+    timer_element linger;
+};
+
+zerocopy_graveyard::entry::entry(file_descriptor fd, client_socket::write_state* writes)
+    : fd(std::move(fd))
+    , writes(writes)
+{}
+
+timer::clock_t::duration const zerocopy_graveyard::linger_timeout = std::chrono::seconds(10);
+
+zerocopy_graveyard::zerocopy_graveyard(epoll& ep)
+    : ep(ep)
+    , count(0)
+{}
+
+zerocopy_graveyard::~zerocopy_graveyard()
+{
+    while (!entries.empty())
+        release(&entries.front(), true);
+}
+
+size_t zerocopy_graveyard::size() const
+{
+    return count;
+}
+
+void zerocopy_graveyard::bury(file_descriptor fd, client_socket::write_state* writes)
+{
+    // the peer gets the rest of the data and the FIN as after close(),
+    // the handlers belong to the destroyed socket
+    ::shutdown(fd.getfd(), SHUT_WR);
+    writes->on_write_ready = client_socket::on_ready_t{};
+    writes->on_output_drained = client_socket::on_ready_t{};
+
+    slab_ptr<entry> e = make_slab_object<entry>(ep.get_slab_allocator(sizeof(entry)), std::move(fd), writes);
+    entry* p = e.get();
+
+    // every completion queued on the socket is a new edge, EPOLLERR is
+    // named for the io_uring backend that polls only for what is asked
+    p->reg = epoll_registration(ep, p->fd.getfd(), EPOLLERR | EPOLLET, [this, p](uint32_t) {
+        client_socket::impl::read_error_queue(p->fd.getfd(), *p->writes);
+        if (p->writes->output.zerocopy_pending() == 0)
+            release(p, false);
+    });
+    p->linger.set_callback([this, p] {
+        release(p, true);
+    });
+    p->linger.restart(ep.get_timer(), linger_timeout);
+
+    entries.push_back(*e.release());
+    ++count;
+}
+
+void zerocopy_graveyard::release(entry* e, bool reset)
+{
+    // an abortive close drops the send queue of the socket and with it
+    // the references to the pages
+    if (reset)
+    {
+        linger l{1, 0};
+        ::setsockopt(e->fd.getfd(), SOL_SOCKET, SO_LINGER, &l, sizeof l);
+    }
+
+    e->unlink();
+    --count;
+    e->reg.clear();
+    e->fd = file_descriptor();
+    destroy_loop_object(ep, e->writes);
+    destroy_loop_object(ep, e);
+}
+
+size_t const server_socket::default_accept_budget;
+timer::clock_t::duration const server_socket::accept_retry_interval = std::chrono::milliseconds(100);
+
 server_socket::server_socket(epoll& ep, on_connected_t on_connected)
-    : fd(make_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK))
-    , on_connected(on_connected)
+    : server_socket(ep, ipv4_endpoint(0, ipv4_address::any()), std::move(on_connected))
+{}
+
+server_socket::server_socket(epoll& ep, socket_address const& local_endpoint, on_connected_t on_connected)
+    : server_socket(ep, local_endpoint, socket_options{}, std::move(on_connected))
+{}
+
+server_socket::server_socket(epoll& ep, socket_address const& local_endpoint, bool reuse_port, on_connected_t on_connected)
+    : server_socket(ep, listen(local_endpoint, reuse_port), std::move(on_connected))
+{}
+
+server_socket::server_socket(epoll& ep, socket_address const& local_endpoint, socket_options const& options, on_connected_t on_connected)
+    : server_socket(ep, listen(local_endpoint, options), std::move(on_connected))
+{}
+
+server_socket::server_socket(epoll& ep, server_socket const& listener, on_connected_t on_connected)
+    : server_socket(ep, listener.duplicate(), std::move(on_connected))
+{
+    accept_budget = listener.accept_budget;
+}
+
+server_socket::server_socket(epoll& ep, file_descriptor listener, on_connected_t on_connected)
+    : fd(std::move(listener))
+    , on_connected(std::move(on_connected))
+    , accept_budget(default_accept_budget)
+    , accept_failing(false)
     , reg(ep, fd.getfd(), EPOLLIN, [this](uint32_t events) {
         assert(events == EPOLLIN);
-        this->on_connected();
+        on_readable();
     })
+    , accept_retry([this] {
+        reg.modify(EPOLLIN);
+    })
+{}
+
+file_descriptor server_socket::listen(socket_address const& local_endpoint, bool reuse_port)
+{
+    return listen(local_endpoint, reuse_port_options(reuse_port));
+}
+
+file_descriptor server_socket::listen(socket_address const& local_endpoint, socket_options const& options)
 {
+    file_descriptor fd = make_socket(local_endpoint.family(), SOCK_STREAM | SOCK_NONBLOCK);
+    apply_options(fd.getfd(), local_endpoint.family(), options, true);
+    bind_socket(fd.getfd(), local_endpoint);
     start_listen(fd.getfd());
+    return fd;
 }
 
-server_socket::server_socket(epoll& ep, ipv4_endpoint local_endpoint, on_connected_t on_connected)
-    : fd(make_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK))
-    , on_connected(on_connected)
-    , reg(ep, fd.getfd(), EPOLLIN, [this](uint32_t events) {
-        assert(events == EPOLLIN);
-        this->on_connected();
+file_descriptor server_socket::duplicate() const
+{
+    return duplicate_socket(fd.getfd());
+}
+
+socket_address server_socket::local_endpoint() const
+{
+    sockaddr_storage saddr{};
+    socklen_t saddr_len = sizeof saddr;
+    int res = ::getsockname(fd.getfd(), reinterpret_cast<sockaddr*>(&saddr), &saddr_len);
+    if (res == -1)
+        throw_error(errno, "getsockname()");
+    return socket_address{reinterpret_cast<sockaddr const*>(&saddr), saddr_len};
+}
+
+client_socket server_socket::accept(client_socket::on_ready_t on_disconnect)
+{
+    return client_socket{reg.get_epoll(), take_accepted(), std::move(on_disconnect)};
+}
+
+client_socket server_socket::accept(client_socket::on_ready_t on_disconnect,
+                                    client_socket::on_ready_t on_read_ready,
+                                    client_socket::on_ready_t on_write_ready)
+{
+    return client_socket{reg.get_epoll(), take_accepted(), std::move(on_disconnect), std::move(on_read_ready), std::move(on_write_ready)};
+}
+
+client_socket server_socket::accept(client_socket::trigger_mode mode,
+                                    client_socket::on_ready_t on_disconnect,
+                                    client_socket::on_ready_t on_read_ready,
+                                    client_socket::on_ready_t on_write_ready)
+{
+    return client_socket{reg.get_epoll(), take_accepted(), mode, std::move(on_disconnect), std::move(on_read_ready), std::move(on_write_ready)};
+}
+
+void server_socket::set_accept_budget(size_t budget)
+{
+    assert(budget != 0);
+    accept_budget = budget;
+}
+
+void server_socket::on_readable()
+{
+    for (size_t i = 0; i != accept_budget; ++i)
+    {
+        int res = ::accept4(fd.getfd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (res == -1)
+        {
+            int err = errno;
+            if (err == EAGAIN || err == EWOULDBLOCK)
+                break;
+
+            // the connection was reset while in the backlog
+            if (err == ECONNABORTED || err == EPROTO || err == EINTR)
+                continue;
+
+            // out of descriptors or memory: keep the loop alive,
+            // accepting is retried later
+            if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM)
+            {
+                pause_accepting(err);
+                break;
+            }
+
+            throw_error(err, "accept4()");
+        }
+
+        accept_failing = false;
+        accepted.reset(res);
+        try
+        {
+            on_connected();
+        }
+        catch (...)
+        {
+            // not taken by the callback, closed right away
+            accepted.reset(-1);
+            throw;
+        }
+        accepted.reset(-1);
+    }
+}
+
+void server_socket::pause_accepting(int err)
+{
+    // the pending connection keeps the level-triggered listener readable
+    if (!accept_failing)
+        std::cerr << "error: accept4(): " << strerror(err) << ", retrying" << std::endl;
+    accept_failing = true;
+
+    reg.modify(0);
+    accept_retry.restart(reg.get_epoll().get_timer(), accept_retry_interval);
+}
+
+file_descriptor server_socket::take_accepted()
+{
+    // accept() is called once per on_connected, from the callback
+    assert(accepted.getfd() != -1);
+
+    file_descriptor result;
+    swap(result, accepted);
+    return result;
+}
+
+datagram_batch::datagram_batch(size_t max_messages, size_t max_message_size)
+    : max_size(max_message_size)
+    , count(0)
+    , buffers(max_messages * max_message_size)
+    , messages(max_messages)
+    , headers(max_messages)
+    , iov(max_messages)
+    , control(max_messages * segment_control_size)
+{
+    assert(max_messages != 0);
+}
+
+size_t datagram_batch::capacity() const
+{
+    return messages.size();
+}
+
+size_t datagram_batch::max_message_size() const
+{
+    return max_size;
+}
+
+size_t datagram_batch::size() const
+{
+    return count;
+}
+
+void datagram_batch::clear()
+{
+    count = 0;
+}
+
+char* datagram_batch::data(size_t i)
+{
+    assert(i < capacity());
+    return buffers.data() + i * max_size;
+}
+
+size_t datagram_batch::message_size(size_t i) const
+{
+    assert(i < count);
+    return messages[i].size;
+}
+
+size_t datagram_batch::segment_size(size_t i) const
+{
+    assert(i < count);
+    return messages[i].segment_size;
+}
+
+socket_address datagram_batch::peer(size_t i) const
+{
+    assert(i < count);
+    return socket_address{reinterpret_cast<sockaddr const*>(&messages[i].peer), messages[i].peer_size};
+}
+
+bool datagram_batch::push(void const* data, size_t size, socket_address const& peer)
+{
+    return push(data, size, peer, 0);
+}
+
+bool datagram_batch::push(void const* data, size_t size, socket_address const& peer, size_t segment_size)
+{
+    // UDP_SEGMENT takes 16 bits, a larger segment can't be a datagram
+    if (segment_size > UINT16_MAX)
+        throw std::invalid_argument("invalid UDP segment size " + std::to_string(segment_size));
+
+    if (count == capacity() || size > max_size)
+        return false;
+
+    memcpy(this->data(count), data, size);
+    message& m = messages[count];
+    m.size = size;
+    m.segment_size = segment_size < size ? segment_size : 0;
+    memcpy(&m.peer, peer.data(), peer.size());
+    m.peer_size = peer.size();
+    ++count;
+    return true;
+}
+
+void datagram_batch::prepare(size_t i, size_t iov_len, socklen_t peer_size, bool with_segment_size)
+{
+    iov[i].iov_base = data(i);
+    iov[i].iov_len = iov_len;
+
+    msghdr& h = headers[i].msg_hdr;
+    h = msghdr{};
+    h.msg_name = &messages[i].peer;
+    h.msg_namelen = peer_size;
+    h.msg_iov = &iov[i];
+    h.msg_iovlen = 1;
+    h.msg_control = &control[i * segment_control_size];
+    h.msg_controllen = segment_control_size;
+
+    if (!with_segment_size)
+        return;
+
+    cmsghdr* cm = CMSG_FIRSTHDR(&h);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t segment_size = static_cast<uint16_t>(messages[i].segment_size);
+    memcpy(CMSG_DATA(cm), &segment_size, sizeof segment_size);
+    h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+}
+
+datagram_socket::datagram_socket(epoll& ep, socket_address const& local_endpoint, socket_options const& options)
+    : fd(make_socket(local_endpoint.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC))
+    , pending_error(0)
+    , reg(ep, fd.getfd(), 0, [this](uint32_t events) {
+        // ICMP errors of a connected socket, reading SO_ERROR clears it;
+        // the error is reported to the read handler by receive()
+        if (events & EPOLLERR)
+        {
+            int err = get_socket_error(fd.getfd());
+            if (err != 0)
+                pending_error = err;
+        }
+
+        if ((events & EPOLLIN || pending_error != 0) && on_read_ready)
+            on_read_ready();
+        if ((events & EPOLLOUT) && on_write_ready)
+            on_write_ready();
     })
 {
-    bind_socket(fd.getfd(), local_endpoint.port_net, local_endpoint.addr_net);
-    start_listen(fd.getfd());
+    apply_options(fd.getfd(), local_endpoint.family(), datagram_options(options), true);
+    bind_socket(fd.getfd(), local_endpoint);
 }
 
-ipv4_endpoint server_socket::local_endpoint() const
+socket_address datagram_socket::local_endpoint() const
 {
-    sockaddr_in saddr{};
+    sockaddr_storage saddr{};
     socklen_t saddr_len = sizeof saddr;
     int res = ::getsockname(fd.getfd(), reinterpret_cast<sockaddr*>(&saddr), &saddr_len);
     if (res == -1)
         throw_error(errno, "getsockname()");
-    assert(saddr_len == sizeof saddr);
-    return ipv4_endpoint{saddr.sin_port, saddr.sin_addr.s_addr};
+    return socket_address{reinterpret_cast<sockaddr const*>(&saddr), saddr_len};
+}
+
+void datagram_socket::connect(socket_address const& remote)
+{
+    connect_socket(fd.getfd(), remote);
 }
 
-client_socket server_socket::accept(client_socket::on_ready_t on_disconnect) const
+void datagram_socket::set_on_read_write(on_ready_t on_read_ready, on_ready_t on_write_ready)
 {
-    int res = ::accept4(fd.getfd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    this->on_read_ready = std::move(on_read_ready);
+    this->on_write_ready = std::move(on_write_ready);
+    update_registration();
+}
+
+bool datagram_socket::set_gro(bool enabled)
+{
+    int value = enabled ? 1 : 0;
+    int res = ::setsockopt(fd.getfd(), SOL_UDP, UDP_GRO, &value, sizeof value);
     if (res == -1)
-        throw_error(errno, "accept4()");
+    {
+        int err = errno;
+        if (err == ENOPROTOOPT || err == EINVAL)
+            return false;
+        throw_error(err, "setsockopt(UDP_GRO)");
+    }
 
-    return client_socket{reg.get_epoll(), {res}, std::move(on_disconnect)};
+    return true;
 }
 
-client_socket server_socket::accept(client_socket::on_ready_t on_disconnect,
-                                    client_socket::on_ready_t on_read_ready,
-                                    client_socket::on_ready_t on_write_ready) const
+size_t datagram_socket::receive(datagram_batch& batch)
+{
+    if (pending_error != 0)
+    {
+        int err = pending_error;
+        pending_error = 0;
+        throw_error(err, "recvmmsg()");
+    }
+
+    size_t n = std::min<size_t>(batch.capacity(), UIO_MAXIOV);
+    for (size_t i = 0; i != n; ++i)
+        batch.prepare(i, batch.max_message_size(), sizeof(sockaddr_storage), false);
+
+    batch.clear();
+    int res;
+    do
+        res = ::recvmmsg(fd.getfd(), batch.headers.data(), static_cast<unsigned>(n), MSG_DONTWAIT, nullptr);
+    while (res == -1 && errno == EINTR);
+
+    if (res == -1)
+    {
+        int err = errno;
+        if (err == EAGAIN)
+            return 0;
+        throw_error(err, "recvmmsg()");
+    }
+
+    for (size_t i = 0; i != static_cast<size_t>(res); ++i)
+    {
+        datagram_batch::message& m = batch.messages[i];
+        msghdr& h = batch.headers[i].msg_hdr;
+        m.size = batch.headers[i].msg_len;
+        m.segment_size = 0;
+        m.peer_size = h.msg_namelen;
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&h); cm != nullptr; cm = CMSG_NXTHDR(&h, cm))
+        {
+            if (cm->cmsg_level != SOL_UDP || cm->cmsg_type != UDP_GRO)
+                continue;
+
+            int segment_size;
+            memcpy(&segment_size, CMSG_DATA(cm), sizeof segment_size);
+            if (segment_size > 0 && static_cast<size_t>(segment_size) < m.size)
+                m.segment_size = static_cast<size_t>(segment_size);
+        }
+    }
+
+    batch.count = static_cast<size_t>(res);
+    return batch.count;
+}
+
+size_t datagram_socket::send(datagram_batch& batch, size_t first)
 {
-    int res = ::accept4(fd.getfd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    assert(first <= batch.size());
+    size_t n = std::min<size_t>(batch.size() - first, UIO_MAXIOV);
+    if (n == 0)
+        return 0;
+
+    for (size_t i = first; i != first + n; ++i)
+    {
+        batch.prepare(i, batch.messages[i].size, batch.messages[i].peer_size, batch.messages[i].segment_size != 0);
+        if (batch.messages[i].segment_size == 0)
+        {
+            batch.headers[i].msg_hdr.msg_control = nullptr;
+            batch.headers[i].msg_hdr.msg_controllen = 0;
+        }
+    }
+
+    int res;
+    do
+        res = ::sendmmsg(fd.getfd(), batch.headers.data() + first, static_cast<unsigned>(n), MSG_DONTWAIT);
+    while (res == -1 && errno == EINTR);
+
     if (res == -1)
-        throw_error(errno, "accept4()");
+    {
+        int err = errno;
+        if (err == EAGAIN || err == ENOBUFS)
+            return 0;
+        throw_error(err, "sendmmsg()");
+    }
 
-    return client_socket{reg.get_epoll(), {res}, std::move(on_disconnect), std::move(on_read_ready), std::move(on_write_ready)};
+    return static_cast<size_t>(res);
+}
+
+void datagram_socket::update_registration()
+{
+    reg.modify(calculate_flags());
+}
+
+int datagram_socket::calculate_flags() const
+{
+    int flags = 0;
+    if (on_read_ready)
+        flags |= EPOLLIN;
+    if (on_write_ready)
+        flags |= EPOLLOUT;
+    return flags;
 }
 
 eventfd::eventfd(epoll& ep, bool semaphore, on_event_t on_event)
     : fd(create_eventfd(semaphore))
-    , on_event(on_event)
-    , reg(ep, fd.getfd(), 0, [this] (uint32_t events) {
+    , on_event(std::move(on_event))
+    , reg(ep, fd.getfd(), this->on_event ? static_cast<uint32_t>(EPOLLIN) : 0, [this] (uint32_t events) {
         assert((events & ~EPOLLIN) == 0);
         uint64_t tmp;
-        read(this->fd.getfd(), &tmp, sizeof tmp);
+        ssize_t res = ::read(this->fd.getfd(), &tmp, sizeof tmp);
+        if (res == -1 && errno != EAGAIN)
+            throw_error(errno, "read(eventfd)");
         this->on_event();
     })
 {}
 
 void eventfd::notify(uint64_t increment)
 {
-    write(fd, &increment, sizeof increment);
+    // the generic write() uses send(), which does not work on an eventfd;
+    // EAGAIN means the counter is saturated and the reader is notified anyway
+    ssize_t res = ::write(fd.getfd(), &increment, sizeof increment);
+    if (res == -1 && errno != EAGAIN)
+        throw_error(errno, "write(eventfd)");
 }
 
 void eventfd::set_on_event(eventfd::on_event_t on_event)
 {
-    this->on_event = on_event;
-    reg.modify(on_event ? EPOLLIN : 0);
+    this->on_event = std::move(on_event);
+    reg.modify(this->on_event ? static_cast<uint32_t>(EPOLLIN) : 0);
 }
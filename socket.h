@@ -4,12 +4,65 @@
 #include "file_descriptor.h"
 #include "address.h"
 #include "epoll.h"
+#include "intrusive_list.h"
+#include "output_queue.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <memory>
+#include <string>
+#include <vector>
 #include <cstdint>
 
+// Options applied when a socket is set up: to a listener before listen(),
+// the connections it accepts inherit them, and to a connecting socket
+// before connect(). Fields left at their defaults keep the system
+// behavior.
+struct socket_options
+{
+    socket_options();
+
+    // TCP_NODELAY: small writes are sent right away instead of being
+    // coalesced by Nagle's algorithm, trades packets for latency
+    bool nodelay;
+    // SO_SNDBUF/SO_RCVBUF in bytes, 0 keeps autotuning
+    int send_buffer;
+    int receive_buffer;
+    // TCP_NOTSENT_LOWAT: writability is reported only while less than
+    // this many bytes are not sent yet, the rest waits in user space
+    int notsent_lowat;
+    // TCP_FASTOPEN: for a listener the length of the queue of pending
+    // fast open requests, for a connecting socket any non-zero value sets
+    // TCP_FASTOPEN_CONNECT
+    int fastopen;
+    // TCP_DEFER_ACCEPT, listener only: a connection is accepted once data
+    // arrives or after this many seconds
+    int defer_accept;
+    // SO_REUSEPORT, listener only
+    bool reuse_port;
+    // IPV6_V6ONLY, IPv6 listener only: by default it is cleared so a
+    // listener on [::] accepts IPv4 connections as well (dual-stack)
+    bool v6only;
+
+    // parses a comma separated list like "nodelay,sndbuf=65536",
+    // names are the ones of the fields plus sndbuf and rcvbuf;
+    // throws std::invalid_argument
+    static socket_options parse(std::string const& spec);
+};
+
 struct client_socket
 {
-    typedef std::function<void ()> on_ready_t;
+    typedef small_function<void ()> on_ready_t;
+
+    // level: epoll interest follows the installed handlers, changing
+    // handlers costs an epoll_ctl.
+    // edge: the socket is registered once for IN|OUT|RDHUP with EPOLLET,
+    // readiness is tracked by the socket and handlers are called again
+    // until read_some/write_some drain the socket.
+    enum class trigger_mode
+    {
+        level,
+        edge,
+    };
 
     client_socket(epoll& ep,
                   file_descriptor fd,
@@ -21,6 +74,17 @@ struct client_socket
                   on_ready_t on_read_ready,
                   on_ready_t on_write_ready);
 
+    client_socket(epoll& ep,
+                  file_descriptor fd,
+                  trigger_mode mode,
+                  on_ready_t on_disconnect,
+                  on_ready_t on_read_ready,
+                  on_ready_t on_write_ready);
+
+    client_socket(client_socket&& other) noexcept;
+    client_socket& operator=(client_socket&& other) noexcept;
+    ~client_socket();
+
     void set_on_read_write(on_ready_t on_read_ready, on_ready_t on_write_ready);
     void set_on_read(on_ready_t on_ready);
     void set_on_write(on_ready_t on_ready);
@@ -28,51 +92,308 @@ struct client_socket
     size_t write_some(void const* data, size_t size);
     size_t read_some(void* data, size_t size);
 
-    static client_socket connect(epoll& ep, ipv4_endpoint const& remote, on_ready_t on_disconnect);
+    // Move up to size bytes between the socket and a pipe with splice(),
+    // the data is not copied to user space. Like read_some/write_some they
+    // return 0 when nothing can be moved now. In edge mode the pipe must
+    // have room for size bytes for splice_read to track readiness.
+    size_t splice_read(weak_file_descriptor pipe_in, size_t size);
+    size_t splice_write(weak_file_descriptor pipe_out, size_t size);
+
+    // Queued output, written with sendmsg() in order after anything
+    // queued before. While the queue is not empty the socket waits for
+    // writability on its own, independently of on_write_ready.
+    void queue_output(std::string data);
+    // data must stay valid until it is written or the socket is destroyed
+    void queue_output_borrowed(void const* data, size_t size);
+    void queue_output_shared(std::shared_ptr<void const> owner, void const* data, size_t size);
+    // writes as much of the queue as the socket accepts now,
+    // returns true when the queue is empty
+    bool flush_output();
+    size_t output_size() const;
+    // called from the loop when the remainder of the queue is written
+    void set_on_output_drained(on_ready_t on_drained);
+
+    // Sends owned and shared queued segments of at least min_size bytes
+    // with MSG_ZEROCOPY, their memory is released once the kernel reports
+    // the completion; 0 disables. Returns false when the kernel does not
+    // support SO_ZEROCOPY. It is turned off again when the kernel reports
+    // that it had to copy the data anyway (e.g. on loopback).
+    bool set_zerocopy(size_t min_size);
+
+    static client_socket connect(epoll& ep, socket_address const& remote, on_ready_t on_disconnect);
+
+    // Non-blocking connect: on_connected is called once the connection is
+    // established, a refused connection or no connection within timeout
+    // calls on_disconnect. Handlers can be installed right away, they are
+    // called only after on_connected.
+    static client_socket connect(epoll& ep,
+                                 socket_address const& remote,
+                                 timer::clock_t::duration timeout,
+                                 on_ready_t on_connected,
+                                 on_ready_t on_disconnect);
+    static client_socket connect(epoll& ep,
+                                 socket_address const& remote,
+                                 socket_options const& options,
+                                 timer::clock_t::duration timeout,
+                                 on_ready_t on_connected,
+                                 on_ready_t on_disconnect);
 
 private:
+    struct connect_state;
+    struct write_state;
+
     struct impl
     {
-        impl(epoll& ep, file_descriptor fd, on_ready_t on_disconnect, on_ready_t on_read_ready, on_ready_t on_write_ready);
+        impl(epoll& ep, file_descriptor fd, trigger_mode mode, on_ready_t on_disconnect, on_ready_t on_read_ready, on_ready_t on_write_ready);
         ~impl();
 
+        void on_event(uint32_t events, bool const& is_destroyed);
+        bool finish_connect(uint32_t events, bool const& is_destroyed);
+        void on_connect_timeout();
         void update_registration();
         int calculate_flags() const;
 
-        epoll& ep;
+        size_t read_some(void* data, size_t size);
+        size_t write_some(void const* data, size_t size);
+        size_t splice_read(weak_file_descriptor pipe_in, size_t size);
+        size_t splice_write(weak_file_descriptor pipe_out, size_t size);
+        bool flush_output();
+        void on_writable_output(bool const& is_destroyed);
+        // collects the zerocopy completions of the socket
+        static void read_error_queue(int fd, write_state& writes);
+
+        bool output_empty() const;
+        bool has_write_handler() const;
+        void set_write_handler(on_ready_t on_write_ready);
+        write_state& get_write_state();
+        void release_idle_write_state();
+
         file_descriptor fd;
+        trigger_mode mode;
+        bool readable;
+        bool writable;
+        // wraps around, only compared for equality
+        uint32_t io_operations;
         on_ready_t on_disconnect;
         on_ready_t on_read_ready;
-        on_ready_t on_write_ready;
-        epoll_registration reg;
         bool* destroyed;
+        // only while a write handler is installed, output is queued or
+        // zerocopy is enabled, an idle connection doesn't pay for it;
+        // allocated from the slab allocator of the loop
+        write_state* writes;
+        // only while an asynchronous connect is in progress
+        std::unique_ptr<connect_state> connecting;
+        epoll_registration reg;
     };
 
-    std::unique_ptr<impl> pimpl;
+    // allocated from the slab allocator of the loop, the allocator is
+    // found through the loop when the socket is destroyed
+    impl* pimpl;
+
+    friend struct zerocopy_graveyard;
+};
+
+// Client sockets destroyed while the kernel still references data they
+// sent with MSG_ZEROCOPY leave their descriptor and output queue here.
+// The sending side is shut down right away, the segments are freed when
+// the completions arrive, or the connection is reset after
+// linger_timeout. One per loop, see epoll::get_zerocopy_graveyard().
+struct zerocopy_graveyard
+{
+    explicit zerocopy_graveyard(epoll& ep);
+    zerocopy_graveyard(zerocopy_graveyard const&) = delete;
+    zerocopy_graveyard& operator=(zerocopy_graveyard const&) = delete;
+    ~zerocopy_graveyard();
+
+    // number of sockets waiting for completions
+    size_t size() const;
+
+    static timer::clock_t::duration const linger_timeout;
+
+private:
+    struct entry;
+
+    void bury(file_descriptor fd, client_socket::write_state* writes);
+    void release(entry* e, bool reset);
+
+private:
+    epoll& ep;
+    intrusive_list<entry> entries;
+    size_t count;
+
+    friend struct client_socket::impl;
 };
 
 struct server_socket
 {
-    typedef std::function<void ()> on_connected_t;
+    typedef small_function<void ()> on_connected_t;
 
     server_socket(epoll& ep, on_connected_t on_connected);
-    server_socket(epoll& ep, ipv4_endpoint local_endpoint, on_connected_t on_connected);
+    server_socket(epoll& ep, socket_address const& local_endpoint, on_connected_t on_connected);
+    server_socket(epoll& ep, socket_address const& local_endpoint, bool reuse_port, on_connected_t on_connected);
+    server_socket(epoll& ep, socket_address const& local_endpoint, socket_options const& options, on_connected_t on_connected);
+    // Accepts from the listening socket of another server_socket, usually
+    // of another loop. For addresses that can't be bound once per loop
+    // with SO_REUSEPORT (Unix sockets): every loop is woken for a new
+    // connection and one of them accepts it.
+    server_socket(epoll& ep, server_socket const& listener, on_connected_t on_connected);
+    // takes over a socket made by listen() or duplicate(), lets the
+    // constructors of a server owning a server_socket delegate to one
+    server_socket(epoll& ep, file_descriptor listener, on_connected_t on_connected);
+
+    // the listening sockets of the constructors above
+    static file_descriptor listen(socket_address const& local_endpoint, bool reuse_port);
+    static file_descriptor listen(socket_address const& local_endpoint, socket_options const& options);
+    file_descriptor duplicate() const;
 
-    ipv4_endpoint local_endpoint() const;
-    client_socket accept(client_socket::on_ready_t on_disconnect) const;
+    socket_address local_endpoint() const;
+
+    // must be called from on_connected, at most once per call; these take
+    // the connection accepted for the callback, a connection not taken by
+    // it is closed
+    client_socket accept(client_socket::on_ready_t on_disconnect);
     client_socket accept(client_socket::on_ready_t on_disconnect,
                          client_socket::on_ready_t on_read_ready,
-                         client_socket::on_ready_t on_write_ready) const;
+                         client_socket::on_ready_t on_write_ready);
+    client_socket accept(client_socket::trigger_mode mode,
+                         client_socket::on_ready_t on_disconnect,
+                         client_socket::on_ready_t on_read_ready,
+                         client_socket::on_ready_t on_write_ready);
+
+    // maximum number of connections accepted (and on_connected calls)
+    // per wakeup; the rest of the backlog waits for the next iteration
+    void set_accept_budget(size_t budget);
+
+    static size_t const default_accept_budget = 64;
+
+    // when accept fails for lack of descriptors or memory the listener
+    // stops being polled for this long, instead of waking the loop for
+    // the same pending connection over and over
+    static timer::clock_t::duration const accept_retry_interval;
+
+private:
+    void on_readable();
+    void pause_accepting(int err);
+    file_descriptor take_accepted();
 
 private:
     file_descriptor fd;
     on_connected_t on_connected;
+    size_t accept_budget;
+    file_descriptor accepted;
+    // set from the first failed accept until one succeeds, the error is
+    // reported once per such period
+    bool accept_failing;
+    epoll_registration reg;
+    timer_element accept_retry;
+};
+
+// Storage for a batch of datagrams: the message buffers, their peers and
+// the headers passed to the kernel, reused between calls so a batch costs
+// one system call and no allocations.
+//
+// With GRO/GSO a message carries several datagrams of segment_size bytes
+// each, the last one can be shorter.
+struct datagram_batch
+{
+    datagram_batch(size_t max_messages, size_t max_message_size);
+    datagram_batch(datagram_batch const&) = delete;
+    datagram_batch& operator=(datagram_batch const&) = delete;
+
+    size_t capacity() const;
+    size_t max_message_size() const;
+
+    // number of messages in the batch
+    size_t size() const;
+    void clear();
+
+    char* data(size_t i);
+    size_t message_size(size_t i) const;
+    // 0 for a message that is a single datagram
+    size_t segment_size(size_t i) const;
+    socket_address peer(size_t i) const;
+
+    // appends a message to send, returns false when the batch is full
+    // or the message is too large. Segment sizes above 65535 don't fit
+    // UDP_SEGMENT and throw std::invalid_argument
+    bool push(void const* data, size_t size, socket_address const& peer);
+    bool push(void const* data, size_t size, socket_address const& peer, size_t segment_size);
+
+private:
+    struct message
+    {
+        size_t size;
+        size_t segment_size;
+        // IPv4 or IPv6, written by the kernel on receive
+        sockaddr_storage peer;
+        socklen_t peer_size;
+    };
+
+    void prepare(size_t i, size_t iov_len, socklen_t peer_size, bool with_segment_size);
+
+    size_t max_size;
+    size_t count;
+    std::vector<char> buffers;
+    std::vector<message> messages;
+    // kernel side, filled by prepare()
+    std::vector<mmsghdr> headers;
+    std::vector<iovec> iov;
+    std::vector<char> control;
+
+    friend struct datagram_socket;
+};
+
+// UDP socket registered in a loop. Datagrams are received and sent in
+// batches with recvmmsg/sendmmsg. Interest follows the installed handlers
+// like a level triggered client_socket. The socket must not be destroyed
+// by its own handlers.
+struct datagram_socket
+{
+    typedef small_function<void ()> on_ready_t;
+
+    // TCP specific options are ignored, an IPv6 socket bound to [::]
+    // without v6only exchanges datagrams with IPv4 peers as well
+    datagram_socket(epoll& ep, socket_address const& local_endpoint, socket_options const& options);
+    datagram_socket(datagram_socket const&) = delete;
+    datagram_socket& operator=(datagram_socket const&) = delete;
+
+    socket_address local_endpoint() const;
+    // sets the default peer, datagrams from other peers are dropped
+    void connect(socket_address const& remote);
+
+    void set_on_read_write(on_ready_t on_read_ready, on_ready_t on_write_ready);
+
+    // UDP_GRO: datagrams of one flow are received coalesced into a single
+    // message with a segment size, the batch needs room for 64KB messages.
+    // Returns false when the kernel doesn't support it
+    bool set_gro(bool enabled);
+
+    // replaces the content of batch with the datagrams received now,
+    // returns their number, 0 when nothing is pending. Throws the errors
+    // of the socket, e.g. ECONNREFUSED from an ICMP message to a
+    // connected socket; the read handler is called for them
+    size_t receive(datagram_batch& batch);
+    // sends messages first..batch.size(), returns the number sent, which
+    // is smaller when the socket buffer is full. Messages with a segment
+    // size are sent with UDP GSO
+    size_t send(datagram_batch& batch, size_t first);
+
+private:
+    void update_registration();
+    int calculate_flags() const;
+
+private:
+    file_descriptor fd;
+    on_ready_t on_read_ready;
+    on_ready_t on_write_ready;
+    // taken from SO_ERROR, thrown by the next receive()
+    int pending_error;
     epoll_registration reg;
 };
 
 struct eventfd
 {
-    typedef std::function<void ()> on_event_t;
+    typedef small_function<void ()> on_event_t;
 
     eventfd(epoll& ep, bool semaphore, on_event_t on_event);
     void notify(uint64_t increment = 1);
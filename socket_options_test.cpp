@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "socket.h"
+
+TEST(socket_options, defaults01)
+{
+    socket_options options;
+    EXPECT_FALSE(options.nodelay);
+    EXPECT_EQ(options.send_buffer, 0);
+    EXPECT_EQ(options.receive_buffer, 0);
+    EXPECT_EQ(options.notsent_lowat, 0);
+    EXPECT_EQ(options.fastopen, 0);
+    EXPECT_EQ(options.defer_accept, 0);
+    EXPECT_FALSE(options.reuse_port);
+    EXPECT_FALSE(options.v6only);
+}
+
+TEST(socket_options, parse01)
+{
+    socket_options options = socket_options::parse("nodelay,sndbuf=65536,rcvbuf=131072,notsent_lowat=16384,fastopen=256,defer_accept=5,reuse_port,v6only");
+    EXPECT_TRUE(options.nodelay);
+    EXPECT_EQ(options.send_buffer, 65536);
+    EXPECT_EQ(options.receive_buffer, 131072);
+    EXPECT_EQ(options.notsent_lowat, 16384);
+    EXPECT_EQ(options.fastopen, 256);
+    EXPECT_EQ(options.defer_accept, 5);
+    EXPECT_TRUE(options.reuse_port);
+    EXPECT_TRUE(options.v6only);
+}
+
+TEST(socket_options, parse02)
+{
+    socket_options options = socket_options::parse("nodelay=0,,sndbuf=1");
+    EXPECT_FALSE(options.nodelay);
+    EXPECT_EQ(options.send_buffer, 1);
+
+    options = socket_options::parse("");
+    EXPECT_FALSE(options.nodelay);
+}
+
+TEST(socket_options, parse_error01)
+{
+    EXPECT_THROW(socket_options::parse("nodelay,unknown"), std::invalid_argument);
+    EXPECT_THROW(socket_options::parse("sndbuf"), std::invalid_argument);
+    EXPECT_THROW(socket_options::parse("sndbuf="), std::invalid_argument);
+    EXPECT_THROW(socket_options::parse("sndbuf=12k"), std::invalid_argument);
+    EXPECT_THROW(socket_options::parse("sndbuf=-1"), std::invalid_argument);
+    EXPECT_THROW(socket_options::parse("rcvbuf=99999999999"), std::invalid_argument);
+}
+
+TEST(socket_options, listen01)
+{
+    socket_options options = socket_options::parse("nodelay,sndbuf=65536,rcvbuf=65536,notsent_lowat=16384,fastopen=16,defer_accept=1");
+
+    epoll ep;
+    std::unique_ptr<client_socket> accepted;
+    server_socket ss(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), options, [&] {
+        accepted.reset(new client_socket(ss.accept(client_socket::on_ready_t{})));
+        ep.stop();
+    });
+
+    // with TCP_DEFER_ACCEPT the connection is reported once data arrives
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(fd, -1);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ss.local_endpoint().as_ipv4().port());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(::connect(fd, reinterpret_cast<sockaddr const*>(&addr), sizeof addr), 0);
+    ASSERT_EQ(::write(fd, "x", 1), 1);
+
+    ep.run();
+    EXPECT_TRUE(static_cast<bool>(accepted));
+    ::close(fd);
+}
@@ -0,0 +1,500 @@
+#include <gtest/gtest.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "socket.h"
+
+namespace
+{
+    // connected pair of non-blocking stream sockets
+    std::pair<file_descriptor, file_descriptor> make_socket_pair()
+    {
+        int fds[2];
+        int res = ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds);
+        EXPECT_EQ(res, 0);
+        return std::make_pair(file_descriptor(fds[0]), file_descriptor(fds[1]));
+    }
+
+    // blocking connect, completes as soon as the connection is in the
+    // backlog of the listener
+    file_descriptor connect_to(socket_address const& remote)
+    {
+        int fd = ::socket(remote.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+        EXPECT_NE(fd, -1);
+        EXPECT_EQ(::connect(fd, remote.data(), remote.size()), 0);
+        return file_descriptor(fd);
+    }
+
+    // runs the loop for a while
+    void run_for(epoll& ep, timer::clock_t::duration d)
+    {
+        timer_element stop(ep.get_timer(), d, [&ep] { ep.stop(); });
+        ep.run();
+    }
+
+    // stops the loop when a test doesn't finish in time
+    struct deadline
+    {
+        deadline(epoll& ep, timer::clock_t::duration d)
+            : expired(false)
+            , element(ep.get_timer(), d, [this, &ep] {
+                expired = true;
+                ep.stop();
+            })
+        {}
+
+        bool expired;
+        timer_element element;
+    };
+}
+
+TEST(client_socket, edge_partial_read01)
+{
+    epoll ep;
+    auto fds = make_socket_pair();
+    std::string data(100, 'x');
+    write(fds.second, data.data(), data.size());
+
+    // the handler reads less than there is, without a new edge it is
+    // called again only because the socket tracks the readiness
+    std::string received;
+    size_t calls = 0;
+    std::unique_ptr<client_socket> s;
+    s.reset(new client_socket(ep, std::move(fds.first), client_socket::trigger_mode::edge,
+                              client_socket::on_ready_t{}, [&] {
+        ++calls;
+        char buf[10];
+        received.append(buf, s->read_some(buf, sizeof buf));
+        if (received.size() == data.size())
+            ep.stop();
+    }, client_socket::on_ready_t{}));
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+    EXPECT_EQ(received, data);
+    EXPECT_GE(calls, 10u);
+}
+
+TEST(client_socket, edge_partial_read02)
+{
+    epoll ep;
+    auto fds = make_socket_pair();
+    std::string data(100, 'x');
+    write(fds.second, data.data(), data.size());
+
+    // a byte per call exceeds the rounds of one event, the rest is
+    // reported again after the registration is re-armed
+    std::string received;
+    std::unique_ptr<client_socket> s;
+    s.reset(new client_socket(ep, std::move(fds.first), client_socket::trigger_mode::edge,
+                              client_socket::on_ready_t{}, [&] {
+        char c;
+        received.append(&c, s->read_some(&c, 1));
+        if (received.size() == data.size())
+            ep.stop();
+    }, client_socket::on_ready_t{}));
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+    EXPECT_EQ(received, data);
+}
+
+TEST(client_socket, edge_install_handler01)
+{
+    epoll ep;
+    auto fds = make_socket_pair();
+    write(fds.second, "abc", 3);
+
+    // the data arrived before the handler was installed, no new edge
+    // follows
+    client_socket s(ep, std::move(fds.first), client_socket::trigger_mode::edge,
+                    client_socket::on_ready_t{}, client_socket::on_ready_t{}, client_socket::on_ready_t{});
+    timer_element install(ep.get_timer(), std::chrono::milliseconds(20), [&] {
+        s.set_on_read([&] {
+            char buf[10];
+            if (s.read_some(buf, sizeof buf) == 3)
+                ep.stop();
+        });
+    });
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+}
+
+TEST(epoll_registration, edge_rearm01)
+{
+    epoll ep;
+    auto fds = make_socket_pair();
+    write(fds.second, "abcd", 4);
+
+    // EPOLLET reports the data once, rearm() reports it again while it
+    // is still there
+    size_t calls = 0;
+    epoll_registration reg;
+    reg = epoll_registration(ep, fds.first.getfd(), EPOLLIN | EPOLLET, [&](uint32_t) {
+        char c;
+        read_some(fds.first, &c, 1);
+        if (++calls == 4)
+            ep.stop();
+        else
+            reg.rearm();
+    });
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+    EXPECT_EQ(calls, 4u);
+}
+
+TEST(server_socket, accept_budget01)
+{
+    epoll ep;
+    std::vector<client_socket> accepted;
+    bool snapshot_posted = false;
+    std::vector<size_t> per_iteration;
+    server_socket ss(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), [&] {
+        accepted.push_back(ss.accept([] {}));
+        // posted actions run at the start of the next iteration
+        if (!snapshot_posted)
+        {
+            snapshot_posted = true;
+            ep.post([&] {
+                snapshot_posted = false;
+                per_iteration.push_back(accepted.size());
+                if (accepted.size() == 5)
+                    ep.stop();
+            });
+        }
+    });
+    ss.set_accept_budget(2);
+
+    std::vector<file_descriptor> clients;
+    for (size_t i = 0; i != 5; ++i)
+        clients.push_back(connect_to(ss.local_endpoint()));
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+    EXPECT_EQ(per_iteration, (std::vector<size_t>{2, 4, 5}));
+}
+
+TEST(server_socket, accept_emfile01)
+{
+    epoll ep;
+    ep.set_stats_enabled(true);
+    std::vector<client_socket> accepted;
+    server_socket ss(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), [&] {
+        accepted.push_back(ss.accept([] {}));
+        if (accepted.size() == 3)
+            ep.stop();
+    });
+
+    std::vector<file_descriptor> clients;
+    for (size_t i = 0; i != 3; ++i)
+        clients.push_back(connect_to(ss.local_endpoint()));
+
+    // no descriptor can be allocated until the limit is restored, the
+    // pending connections must not keep the loop busy meanwhile
+    testing::internal::CaptureStderr();
+    rlimit original;
+    ASSERT_EQ(::getrlimit(RLIMIT_NOFILE, &original), 0);
+    int lowest_free = ::dup(0);
+    ASSERT_NE(lowest_free, -1);
+    ::close(lowest_free);
+    rlimit lowered = original;
+    lowered.rlim_cur = static_cast<rlim_t>(lowest_free);
+    ASSERT_EQ(::setrlimit(RLIMIT_NOFILE, &lowered), 0);
+
+    timer_element restore(ep.get_timer(), std::chrono::milliseconds(300), [&] {
+        ::setrlimit(RLIMIT_NOFILE, &original);
+    });
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    ::setrlimit(RLIMIT_NOFILE, &original);
+    std::string log = testing::internal::GetCapturedStderr();
+
+    EXPECT_FALSE(d.expired);
+    EXPECT_EQ(accepted.size(), 3u);
+    EXPECT_LT(ep.get_stats().snapshot().events_per_wakeup.count(), 20u);
+    // reported once for the whole period
+    size_t lines = 0;
+    for (char c : log)
+        lines += c == '\n';
+    EXPECT_EQ(lines, 1u);
+}
+
+TEST(server_socket, accept_throw01)
+{
+    epoll ep;
+    server_socket ss(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), [] {
+        throw std::runtime_error("on_connected failed");
+    });
+
+    // the connection the callback failed on is closed right away, not
+    // when the next one is accepted
+    file_descriptor client = connect_to(ss.local_endpoint());
+    testing::internal::CaptureStderr();
+    run_for(ep, std::chrono::milliseconds(20));
+    EXPECT_EQ(testing::internal::GetCapturedStderr(), "error: on_connected failed\n");
+
+    char c;
+    EXPECT_EQ(::recv(client.getfd(), &c, 1, MSG_DONTWAIT), 0);
+}
+
+TEST(client_socket, connect01)
+{
+    epoll ep;
+    std::vector<client_socket> accepted;
+    std::string received;
+    server_socket ss(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), [&] {
+        accepted.push_back(ss.accept([] {}));
+        client_socket& c = accepted.back();
+        c.set_on_read([&] {
+            char buf[16];
+            received.append(buf, c.read_some(buf, sizeof buf));
+            if (received == "hello")
+                ep.stop();
+        });
+    });
+
+    // the handlers installed before the connection is established wait
+    // for on_connected
+    std::vector<std::string> calls;
+    std::unique_ptr<client_socket> s;
+    s.reset(new client_socket(client_socket::connect(ep, ss.local_endpoint(), std::chrono::seconds(5), [&] {
+        calls.push_back("connected");
+        EXPECT_EQ(s->write_some("hello", 5), 5u);
+    }, [&] {
+        calls.push_back("disconnect");
+    })));
+    s->set_on_write([&] {
+        calls.push_back("write");
+        s->set_on_write(client_socket::on_ready_t{});
+    });
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+    EXPECT_EQ(received, "hello");
+    ASSERT_FALSE(calls.empty());
+    EXPECT_EQ(calls[0], "connected");
+    EXPECT_EQ(std::count(calls.begin(), calls.end(), "disconnect"), 0);
+}
+
+TEST(client_socket, connect_refused01)
+{
+    epoll ep;
+    socket_address remote;
+    {
+        // the port is free once the listener is closed
+        server_socket ss(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), [] {});
+        remote = ss.local_endpoint();
+    }
+
+    bool connected = false;
+    bool disconnected = false;
+    client_socket s = client_socket::connect(ep, remote, std::chrono::seconds(5), [&] {
+        connected = true;
+    }, [&] {
+        disconnected = true;
+        ep.stop();
+    });
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+    EXPECT_FALSE(connected);
+    EXPECT_TRUE(disconnected);
+}
+
+TEST(client_socket, connect_timeout01)
+{
+    epoll ep;
+
+    // the accept queue of the listener is full after the first
+    // connection, further handshakes are not answered
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_NE(fd, -1);
+    file_descriptor listener(fd);
+    socket_address local(ipv4_endpoint(0, ipv4_address("127.0.0.1")));
+    ASSERT_EQ(::bind(fd, local.data(), local.size()), 0);
+    ASSERT_EQ(::listen(fd, 0), 0);
+    sockaddr_storage saddr{};
+    socklen_t saddr_len = sizeof saddr;
+    ASSERT_EQ(::getsockname(fd, reinterpret_cast<sockaddr*>(&saddr), &saddr_len), 0);
+    socket_address remote(reinterpret_cast<sockaddr const*>(&saddr), saddr_len);
+    file_descriptor filler = connect_to(remote);
+
+    bool connected = false;
+    bool disconnected = false;
+    timer::clock_t::time_point start = timer::clock_t::now();
+    timer::clock_t::time_point disconnected_at;
+    client_socket s = client_socket::connect(ep, remote, std::chrono::milliseconds(50), [&] {
+        connected = true;
+    }, [&] {
+        disconnected = true;
+        disconnected_at = timer::clock_t::now();
+        ep.stop();
+    });
+
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+    EXPECT_FALSE(connected);
+    EXPECT_TRUE(disconnected);
+    EXPECT_GE(disconnected_at - start, std::chrono::milliseconds(50));
+}
+
+TEST(client_socket, connect_destroy01)
+{
+    epoll ep;
+    std::vector<client_socket> accepted;
+    server_socket ss(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), [&] {
+        accepted.push_back(ss.accept([] {}));
+    });
+
+    // the socket is destroyed in on_connected, the handlers installed
+    // before must not be called afterwards
+    size_t connected = 0;
+    size_t other_calls = 0;
+    std::unique_ptr<client_socket> s;
+    s.reset(new client_socket(client_socket::connect(ep, ss.local_endpoint(), std::chrono::milliseconds(50), [&] {
+        std::unique_ptr<client_socket>& self = s;
+        ++connected;
+        self.reset();
+    }, [&] {
+        ++other_calls;
+    })));
+    s->set_on_read_write([&] { ++other_calls; }, [&] { ++other_calls; });
+
+    // longer than the connect timeout, which must be gone as well
+    run_for(ep, std::chrono::milliseconds(100));
+    EXPECT_EQ(connected, 1u);
+    EXPECT_EQ(other_calls, 0u);
+    EXPECT_FALSE(s);
+}
+
+namespace
+{
+    // a TCP connection over loopback with zerocopy enabled on the client,
+    // the accepted side is returned as a plain descriptor; null when the
+    // kernel has no SO_ZEROCOPY
+    std::unique_ptr<client_socket> make_zerocopy_connection(epoll& ep, file_descriptor& peer)
+    {
+        server_socket ss(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")), [] {});
+        std::unique_ptr<client_socket> c(new client_socket(client_socket::connect(ep, ss.local_endpoint(), [] {})));
+        int fd = ::accept4(ss.duplicate().getfd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        EXPECT_NE(fd, -1);
+        peer.reset(fd);
+        if (!c->set_zerocopy(1))
+        {
+            std::cerr << "SO_ZEROCOPY is not supported, skipped" << std::endl;
+            return nullptr;
+        }
+        return c;
+    }
+
+    // the stream the zerocopy tests send
+    std::string const& data()
+    {
+        static std::string const result = [] {
+            std::string result(32 << 20, '\0');
+            for (size_t i = 0; i != result.size(); ++i)
+                result[i] = static_cast<char>('a' + i % 26);
+            return result;
+        }();
+        return result;
+    }
+
+    // writes the start of data() until the connection is full, then reads
+    // a megabyte on the other side; returns the number of bytes written
+    size_t fill_connection(client_socket& c, file_descriptor& peer)
+    {
+        size_t offset = 0;
+        while (size_t written = c.write_some(data().data() + offset, 65536))
+            offset += written;
+
+        std::string received;
+        char buf[65536];
+        while (received.size() < (1 << 20))
+        {
+            ssize_t res = ::read(peer.getfd(), buf, std::min(sizeof buf, (1 << 20) - received.size()));
+            if (res > 0)
+                received.append(buf, res);
+        }
+        return offset;
+    }
+}
+
+TEST(zerocopy_graveyard, release01)
+{
+    epoll ep;
+    file_descriptor peer;
+    std::unique_ptr<client_socket> c = make_zerocopy_connection(ep, peer);
+    if (!c)
+        return;
+
+    // the connection is filled with copied data, the peer makes some
+    // room and stops reading, the zerocopy send that follows stays
+    // unacknowledged when the socket is destroyed
+    size_t offset = fill_connection(*c, peer);
+    c->queue_output(data().substr(offset, 4 << 20));
+    c->flush_output();
+    c.reset();
+    EXPECT_EQ(ep.get_zerocopy_graveyard().size(), 1u);
+
+    // everything sent arrives intact, followed by the end of the stream
+    std::string received;
+    epoll_registration reg(ep, peer.getfd(), EPOLLIN, [&](uint32_t) {
+        char buf[65536];
+        ssize_t res = ::read(peer.getfd(), buf, sizeof buf);
+        if (res > 0)
+            received.append(buf, res);
+        else if (res == 0)
+            ep.stop();
+    });
+    deadline d(ep, std::chrono::seconds(5));
+    ep.run();
+    EXPECT_FALSE(d.expired);
+    EXPECT_GT(received.size() + (1 << 20), offset);
+    EXPECT_TRUE(received == data().substr(1 << 20, received.size()));
+
+    // the completions follow the acknowledgements
+    reg.clear();
+    deadline d2(ep, std::chrono::seconds(5));
+    timer_element poll;
+    poll.set_callback([&] {
+        if (ep.get_zerocopy_graveyard().size() == 0)
+            ep.stop();
+        else
+            poll.restart(ep.get_timer(), std::chrono::milliseconds(1));
+    });
+    poll.restart(ep.get_timer(), std::chrono::milliseconds(1));
+    ep.run();
+    EXPECT_FALSE(d2.expired);
+}
+
+TEST(zerocopy_graveyard, release02)
+{
+    // sockets still waiting are reset when the loop is destroyed
+    epoll ep;
+    file_descriptor peer;
+    std::unique_ptr<client_socket> c = make_zerocopy_connection(ep, peer);
+    if (!c)
+        return;
+
+    size_t offset = fill_connection(*c, peer);
+    c->queue_output(data().substr(offset, 4 << 20));
+    c->flush_output();
+    c.reset();
+    EXPECT_EQ(ep.get_zerocopy_graveyard().size(), 1u);
+}
@@ -1,75 +1,360 @@
 #include "timer.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
+#include "loop_stats.h"
+
+namespace
+{
+    uint64_t to_nanoseconds(timer::clock_t::duration d)
+    {
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        return ns < 0 ? 0 : static_cast<uint64_t>(ns);
+    }
+}
+
+unsigned const timer::tick_bits;
+unsigned const timer::level_bits;
+unsigned const timer::number_of_levels;
+unsigned const timer::slots_per_level;
+
 timer::timer()
+    : cached_now(clock_t::now())
+    , current_tick(to_ticks(cached_now))
+    , size(0)
+    , occupied()
+    , stats(nullptr)
 {}
 
+timer::~timer()
+{
+    // detach the remaining elements so their destructors don't touch us
+    for (unsigned level = 0; level != number_of_levels; ++level)
+    {
+        for (unsigned slot = 0; slot != slots_per_level; ++slot)
+        {
+            slot_t& s = slots[level][slot];
+            while (!s.empty())
+            {
+                s.front().t = nullptr;
+                s.pop_front();
+            }
+        }
+    }
+
+    while (!overflow.empty())
+    {
+        overflow.front().t = nullptr;
+        overflow.pop_front();
+    }
+
+    while (!fixed_lists.empty())
+    {
+        fixed_lists.front().t = nullptr;
+        fixed_lists.pop_front();
+    }
+}
+
 void timer::add(timer_element* e)
 {
-    queue.insert(value_t(e->wakeup, e));
+    place(e);
+    ++size;
 }
 
 void timer::remove(timer_element *e)
 {
-    auto i = queue.find(value_t(e->wakeup, e));
-    assert(i != queue.end());
-    queue.erase(i);
+    assert(e->is_linked());
+    unlink(e);
+    --size;
 }
 
 bool timer::empty() const
 {
-    return queue.empty();
+    if (size != 0)
+        return false;
+
+    for (fixed_timeout_list& list : const_cast<intrusive_list<fixed_timeout_list>&>(fixed_lists))
+        if (!list.queue.empty())
+            return false;
+
+    return true;
 }
 
 timer::clock_t::time_point timer::top() const
 {
     assert(!empty());
-    return queue.begin()->first;
+
+    clock_t::time_point result = clock_t::time_point::max();
+    for (fixed_timeout_list& list : const_cast<intrusive_list<fixed_timeout_list>&>(fixed_lists))
+        if (!list.queue.empty() && list.queue.front().wakeup < result)
+            result = list.queue.front().wakeup;
+
+    if (size == 0)
+        return result;
+
+    // the first occupied slot of level 0 holds the earliest elements,
+    // elements on higher levels are not sorted, the start of their slot
+    // is returned instead; waking up there cascades them down
+    uint64_t current_slot = current_tick & (slots_per_level - 1);
+    uint64_t mask = occupied[0] & (~uint64_t(0) << current_slot);
+    if (mask != 0)
+    {
+        slot_t& s = const_cast<slot_t&>(slots[0][__builtin_ctzll(mask)]);
+        assert(!s.empty());
+        for (timer_element& e : s)
+            if (e.wakeup < result)
+                result = e.wakeup;
+        return result;
+    }
+
+    return std::min(result, from_ticks(next_event_tick()));
 }
 
 void timer::notify(clock_t::time_point now)
 {
+    cached_now = now;
+
+    uint64_t target = to_ticks(now);
+    if (target < current_tick)
+        target = current_tick;
+
     for (;;)
     {
-        if (queue.empty())
-            break;
+        run_due(now, current_tick != target);
 
-        auto i = queue.begin();
-        if (i->first > now)
+        if (current_tick == target)
             break;
 
-        i->second->t = nullptr;
-        try
+        uint64_t next = next_event_tick();
+        current_tick = next < target ? next : target;
+        cascade();
+    }
+
+    for (auto i = fixed_lists.begin(); i != fixed_lists.end();)
+        run_due(*i++, now);
+}
+
+timer::clock_t::time_point timer::now() const
+{
+    return cached_now;
+}
+
+timer::clock_t::time_point timer::update_now()
+{
+    cached_now = clock_t::now();
+    return cached_now;
+}
+
+uint64_t timer::to_ticks(clock_t::time_point t)
+{
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    return ns < 0 ? 0 : static_cast<uint64_t>(ns) >> tick_bits;
+}
+
+timer::clock_t::time_point timer::from_ticks(uint64_t ticks)
+{
+    if (ticks >= (uint64_t(1) << (63 - tick_bits)))
+        return clock_t::time_point::max();
+
+    std::chrono::nanoseconds ns(static_cast<int64_t>(ticks << tick_bits));
+    return clock_t::time_point(std::chrono::duration_cast<clock_t::duration>(ns));
+}
+
+void timer::place(timer_element* e)
+{
+    uint64_t ticks = to_ticks(e->wakeup);
+    if (ticks < current_tick)
+        ticks = current_tick;
+
+    // the highest bit in which the deadline differs from the current
+    // tick selects the level, the slot index at that level is then
+    // always ahead of the current one
+    uint64_t diff = ticks ^ current_tick;
+    unsigned level = diff == 0 ? 0 : (63 - __builtin_clzll(diff)) / level_bits;
+    if (level >= number_of_levels)
+    {
+        e->level = number_of_levels;
+        e->slot = 0;
+        overflow.push_back(*e);
+        return;
+    }
+
+    unsigned slot = (ticks >> (level * level_bits)) & (slots_per_level - 1);
+    e->level = level;
+    e->slot = slot;
+    slots[level][slot].push_back(*e);
+    occupied[level] |= uint64_t(1) << slot;
+}
+
+void timer::unlink(timer_element* e)
+{
+    e->unlink();
+    if (e->level < number_of_levels && slots[e->level][e->slot].empty())
+        occupied[e->level] &= ~(uint64_t(1) << e->slot);
+}
+
+uint64_t timer::next_event_tick() const
+{
+    // slots of a lower level lie within the current slot of the higher
+    // one, so the first occupied slot found bottom-up is the earliest
+    for (unsigned level = 0; level != number_of_levels; ++level)
+    {
+        unsigned shift = level * level_bits;
+        uint64_t current_slot = (current_tick >> shift) & (slots_per_level - 1);
+        uint64_t mask = current_slot == slots_per_level - 1
+                            ? 0
+                            : occupied[level] & (~uint64_t(0) << (current_slot + 1));
+        if (mask != 0)
+        {
+            uint64_t base = current_tick >> (shift + level_bits) << (shift + level_bits);
+            return base | (uint64_t(__builtin_ctzll(mask)) << shift);
+        }
+    }
+
+    if (!overflow.empty())
+    {
+        unsigned shift = number_of_levels * level_bits;
+        return ((current_tick >> shift) + 1) << shift;
+    }
+
+    return ~uint64_t(0);
+}
+
+void timer::cascade()
+{
+    for (unsigned level = number_of_levels; level != 0; --level)
+    {
+        unsigned shift = level * level_bits;
+        if ((current_tick & ((uint64_t(1) << shift) - 1)) != 0)
+            continue;
+
+        slot_t* s;
+        if (level == number_of_levels)
         {
-            i->second->callback();
+            s = &overflow;
         }
-        catch (std::exception const& e)
+        else
         {
-            std::cerr << "error: " << e.what() << std::endl;
+            unsigned slot = (current_tick >> shift) & (slots_per_level - 1);
+            s = &slots[level][slot];
+            occupied[level] &= ~(uint64_t(1) << slot);
         }
-        catch (...)
+
+        while (!s->empty())
         {
-            std::cerr << "unknown exception in timer::notify()" << std::endl;
+            timer_element& e = s->front();
+            s->pop_front();
+            place(&e);
         }
+    }
+}
+
+void timer::run_due(clock_t::time_point now, bool all)
+{
+    unsigned slot = current_tick & (slots_per_level - 1);
+    slot_t& s = slots[0][slot];
+    if (s.empty())
+        return;
+
+    // elements re-added by the callbacks wait for the next notify
+    slot_t due;
+    for (auto i = s.begin(); i != s.end();)
+    {
+        timer_element& e = *i++;
+        if (!all && e.wakeup > now)
+            continue;
 
-        queue.erase(i);
+        e.unlink();
+        e.level = number_of_levels + 1;
+        due.push_back(e);
     }
+
+    if (s.empty())
+        occupied[0] &= ~(uint64_t(1) << slot);
+
+    while (!due.empty())
+    {
+        timer_element& e = due.front();
+        due.pop_front();
+        --size;
+        e.t = nullptr;
+        run_callback(e.callback, e.wakeup);
+    }
+}
+
+void timer::run_due(fixed_timeout_list& list, clock_t::time_point now)
+{
+    if (list.queue.empty() || list.queue.front().wakeup > now)
+        return;
+
+    // elements re-armed by the callbacks wait for the next notify
+    intrusive_list<fixed_timeout_element> due;
+    while (!list.queue.empty() && list.queue.front().wakeup <= now)
+    {
+        fixed_timeout_element& e = list.queue.front();
+        list.queue.pop_front();
+        due.push_back(e);
+    }
+
+    while (!due.empty())
+    {
+        fixed_timeout_element& e = due.front();
+        due.pop_front();
+        run_callback(e.callback, e.wakeup);
+    }
+}
+
+void timer::run_callback(small_function<void ()>& callback, clock_t::time_point wakeup)
+{
+    clock_t::time_point started;
+    if (stats)
+    {
+        started = clock_t::now();
+        stats->timer_lateness.record(to_nanoseconds(started - wakeup));
+    }
+
+    try
+    {
+        callback();
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+    }
+    catch (...)
+    {
+        std::cerr << "unknown exception in timer::notify()" << std::endl;
+    }
+
+    if (stats)
+        stats->record_callback(to_nanoseconds(clock_t::now() - started), -1);
+}
+
+void timer::set_stats(loop_stats* stats)
+{
+    this->stats = stats;
 }
 
 timer_element::timer_element()
     : t(nullptr)
+    , level()
+    , slot()
 {}
 
 timer_element::timer_element(timer_element::callback_t callback)
     : t(nullptr)
+    , level()
+    , slot()
     , callback(std::move(callback))
 {}
 
 timer_element::timer_element(timer& t, clock_t::duration interval, callback_t callback)
     : t(&t)
-    , wakeup(clock_t::now() + interval)
+    , wakeup(t.now() + interval)
+    , level()
+    , slot()
     , callback(std::move(callback))
 {
     t.add(this);
@@ -78,6 +363,8 @@ timer_element::timer_element(timer& t, clock_t::duration interval, callback_t ca
 timer_element::timer_element(timer& t, clock_t::time_point wakeup, callback_t callback)
     : t(&t)
     , wakeup(wakeup)
+    , level()
+    , slot()
     , callback(std::move(callback))
 {
     t.add(this);
@@ -99,14 +386,69 @@ void timer_element::restart(timer& t, clock_t::duration interval)
     if (this->t)
         this->t->remove(this);
     this->t = &t;
-    this->wakeup = clock_t::now() + interval;
+    this->wakeup = t.now() + interval;
     this->t->add(this);
 }
 
 void timer_element::restart(timer& t, clock_t::time_point wakeup)
 {
-    this->t->remove(this);
+    if (this->t)
+        this->t->remove(this);
     this->t = &t;
     this->wakeup = wakeup;
     this->t->add(this);
 }
+
+fixed_timeout_list::fixed_timeout_list(timer& t, clock_t::duration timeout)
+    : t(&t)
+    , timeout(timeout)
+{
+    t.fixed_lists.push_back(*this);
+}
+
+fixed_timeout_list::~fixed_timeout_list()
+{
+    queue.clear();
+
+    if (t)
+        unlink();
+}
+
+fixed_timeout_list::clock_t::duration fixed_timeout_list::get_timeout() const
+{
+    return timeout;
+}
+
+fixed_timeout_element::fixed_timeout_element()
+{}
+
+fixed_timeout_element::fixed_timeout_element(callback_t callback)
+    : callback(std::move(callback))
+{}
+
+fixed_timeout_element::fixed_timeout_element(fixed_timeout_list& list, callback_t callback)
+    : callback(std::move(callback))
+{
+    restart(list);
+}
+
+fixed_timeout_element::~fixed_timeout_element()
+{
+    if (is_linked())
+        unlink();
+}
+
+void fixed_timeout_element::set_callback(callback_t callback)
+{
+    this->callback = std::move(callback);
+}
+
+void fixed_timeout_element::restart(fixed_timeout_list& list)
+{
+    assert(list.t);
+
+    if (is_linked())
+        unlink();
+    wakeup = list.t->now() + list.timeout;
+    list.queue.push_back(*this);
+}
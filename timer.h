@@ -2,34 +2,81 @@
 #define TIMER_H
 
 #include <cstdint>
-#include <functional>
-#include <set>
 #include <chrono>
 
+#include "intrusive_list.h"
+#include "small_function.h"
+
 struct timer_element;
+struct fixed_timeout_list;
+struct loop_stats;
 
+// Hierarchical timing wheel: levels of 64 slots each, a slot on level L
+// spans 64^L ticks. add and remove are O(1), notify cascades elements
+// from higher levels down as time passes their slot boundaries.
 struct timer
 {
     typedef std::chrono::steady_clock clock_t;
 
     timer();
+    timer(timer const&) = delete;
+    timer& operator=(timer const&) = delete;
+    ~timer();
 
     void add(timer_element* e);
     void remove(timer_element* e);
 
     bool empty() const;
     clock_t::time_point top() const;
+    // also makes now the cached current time
     void notify(clock_t::time_point now);
 
+    // cached current time, relative intervals of the elements are counted
+    // from it; it is updated by notify() and update_now()
+    clock_t::time_point now() const;
+    // reads the clock and updates the cached time
+    clock_t::time_point update_now();
+
+    // records lateness and duration of the callbacks, nullptr disables
+    void set_stats(loop_stats* stats);
+
+    static unsigned const tick_bits = 10;
+    static unsigned const level_bits = 6;
+    static unsigned const number_of_levels = 7;
+    static unsigned const slots_per_level = 1u << level_bits;
+
 private:
-    typedef std::pair<clock_t::time_point, timer_element*> value_t;
-    std::set<value_t> queue;
+    typedef intrusive_list<timer_element> slot_t;
+
+    static uint64_t to_ticks(clock_t::time_point t);
+    static clock_t::time_point from_ticks(uint64_t ticks);
+
+    void place(timer_element* e);
+    void unlink(timer_element* e);
+    uint64_t next_event_tick() const;
+    void cascade();
+    void run_due(clock_t::time_point now, bool all);
+    void run_due(fixed_timeout_list& list, clock_t::time_point now);
+    void run_callback(small_function<void ()>& callback, clock_t::time_point wakeup);
+
+private:
+    clock_t::time_point cached_now;
+    uint64_t current_tick;
+    size_t size;
+    uint64_t occupied[number_of_levels];
+    slot_t slots[number_of_levels][slots_per_level];
+    // elements beyond the range of the top level
+    slot_t overflow;
+    intrusive_list<fixed_timeout_list> fixed_lists;
+    loop_stats* stats;
+
+    friend struct fixed_timeout_list;
 };
 
-struct timer_element
+struct timer_element : intrusive_list_element<>
 {
     typedef timer::clock_t clock_t;
-    typedef std::function<void ()> callback_t;
+    typedef small_function<void ()> callback_t;
 
     timer_element();
     timer_element(callback_t callback);
@@ -46,10 +93,61 @@ struct timer_element
 private:
     timer* t;
     clock_t::time_point wakeup;
-    uint64_t wakeup_time_point;
+    uint8_t level;
+    uint8_t slot;
+    callback_t callback;
+
+    friend struct timer;
+};
+
+struct fixed_timeout_element;
+
+// FIFO of elements that are all armed with the same timeout. Expiry order
+// equals arming order, so restarting an element is an O(1) move to the
+// back and the timer only looks at the head. Suits idle timeouts that
+// are the same for every connection.
+struct fixed_timeout_list : intrusive_list_element<>
+{
+    typedef timer::clock_t clock_t;
+
+    fixed_timeout_list(timer& t, clock_t::duration timeout);
+    fixed_timeout_list(fixed_timeout_list const&) = delete;
+    fixed_timeout_list& operator=(fixed_timeout_list const&) = delete;
+    ~fixed_timeout_list();
+
+    clock_t::duration get_timeout() const;
+
+private:
+    timer* t;
+    clock_t::duration timeout;
+    intrusive_list<fixed_timeout_element> queue;
+
+    friend struct timer;
+    friend struct fixed_timeout_element;
+};
+
+struct fixed_timeout_element : intrusive_list_element<>
+{
+    typedef timer::clock_t clock_t;
+    typedef small_function<void ()> callback_t;
+
+    fixed_timeout_element();
+    fixed_timeout_element(callback_t callback);
+    fixed_timeout_element(fixed_timeout_list& list, callback_t callback);
+    fixed_timeout_element(fixed_timeout_element const&) = delete;
+    fixed_timeout_element& operator=(fixed_timeout_element const&) = delete;
+    ~fixed_timeout_element();
+
+    void set_callback(callback_t callback);
+    // arms the element to fire list.get_timeout() from now
+    void restart(fixed_timeout_list& list);
+
+private:
+    clock_t::time_point wakeup;
     callback_t callback;
 
     friend struct timer;
+    friend struct fixed_timeout_list;
 };
 
 #endif // TIMER_H
@@ -0,0 +1,231 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+#include "timer.h"
+
+namespace
+{
+    typedef timer::clock_t test_clock;
+
+    // runs the timer by waking up at top() like the event loop does
+    void run_to_completion(timer& t, std::vector<size_t>& fired, std::vector<test_clock::time_point>& fired_at)
+    {
+        while (!t.empty())
+        {
+            test_clock::time_point now = t.top();
+            size_t before = fired.size();
+            t.notify(now);
+            for (size_t i = before; i != fired.size(); ++i)
+                fired_at.push_back(now);
+        }
+    }
+}
+
+TEST(timer, empty01)
+{
+    timer t;
+    EXPECT_TRUE(t.empty());
+    t.notify(test_clock::now() + std::chrono::hours(1));
+    EXPECT_TRUE(t.empty());
+}
+
+TEST(timer, fires_in_order01)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int64_t> exponent(0, 42);
+
+    timer t;
+    test_clock::time_point base = test_clock::now();
+    size_t const n = 2000;
+
+    std::vector<test_clock::time_point> deadlines;
+    std::vector<size_t> fired;
+    std::vector<test_clock::time_point> fired_at;
+    std::vector<std::unique_ptr<timer_element>> elements;
+    for (size_t i = 0; i != n; ++i)
+    {
+        int64_t ns = int64_t(1) << exponent(rng);
+        ns += std::uniform_int_distribution<int64_t>(0, ns)(rng);
+        deadlines.push_back(base + std::chrono::nanoseconds(ns));
+        elements.emplace_back(new timer_element(t, deadlines.back(), [&fired, i] {
+            fired.push_back(i);
+        }));
+    }
+
+    run_to_completion(t, fired, fired_at);
+
+    ASSERT_EQ(fired.size(), n);
+    for (size_t i = 0; i != n; ++i)
+    {
+        EXPECT_GE(fired_at[i], deadlines[fired[i]]);
+        // elements within one tick fire in insertion order
+        if (i != 0)
+        {
+            EXPECT_LT(deadlines[fired[i - 1]],
+                      deadlines[fired[i]] + std::chrono::nanoseconds(1 << timer::tick_bits));
+        }
+    }
+}
+
+TEST(timer, top_is_not_late01)
+{
+    timer t;
+    test_clock::time_point base = test_clock::now();
+    test_clock::duration intervals[] = {std::chrono::microseconds(3),
+                                     std::chrono::milliseconds(15),
+                                     std::chrono::seconds(15),
+                                     std::chrono::hours(30)};
+    for (test_clock::duration d : intervals)
+    {
+        timer_element e(t, base + d, [] {});
+        EXPECT_LE(t.top(), base + d);
+    }
+    EXPECT_TRUE(t.empty());
+}
+
+TEST(timer, remove01)
+{
+    timer t;
+    test_clock::time_point base = test_clock::now();
+    bool fired_a = false;
+    bool fired_b = false;
+    timer_element a(t, base + std::chrono::milliseconds(5), [&] { fired_a = true; });
+    {
+        timer_element b(t, base + std::chrono::milliseconds(5), [&] { fired_b = true; });
+    }
+    t.notify(base + std::chrono::seconds(1));
+    EXPECT_TRUE(fired_a);
+    EXPECT_FALSE(fired_b);
+    EXPECT_TRUE(t.empty());
+}
+
+TEST(timer, remove_from_callback01)
+{
+    timer t;
+    test_clock::time_point base = test_clock::now();
+    std::unique_ptr<timer_element> b;
+    timer_element a(t, base + std::chrono::milliseconds(1), [&] { b.reset(); });
+    b.reset(new timer_element(t, base + std::chrono::milliseconds(1), [] { FAIL(); }));
+    t.notify(base + std::chrono::milliseconds(2));
+    EXPECT_FALSE(b);
+    EXPECT_TRUE(t.empty());
+}
+
+TEST(timer, restart01)
+{
+    timer t;
+    test_clock::time_point base = test_clock::now();
+    int fired = 0;
+    timer_element e([&] { ++fired; });
+    e.restart(t, base + std::chrono::seconds(10));
+    e.restart(t, base + std::chrono::milliseconds(10));
+    t.notify(base + std::chrono::milliseconds(20));
+    EXPECT_EQ(fired, 1);
+    EXPECT_TRUE(t.empty());
+}
+
+TEST(timer, readd_from_callback01)
+{
+    timer t;
+    test_clock::time_point base = test_clock::now();
+    int fired = 0;
+    timer_element e;
+    e.set_callback([&] {
+        ++fired;
+        e.restart(t, base);
+    });
+    e.restart(t, base);
+    t.notify(base);
+    EXPECT_EQ(fired, 1);
+    t.notify(base);
+    EXPECT_EQ(fired, 2);
+}
+
+TEST(timer, not_fired_early01)
+{
+    timer t;
+    test_clock::time_point base = test_clock::now();
+    bool fired = false;
+    timer_element e(t, base + std::chrono::nanoseconds(100), [&] { fired = true; });
+    t.notify(base + std::chrono::nanoseconds(99));
+    EXPECT_FALSE(fired);
+    t.notify(base + std::chrono::nanoseconds(100));
+    EXPECT_TRUE(fired);
+}
+
+TEST(timer, outlives_timer01)
+{
+    std::unique_ptr<timer> t(new timer());
+    timer_element e(*t, std::chrono::seconds(1), [] {});
+    timer_element far(*t, std::chrono::hours(24 * 365), [] {});
+    t.reset();
+}
+
+TEST(timer, cached_now01)
+{
+    timer t;
+    test_clock::time_point base = t.now();
+    test_clock::time_point later = base + std::chrono::seconds(100);
+    t.notify(later);
+    EXPECT_EQ(t.now(), later);
+
+    timer_element e(t, std::chrono::seconds(1), [] {});
+    EXPECT_LE(t.top(), later + std::chrono::seconds(1));
+    EXPECT_GT(t.top(), later);
+
+    EXPECT_GE(t.update_now(), base);
+}
+
+TEST(fixed_timeout_list, fifo01)
+{
+    timer t;
+    fixed_timeout_list list(t, std::chrono::seconds(15));
+    EXPECT_TRUE(t.empty());
+
+    std::vector<int> fired;
+    test_clock::time_point base = t.now();
+    fixed_timeout_element a(list, [&] { fired.push_back(0); });
+    t.notify(base + std::chrono::seconds(1));
+    fixed_timeout_element b(list, [&] { fired.push_back(1); });
+    t.notify(base + std::chrono::seconds(2));
+    a.restart(list);
+    EXPECT_FALSE(t.empty());
+    EXPECT_EQ(t.top(), base + std::chrono::seconds(16));
+
+    t.notify(base + std::chrono::seconds(16));
+    EXPECT_EQ(fired, std::vector<int>({1}));
+    t.notify(base + std::chrono::seconds(17));
+    EXPECT_EQ(fired, std::vector<int>({1, 0}));
+    EXPECT_TRUE(t.empty());
+}
+
+TEST(fixed_timeout_list, mixed_with_wheel01)
+{
+    timer t;
+    fixed_timeout_list list(t, std::chrono::seconds(15));
+    test_clock::time_point base = t.now();
+    std::vector<int> fired;
+    fixed_timeout_element a(list, [&] { fired.push_back(0); });
+    timer_element b(t, base + std::chrono::seconds(10), [&] { fired.push_back(1); });
+    while (!t.empty())
+        t.notify(t.top());
+    EXPECT_EQ(fired, std::vector<int>({1, 0}));
+}
+
+TEST(fixed_timeout_list, destroy01)
+{
+    timer t;
+    bool fired = false;
+    {
+        fixed_timeout_list list(t, std::chrono::seconds(1));
+        fixed_timeout_element e(list, [&] { fired = true; });
+        {
+            fixed_timeout_element f(list, [&] { fired = true; });
+        }
+    }
+    EXPECT_TRUE(t.empty());
+    t.notify(t.now() + std::chrono::seconds(2));
+    EXPECT_FALSE(fired);
+}
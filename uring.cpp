@@ -0,0 +1,316 @@
+#include "uring.h"
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#include "throw_error.h"
+
+using namespace sysapi;
+
+namespace
+{
+    // completions with this user_data (POLL_REMOVE requests) are ignored
+    uint64_t const ignored_user_data = 0;
+
+    uint32_t const poll_mask = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLPRI | EPOLLERR | EPOLLHUP;
+
+    int io_uring_setup(unsigned entries, io_uring_params* p)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void const* arg, size_t arg_size)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size));
+    }
+
+    void* map_ring(int fd, size_t size, uint64_t offset)
+    {
+        void* res = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if (res == MAP_FAILED)
+            throw_error(errno, "mmap(io_uring)");
+        return res;
+    }
+
+    template <typename T>
+    T* ring_field(void* ring, uint32_t offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+
+    uint64_t make_user_data(int fd, uint32_t generation)
+    {
+        return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+    }
+}
+
+uring_poller::uring_poller(unsigned entries)
+    : sq_ring_()
+    , sq_ring_size_()
+    , cq_ring_()
+    , cq_ring_size_()
+    , sqes_()
+    , sqes_size_()
+{
+    io_uring_params params{};
+    int r = io_uring_setup(entries, &params);
+    if (r == -1)
+        throw_error(errno, "io_uring_setup()");
+
+    fd_.reset(r);
+
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+        throw std::runtime_error("io_uring backend requires IORING_FEAT_EXT_ARG (linux 5.11)");
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        cq_ring_size_ = 0;
+    }
+
+    try
+    {
+        sq_ring_ = map_ring(fd_.getfd(), sq_ring_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = cq_ring_size_ != 0 ? map_ring(fd_.getfd(), cq_ring_size_, IORING_OFF_CQ_RING) : sq_ring_;
+
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map_ring(fd_.getfd(), sqes_size_, IORING_OFF_SQES));
+    }
+    catch (...)
+    {
+        if (cq_ring_ && cq_ring_size_ != 0)
+            ::munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_)
+            ::munmap(sq_ring_, sq_ring_size_);
+        throw;
+    }
+
+    sq_head_ = ring_field<unsigned>(sq_ring_, params.sq_off.head);
+    sq_tail_ = ring_field<unsigned>(sq_ring_, params.sq_off.tail);
+    sq_mask_ = *ring_field<unsigned>(sq_ring_, params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+
+    // submission queue entries are always used in order, the index
+    // array is an identity mapping
+    unsigned* sq_array = ring_field<unsigned>(sq_ring_, params.sq_off.array);
+    for (unsigned i = 0; i != sq_entries_; ++i)
+        sq_array[i] = i;
+
+    cq_head_ = ring_field<unsigned>(cq_ring_, params.cq_off.head);
+    cq_tail_ = ring_field<unsigned>(cq_ring_, params.cq_off.tail);
+    cq_mask_ = *ring_field<unsigned>(cq_ring_, params.cq_off.ring_mask);
+    cqes_ = ring_field<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+}
+
+uring_poller::~uring_poller()
+{
+    ::munmap(sqes_, sqes_size_);
+    if (cq_ring_size_ != 0)
+        ::munmap(cq_ring_, cq_ring_size_);
+    ::munmap(sq_ring_, sq_ring_size_);
+}
+
+void uring_poller::add(int fd, uint32_t events, void* ptr)
+{
+    slot& s = get_slot(fd);
+    if (s.registered)
+        throw_error(EEXIST, "io_uring poll add");
+
+    s.ptr = ptr;
+    s.events = events;
+    s.armed = false;
+    s.registered = true;
+    arm(fd, s);
+}
+
+void uring_poller::modify(int fd, uint32_t events, void* ptr)
+{
+    slot& s = get_slot(fd);
+    if (!s.registered)
+        throw_error(ENOENT, "io_uring poll modify");
+
+    // the old request is cancelled and a new one is submitted, this also
+    // reevaluates the readiness just like EPOLL_CTL_MOD
+    disarm(fd, s);
+    s.ptr = ptr;
+    s.events = events;
+    arm(fd, s);
+}
+
+void uring_poller::remove(int fd)
+{
+    slot& s = get_slot(fd);
+    if (!s.registered)
+        throw_error(ENOENT, "io_uring poll remove");
+
+    disarm(fd, s);
+    s.ptr = nullptr;
+    s.events = 0;
+    s.registered = false;
+}
+
+size_t uring_poller::wait(epoll_event* events, size_t max_events, timespec const* timeout)
+{
+    for (int fd : rearm_)
+    {
+        slot& s = slots_[fd];
+        if (s.registered && !s.armed)
+            arm(fd, s);
+    }
+    rearm_.clear();
+
+    if (completions_ready())
+        enter(pending_submissions(), 0, nullptr);
+    else
+        enter(pending_submissions(), 1, timeout);
+
+    size_t num_events = 0;
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+    for (; head != tail && num_events != max_events; ++head)
+    {
+        io_uring_cqe const& cqe = cqes_[head & cq_mask_];
+        if (cqe.user_data == ignored_user_data)
+            continue;
+
+        int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+        uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 32);
+
+        if (fd < 0 || static_cast<size_t>(fd) >= slots_.size())
+            continue;
+
+        slot& s = slots_[fd];
+        // completion of a request that was cancelled or replaced
+        if (!s.registered || s.generation != generation)
+            continue;
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            s.armed = false;
+            rearm_.push_back(fd);
+        }
+
+        if (cqe.res == -ECANCELED)
+            continue;
+
+        epoll_event& ev = events[num_events++];
+        ev.events = cqe.res < 0 ? EPOLLERR : (static_cast<uint32_t>(cqe.res) & poll_mask);
+        ev.data.ptr = s.ptr;
+    }
+
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return num_events;
+}
+
+uring_poller::slot& uring_poller::get_slot(int fd)
+{
+    assert(fd >= 0);
+    size_t index = static_cast<size_t>(fd);
+    if (index >= slots_.size())
+        slots_.resize(index + 1, slot{nullptr, 1, 0, false, false});
+
+    return slots_[index];
+}
+
+void uring_poller::arm(int fd, slot& s)
+{
+    assert(!s.armed);
+
+    uint32_t mask = s.events & poll_mask;
+    if (mask == 0)
+        return;
+
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = mask;
+    sqe->len = (s.events & EPOLLET) ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = make_user_data(fd, s.generation);
+    s.armed = true;
+}
+
+void uring_poller::disarm(int fd, slot& s)
+{
+    if (s.armed)
+    {
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = make_user_data(fd, s.generation);
+        sqe->user_data = ignored_user_data;
+        s.armed = false;
+    }
+
+    // completions of the old request that are already in flight
+    // are recognized by the generation
+    ++s.generation;
+    if (s.generation == 0)
+        ++s.generation;
+}
+
+io_uring_sqe* uring_poller::get_sqe()
+{
+    if (pending_submissions() == sq_entries_)
+        enter(pending_submissions(), 0, nullptr);
+
+    assert(pending_submissions() < sq_entries_);
+
+    io_uring_sqe* sqe = &sqes_[sq_local_tail_ & sq_mask_];
+    *sqe = io_uring_sqe{};
+    ++sq_local_tail_;
+    return sqe;
+}
+
+unsigned uring_poller::pending_submissions() const
+{
+    return sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+bool uring_poller::completions_ready() const
+{
+    return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+}
+
+void uring_poller::enter(unsigned to_submit, unsigned min_complete, timespec const* timeout)
+{
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+    if (to_submit == 0 && min_complete == 0)
+        return;
+
+    unsigned flags = 0;
+    if (min_complete != 0)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    io_uring_getevents_arg arg{};
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<uint64_t>(timeout);
+    flags |= IORING_ENTER_EXT_ARG;
+
+    int r = io_uring_enter(fd_.getfd(), to_submit, min_complete, flags, &arg, sizeof arg);
+    if (r < 0)
+    {
+        int err = errno;
+
+        // ETIME: timeout expired, EBUSY: completion queue overflowed and
+        // has to be reaped before anything else can be submitted
+        if (err == EINTR || err == ETIME || err == EBUSY)
+            return;
+
+        throw_error(err, "io_uring_enter()");
+    }
+}
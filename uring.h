@@ -0,0 +1,82 @@
+#ifndef URING_H
+#define URING_H
+
+#include "file_descriptor.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+struct epoll_event;
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct timespec;
+
+namespace sysapi
+{
+    // readiness polling on top of io_uring with the interface of epoll_ctl/
+    // epoll_wait. Requests are queued in the submission ring and submitted
+    // together with the wait, one io_uring_enter per loop iteration.
+    //
+    // EPOLLET registrations use multishot poll, level-triggered ones use
+    // single shot poll that is rearmed after each completion.
+    struct uring_poller
+    {
+        explicit uring_poller(unsigned entries);
+        uring_poller(uring_poller const&) = delete;
+        uring_poller& operator=(uring_poller const&) = delete;
+        ~uring_poller();
+
+        void add(int fd, uint32_t events, void* ptr);
+        void modify(int fd, uint32_t events, void* ptr);
+        void remove(int fd);
+
+        // timeout == nullptr waits indefinitely
+        size_t wait(epoll_event* events, size_t max_events, timespec const* timeout);
+
+    private:
+        struct slot
+        {
+            void* ptr;
+            uint32_t generation;
+            uint32_t events;
+            bool armed;
+            bool registered;
+        };
+
+        slot& get_slot(int fd);
+        void arm(int fd, slot& s);
+        void disarm(int fd, slot& s);
+
+        io_uring_sqe* get_sqe();
+        unsigned pending_submissions() const;
+        bool completions_ready() const;
+        void enter(unsigned to_submit, unsigned min_complete, timespec const* timeout);
+
+    private:
+        file_descriptor fd_;
+
+        void* sq_ring_;
+        size_t sq_ring_size_;
+        void* cq_ring_;
+        size_t cq_ring_size_;
+        io_uring_sqe* sqes_;
+        size_t sqes_size_;
+
+        unsigned* sq_head_;
+        unsigned* sq_tail_;
+        unsigned sq_mask_;
+        unsigned sq_entries_;
+        unsigned sq_local_tail_;
+
+        unsigned* cq_head_;
+        unsigned* cq_tail_;
+        unsigned cq_mask_;
+        io_uring_cqe* cqes_;
+
+        std::vector<slot> slots_;
+        std::vector<int> rearm_;
+    };
+}
+
+#endif // URING_H
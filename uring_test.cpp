@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <iostream>
+#include <memory>
+#include "uring.h"
+
+namespace
+{
+    std::pair<file_descriptor, file_descriptor> make_socket_pair()
+    {
+        int fds[2];
+        int res = ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds);
+        EXPECT_EQ(res, 0);
+        return std::make_pair(file_descriptor(fds[0]), file_descriptor(fds[1]));
+    }
+
+    // nullptr when the kernel doesn't support io_uring
+    std::unique_ptr<sysapi::uring_poller> make_poller()
+    {
+        try
+        {
+            return std::unique_ptr<sysapi::uring_poller>(new sysapi::uring_poller(64));
+        }
+        catch (std::exception const& e)
+        {
+            std::cerr << "io_uring is not available, skipped: " << e.what() << std::endl;
+            return nullptr;
+        }
+    }
+}
+
+TEST(uring_poller, level01)
+{
+    auto p = make_poller();
+    if (!p)
+        return;
+
+    auto fds = make_socket_pair();
+    write(fds.second, "x", 1);
+    int a = 0;
+    p->add(fds.first.getfd(), EPOLLIN, &a);
+
+    // single shot poll, rearmed by the next wait while still readable
+    epoll_event events[4];
+    for (int i = 0; i != 3; ++i)
+    {
+        ASSERT_EQ(p->wait(events, 4, nullptr), 1u);
+        EXPECT_EQ(events[0].data.ptr, &a);
+        EXPECT_TRUE(events[0].events & EPOLLIN);
+    }
+}
+
+TEST(uring_poller, stale01)
+{
+    auto p = make_poller();
+    if (!p)
+        return;
+
+    auto fds = make_socket_pair();
+    write(fds.second, "x", 1);
+    int a = 0;
+    int b = 0;
+
+    // the first request completes right away when it is submitted
+    // together with its removal, only the completion of the replacement
+    // is reported
+    p->add(fds.first.getfd(), EPOLLIN, &a);
+    p->modify(fds.first.getfd(), EPOLLIN, &b);
+
+    epoll_event events[4];
+    ASSERT_EQ(p->wait(events, 4, nullptr), 1u);
+    EXPECT_EQ(events[0].data.ptr, &b);
+}
+
+TEST(uring_poller, stale02)
+{
+    auto p = make_poller();
+    if (!p)
+        return;
+
+    epoll_event events[4];
+    timespec zero{0, 0};
+    timespec short_timeout{0, 20 * 1000 * 1000};
+
+    int old_fd;
+    int a = 0;
+    {
+        auto first = make_socket_pair();
+        old_fd = first.first.getfd();
+        p->add(old_fd, EPOLLIN | EPOLLET, &a);
+        EXPECT_EQ(p->wait(events, 4, &zero), 0u);
+
+        // the multishot request posts a completion as soon as the data
+        // arrives, before the descriptor is removed and its number reused
+        write(first.second, "x", 1);
+        p->remove(old_fd);
+    }
+
+    auto second = make_socket_pair();
+    ASSERT_EQ(second.first.getfd(), old_fd);
+    int b = 0;
+    p->add(second.first.getfd(), EPOLLIN | EPOLLET, &b);
+
+    EXPECT_EQ(p->wait(events, 4, &short_timeout), 0u);
+}